@@ -0,0 +1,458 @@
+//
+// Coroutine Waiting Support
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_ASYNC_H_
+#define EVENK_ASYNC_H_
+
+//
+// The basis for C++20 co_await support. A coroutine that has to wait for a
+// queue or a lock does not block its thread. Instead it parks a waiter record
+// in a global table keyed by address, much like parking_lot does for threads.
+// The record lives in the awaiter object, that is in the coroutine frame, so
+// parking never allocates.
+//
+// When the awaited address changes the thread that changes it unparks the
+// waiters. Every unparked waiter gets a wake call on that thread. The call
+// either completes the operation and resumes the coroutine right there or
+// parks the waiter again.
+//
+// A resumed coroutine might in turn wake another one, e.g. when it releases
+// a lock it has been handed. To keep the stack from growing with every such
+// hand-off a resume call made from within a resumed coroutine is deferred
+// until the outer one suspends or finishes. The deferred coroutines are run
+// in order by the outermost resume call.
+//
+// Nothing here depends on the <coroutine> header. An awaiter accepts any
+// coroutine handle type with its await_suspend() template. So the headers
+// still build as C++14 while the awaiters only come to use in C++20 code.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#include "backoff.h"
+#include "basic.h"
+#include "futex.h"
+#include "spinlock.h"
+#include "synch.h"
+
+namespace evenk {
+
+class async_waiter;
+
+namespace detail {
+
+struct async_resume_queue
+{
+	bool active = false;
+	async_waiter *head = nullptr;
+	async_waiter *tail = nullptr;
+
+	static async_resume_queue &local() noexcept
+	{
+		static thread_local async_resume_queue queue;
+		return queue;
+	}
+};
+
+} // namespace detail
+
+class async_waiter
+{
+public:
+	using wake_function = void (*)(async_waiter &);
+
+	explicit async_waiter(wake_function wake) noexcept : wake_(wake)
+	{
+	}
+
+	// An awaiter is returned by value so it has to be copyable in C++14.
+	// But it is never copied after it has been parked.
+	async_waiter(const async_waiter &other) noexcept : wake_(other.wake_)
+	{
+	}
+	async_waiter &operator=(const async_waiter &) = delete;
+
+	template <typename Handle>
+	void set_handle(Handle handle) noexcept
+	{
+		handle_ = handle.address();
+		resume_ = &resume_handle<Handle>;
+	}
+
+	void resume()
+	{
+		detail::async_resume_queue &queue = detail::async_resume_queue::local();
+		if (queue.active) {
+			next_ = nullptr;
+			if (queue.tail == nullptr)
+				queue.head = this;
+			else
+				queue.tail->next_ = this;
+			queue.tail = this;
+			return;
+		}
+
+		// The waiter lives in the coroutine frame so it must not be
+		// touched after the coroutine is resumed.
+		queue.active = true;
+		try {
+			async_waiter *waiter = this;
+			do {
+				waiter->resume_(waiter->handle_);
+				waiter = queue.head;
+				if (waiter != nullptr) {
+					queue.head = waiter->next_;
+					if (queue.head == nullptr)
+						queue.tail = nullptr;
+				}
+			} while (waiter != nullptr);
+		} catch (...) {
+			// The rest is left for the next resume call.
+			queue.active = false;
+			throw;
+		}
+		queue.active = false;
+	}
+
+private:
+	friend class async_parking_lot;
+
+	template <typename Handle>
+	static void resume_handle(void *address)
+	{
+		Handle::from_address(address).resume();
+	}
+
+	const wake_function wake_;
+
+	void *handle_ = nullptr;
+	void (*resume_)(void *) = nullptr;
+
+	const void *address_ = nullptr;
+	async_waiter *next_ = nullptr;
+};
+
+namespace detail {
+
+struct alignas(cache_line_size) async_bucket
+{
+	tatas_lock lock;
+	async_waiter *head = nullptr;
+	async_waiter *tail = nullptr;
+};
+
+} // namespace detail
+
+class async_parking_lot
+{
+public:
+	static constexpr unsigned bucket_bits = 8;
+	static constexpr std::size_t bucket_count = std::size_t(1) << bucket_bits;
+
+	async_parking_lot() = delete;
+
+	// Park the waiter at the given address if the validate function returns
+	// true. The function is called with the bucket lock held so it runs
+	// atomically with respect to unpark calls. Once parked the waiter might
+	// be woken at any moment so the caller should not touch it any more.
+	template <typename Validate>
+	static bool park(const void *address, async_waiter &waiter, Validate validate)
+	{
+		detail::async_bucket &bucket = address_bucket(address);
+
+		bucket.lock.lock(yield_backoff{});
+		if (!validate()) {
+			bucket.lock.unlock();
+			return false;
+		}
+		waiter.address_ = address;
+		waiter.next_ = nullptr;
+		if (bucket.tail == nullptr)
+			bucket.head = &waiter;
+		else
+			bucket.tail->next_ = &waiter;
+		bucket.tail = &waiter;
+		bucket.lock.unlock();
+		return true;
+	}
+
+	// Wake the first waiter parked at the given address. Returns false if
+	// there are no such waiters.
+	static bool unpark_one(const void *address)
+	{
+		detail::async_bucket &bucket = address_bucket(address);
+
+		bucket.lock.lock(yield_backoff{});
+		async_waiter *prev = nullptr;
+		async_waiter *waiter = bucket.head;
+		while (waiter != nullptr && waiter->address_ != address) {
+			prev = waiter;
+			waiter = waiter->next_;
+		}
+		if (waiter != nullptr)
+			unlink(bucket, prev, waiter);
+		bucket.lock.unlock();
+
+		if (waiter == nullptr)
+			return false;
+		waiter->wake_(*waiter);
+		return true;
+	}
+
+	// Wake all the waiters parked at the given address. Returns their number.
+	static std::size_t unpark_all(const void *address)
+	{
+		detail::async_bucket &bucket = address_bucket(address);
+
+		bucket.lock.lock(yield_backoff{});
+		async_waiter *list = nullptr;
+		async_waiter **list_tail = &list;
+		async_waiter *prev = nullptr;
+		async_waiter *waiter = bucket.head;
+		while (waiter != nullptr) {
+			async_waiter *next = waiter->next_;
+			if (waiter->address_ != address) {
+				prev = waiter;
+			} else {
+				unlink(bucket, prev, waiter);
+				*list_tail = waiter;
+				list_tail = &waiter->next_;
+			}
+			waiter = next;
+		}
+		bucket.lock.unlock();
+
+		// A wake call might park the waiter again and so change its
+		// link. Therefore fetch the link in advance.
+		std::size_t count = 0;
+		while (list != nullptr) {
+			async_waiter *next = list->next_;
+			list->wake_(*list);
+			list = next;
+			count++;
+		}
+		return count;
+	}
+
+private:
+	static void
+	unlink(detail::async_bucket &bucket, async_waiter *prev, async_waiter *waiter) noexcept
+	{
+		if (prev == nullptr)
+			bucket.head = waiter->next_;
+		else
+			prev->next_ = waiter->next_;
+		if (bucket.tail == waiter)
+			bucket.tail = prev;
+		waiter->next_ = nullptr;
+	}
+
+	static detail::async_bucket &address_bucket(const void *address) noexcept
+	{
+		static detail::async_bucket buckets[bucket_count];
+
+		// Fibonacci hashing.
+		std::uint64_t key = reinterpret_cast<std::uintptr_t>(address);
+		key *= UINT64_C(0x9e3779b97f4a7c15);
+		return buckets[key >> (64 - bucket_bits)];
+	}
+};
+
+//
+// A futex_lock that coroutines might acquire as well: co_await
+// lock.async_lock(). If the lock is busy the coroutine is parked and later
+// resumed by an unlock call on the unlocking thread with the lock already
+// acquired. If that thread runs a coroutine itself the resumption is deferred
+// until the coroutine suspends.
+//
+// This is a separate type so that plain futex_lock users do not pay for the
+// waiter count and the unlock check.
+//
+
+class async_futex_lock : non_copyable
+{
+public:
+	using native_handle_type = futex_t &;
+
+	constexpr async_futex_lock() noexcept = default;
+
+	void lock() noexcept
+	{
+		lock_.lock();
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff) noexcept
+	{
+		lock_.lock(backoff);
+	}
+
+	bool try_lock() noexcept
+	{
+		return lock_.try_lock();
+	}
+
+	template <typename Duration>
+	bool try_lock_until(const steady_time_point<Duration> &abs_time) noexcept
+	{
+		return lock_.try_lock_until(abs_time);
+	}
+
+	template <typename Rep, typename Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &rel_time) noexcept
+	{
+		return lock_.try_lock_for(rel_time);
+	}
+
+	// The same as futex_lock::unlock() but it also unparks a coroutine.
+	void unlock() noexcept
+	{
+		futex_t &futex = lock_.native_handle();
+		if (futex.fetch_sub(1, std::memory_order_release) != 1) {
+			futex.store(0, std::memory_order_relaxed);
+			futex_wake(futex, 1);
+
+			// Only go to the parking lot if there are coroutines
+			// waiting. This pairs with the fence in async_lock_op.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (async_waiters_.load(std::memory_order_relaxed) != 0)
+				async_parking_lot::unpark_one(&futex);
+		}
+	}
+
+	class async_lock_op;
+	async_lock_op async_lock() noexcept;
+
+	native_handle_type native_handle() noexcept
+	{
+		return lock_.native_handle();
+	}
+
+private:
+	futex_lock lock_;
+
+	// The number of coroutines that are going to park or are parked.
+	std::atomic<std::uint32_t> async_waiters_ = ATOMIC_VAR_INIT(0);
+};
+
+class async_futex_lock::async_lock_op : public async_waiter
+{
+public:
+	explicit async_lock_op(async_futex_lock &lock) noexcept
+		: async_waiter(&wake), lock_(lock)
+	{
+	}
+
+	bool await_ready() noexcept
+	{
+		return lock_.try_lock();
+	}
+
+	template <typename Handle>
+	bool await_suspend(Handle handle) noexcept
+	{
+		set_handle(handle);
+
+		// Announce the waiter before marking the lock as contended
+		// so that the unlocking thread does not miss it.
+		lock_.async_waiters_.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return park();
+	}
+
+	void await_resume() noexcept
+	{
+	}
+
+private:
+	// Mark the lock as contended and park unless it has just got free.
+	// Returns false if the lock is acquired instead.
+	bool park() noexcept
+	{
+		futex_t &futex = lock_.native_handle();
+		for (;;) {
+			if (futex.exchange(2, std::memory_order_acquire) == 0) {
+				lock_.async_waiters_.fetch_sub(1, std::memory_order_relaxed);
+				return false;
+			}
+			if (async_parking_lot::park(&futex, *this, [&futex] {
+				    return futex.load(std::memory_order_relaxed) == 2;
+			    }))
+				return true;
+		}
+	}
+
+	static void wake(async_waiter &waiter) noexcept
+	{
+		async_lock_op &self = static_cast<async_lock_op &>(waiter);
+		if (!self.park())
+			self.resume();
+	}
+
+	async_futex_lock &lock_;
+};
+
+inline async_futex_lock::async_lock_op
+async_futex_lock::async_lock() noexcept
+{
+	return async_lock_op(*this);
+}
+
+//
+// An awaiter that moves the coroutine to a thread pool.
+//
+
+template <typename Pool>
+class async_schedule_op
+{
+public:
+	explicit async_schedule_op(Pool &pool) noexcept : pool_(pool)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	template <typename Handle>
+	void await_suspend(Handle handle)
+	{
+		pool_.submit([handle]() mutable { handle.resume(); });
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+
+private:
+	Pool &pool_;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_ASYNC_H_
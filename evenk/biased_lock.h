@@ -0,0 +1,239 @@
+//
+// Reader-Biased Shared Locks
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_BIASED_LOCK_H_
+#define EVENK_BIASED_LOCK_H_
+
+//
+// The code in this file is based on the following paper:
+//    D. Dice, A. Kogan. BRAVO -- Biased Locking for Reader-Writer Locks.
+//    USENIX ATC 2019.
+//
+// The reader_biased_lock class wraps an underlying shared lock. While the
+// lock is in the reader-biased mode readers do not touch the underlying lock
+// at all. Instead they mark their presence in one of a number of reader slots
+// that reside on separate cache lines. A thread always uses the same slot so
+// readers running on different cores rarely share a cache line.
+//
+// A writer acquires the underlying lock, revokes the bias and waits until
+// all the reader slots drain. The revocation is expensive, so the bias is
+// not restored until some time passes. The time is proportional to the cost
+// of the last revocation. Meanwhile readers have to pass through the shared
+// mode of the underlying lock.
+//
+// Unlike the original algorithm that uses a global table of reader slots the
+// slots here are owned by the lock itself. This costs some memory for each
+// lock instance but is simpler and does not introduce unrelated contention.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "backoff.h"
+#include "basic.h"
+#include "spinlock.h"
+
+namespace evenk {
+
+template <typename Lock = shared_ticket_lock, std::size_t Slots = 32>
+class reader_biased_lock : non_copyable
+{
+public:
+	using lock_type = Lock;
+
+	static_assert(Slots != 0 && (Slots & (Slots - 1)) == 0,
+		      "the number of reader slots must be a power of two");
+
+	// The bias inhibition time relative to the revocation time.
+	static constexpr std::uint32_t inhibit_factor = 9;
+
+	void lock()
+	{
+		lock(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff)
+	{
+		lock_.lock(backoff);
+		if (bias_.load(std::memory_order_relaxed)) {
+			auto start = clock::now();
+			bias_.store(false, std::memory_order_seq_cst);
+			drain(backoff);
+			auto end = clock::now();
+			auto until = end + (end - start) * inhibit_factor;
+			inhibit_until_.store(until.time_since_epoch().count(),
+					     std::memory_order_relaxed);
+		} else {
+			drain(backoff);
+		}
+	}
+
+	bool try_lock()
+	{
+		if (!lock_.try_lock())
+			return false;
+		if (!bias_.load(std::memory_order_relaxed)) {
+			if (has_readers()) {
+				lock_.unlock();
+				return false;
+			}
+			return true;
+		}
+
+		// If there are fast readers put the bias back so that a failed
+		// attempt leaves no trace. Otherwise inhibit the bias just like
+		// lock() does.
+		auto start = clock::now();
+		bias_.store(false, std::memory_order_seq_cst);
+		if (has_readers()) {
+			bias_.store(true, std::memory_order_relaxed);
+			lock_.unlock();
+			return false;
+		}
+		auto end = clock::now();
+		auto until = end + (end - start) * inhibit_factor;
+		inhibit_until_.store(until.time_since_epoch().count(),
+				     std::memory_order_relaxed);
+		return true;
+	}
+
+	void unlock()
+	{
+		lock_.unlock();
+	}
+
+	void lock_shared()
+	{
+		lock_shared(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock_shared(Backoff backoff)
+	{
+		auto &readers = thread_slot();
+		if (try_fast_lock_shared(readers))
+			return;
+
+		// While the underlying lock is held in the shared mode there is
+		// no writer. So it is safe to just mark the reader slot.
+		lock_.lock_shared(backoff);
+		readers.fetch_add(1, std::memory_order_relaxed);
+		restore_bias();
+		lock_.unlock_shared();
+	}
+
+	bool try_lock_shared()
+	{
+		auto &readers = thread_slot();
+		if (try_fast_lock_shared(readers))
+			return true;
+
+		if (!lock_.try_lock_shared())
+			return false;
+		readers.fetch_add(1, std::memory_order_relaxed);
+		restore_bias();
+		lock_.unlock_shared();
+		return true;
+	}
+
+	void unlock_shared()
+	{
+		thread_slot().fetch_sub(1, std::memory_order_release);
+	}
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct alignas(cache_line_size) slot
+	{
+		std::atomic<std::uint32_t> readers = ATOMIC_VAR_INIT(0);
+	};
+
+	slot slots_[Slots];
+
+	alignas(cache_line_size) std::atomic<bool> bias_ = ATOMIC_VAR_INIT(true);
+	std::atomic<clock::rep> inhibit_until_ = ATOMIC_VAR_INIT(0);
+
+	lock_type lock_;
+
+	static std::size_t thread_index() noexcept
+	{
+		static std::atomic<std::size_t> next_index = ATOMIC_VAR_INIT(0);
+		static thread_local std::size_t index =
+			next_index.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+
+	std::atomic<std::uint32_t> &thread_slot() noexcept
+	{
+		return slots_[thread_index() & (Slots - 1)].readers;
+	}
+
+	bool try_fast_lock_shared(std::atomic<std::uint32_t> &readers) noexcept
+	{
+		if (!bias_.load(std::memory_order_relaxed))
+			return false;
+
+		// Either the writer sees the reader mark or the reader sees
+		// the revoked bias.
+		readers.fetch_add(1, std::memory_order_seq_cst);
+		if (bias_.load(std::memory_order_seq_cst))
+			return true;
+		readers.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	void restore_bias() noexcept
+	{
+		if (bias_.load(std::memory_order_relaxed))
+			return;
+		if (clock::now().time_since_epoch().count()
+		    >= inhibit_until_.load(std::memory_order_relaxed))
+			bias_.store(true, std::memory_order_relaxed);
+	}
+
+	bool has_readers() const noexcept
+	{
+		for (std::size_t i = 0; i < Slots; i++) {
+			if (slots_[i].readers.load(std::memory_order_acquire) != 0)
+				return true;
+		}
+		return false;
+	}
+
+	template <typename Backoff>
+	void drain(Backoff &backoff)
+	{
+		for (std::size_t i = 0; i < Slots; i++) {
+			while (slots_[i].readers.load(std::memory_order_acquire) != 0)
+				backoff();
+		}
+	}
+};
+
+} // namespace evenk
+
+#endif // !EVENK_BIASED_LOCK_H_
@@ -25,16 +25,21 @@
 #ifndef EVENK_BOUNDED_QUEUE_H_
 #define EVENK_BOUNDED_QUEUE_H_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <iterator>
 #include <stdexcept>
 #include <thread>
 #include <type_traits>
 
+#include "async.h"
 #include "backoff.h"
 #include "basic.h"
 #include "conqueue.h"
 #include "futex.h"
+#include "numa.h"
 #include "synch.h"
 
 namespace evenk {
@@ -75,6 +80,44 @@ constexpr token_t ticket_mask = ~(status_mask | status_waiting | status_closed);
 // The minimum queue size that allows combined slot status and ticket encoding.
 constexpr count_t min_size = 16;
 
+// The eventcount for select_pop() on kernels without futex_waitv(). Any
+// futex slot that wakes its waiters notifies it as well. Nobody pays for
+// it beyond a fence and a load unless some select_pop() call sleeps on it.
+inline eventcount &
+select_event() noexcept
+{
+	static eventcount event;
+	return event;
+}
+
+// The number of async_pop() calls that might be parked on futex slots. Slots
+// look into the parking lot only if it is not zero so that thread-only users
+// never touch the parking lot bucket locks.
+inline std::atomic<std::size_t> &
+async_pop_waiters() noexcept
+{
+	static std::atomic<std::size_t> count = ATOMIC_VAR_INIT(0);
+	return count;
+}
+
+// Wake the coroutines parked on a futex slot if there might be any.
+inline void
+unpark_slot(futex_t &futex) noexcept
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (async_pop_waiters().load(std::memory_order_relaxed) != 0)
+		async_parking_lot::unpark_all(&futex);
+}
+
+// The flag is set once futex_waitv() is found missing. Tests might set it
+// to exercise the fallback.
+inline std::atomic<bool> &
+select_no_waitv() noexcept
+{
+	static std::atomic<bool> flag = ATOMIC_VAR_INIT(false);
+	return flag;
+}
+
 // Single-threaded slot counter.
 class counter
 {
@@ -97,6 +140,12 @@ public:
 		return true;
 	}
 
+	bool try_add(count_t count, count_t addend)
+	{
+		count_ = count + addend;
+		return true;
+	}
+
 private:
 	count_t count_ = 0;
 };
@@ -122,6 +171,13 @@ public:
 						      std::memory_order_relaxed);
 	}
 
+	bool try_add(count_t count, count_t addend)
+	{
+		return count_.compare_exchange_strong(count, count + addend,
+						      std::memory_order_relaxed,
+						      std::memory_order_relaxed);
+	}
+
 private:
 	std::atomic<count_t> count_ = {0};
 };
@@ -152,6 +208,12 @@ public:
 		return base::load(std::memory_order_relaxed);
 	}
 
+	template <typename Duration>
+	token_t wait_until(token_t, const steady_time_point<Duration> &)
+	{
+		return base::load(std::memory_order_relaxed);
+	}
+
 	void wake(token_t t)
 	{
 		store(t, std::memory_order_release);
@@ -166,6 +228,13 @@ public:
 		std::this_thread::yield();
 		return base::load(std::memory_order_relaxed);
 	}
+
+	template <typename Duration>
+	token_t wait_until(token_t, const steady_time_point<Duration> &)
+	{
+		std::this_thread::yield();
+		return base::load(std::memory_order_relaxed);
+	}
 };
 
 class futex : public spin
@@ -178,8 +247,11 @@ public:
 		while (!compare_exchange_weak(
 			       t, x, std::memory_order_relaxed, std::memory_order_relaxed))
 			x = t | detail::status_closed;
-		if ((t & detail::status_waiting) != 0)
+		if ((t & detail::status_waiting) != 0) {
 			futex_wake(*this, INT32_MAX);
+			detail::unpark_slot(native_handle());
+			detail::select_event().notify_all();
+		}
 	}
 
 	token_t wait(token_t t)
@@ -194,12 +266,93 @@ public:
 		return t;
 	}
 
+	template <typename Duration>
+	token_t wait_until(token_t t, const steady_time_point<Duration> &abs_time)
+	{
+		token_t x = t | detail::status_waiting;
+		if (compare_exchange_strong(
+			    t, x, std::memory_order_relaxed, std::memory_order_relaxed) ||
+		    t == x) {
+			futex_wait_until(*this, x, abs_time);
+			t = base::load(std::memory_order_relaxed);
+		}
+		return t;
+	}
+
 	void wake(token_t t)
 	{
 		t = exchange(t, std::memory_order_release);
-		if ((t & detail::status_waiting) != 0)
+		if ((t & detail::status_waiting) != 0) {
 			futex_wake(*this, INT32_MAX);
+			detail::unpark_slot(native_handle());
+			detail::select_event().notify_all();
+		}
+	}
+
+	// Mark the slot as having a waiter but do not wait yet. Returns false
+	// if the slot has changed from the given value.
+	bool prepare_wait(token_t &t)
+	{
+		token_t x = t | detail::status_waiting;
+		if (compare_exchange_strong(
+			    t, x, std::memory_order_relaxed, std::memory_order_relaxed) ||
+		    t == x) {
+			t = x;
+			return true;
+		}
+		return false;
+	}
+
+	futex_t &native_handle()
+	{
+		return *this;
+	}
+};
+
+// A slot that sleeps on an eventcount. Unlike the futex slot it does not
+// need an atomic read-modify-write operation to wake up a waiter.
+class event : public spin
+{
+public:
+	void close()
+	{
+		base::fetch_or(detail::status_closed, std::memory_order_relaxed);
+		event_.notify_all();
+	}
+
+	token_t wait(token_t t)
+	{
+		eventcount::key key = event_.prepare_wait();
+		token_t v = base::load(std::memory_order_acquire);
+		if (v != t) {
+			event_.cancel_wait();
+			return v;
+		}
+		event_.commit_wait(key);
+		return base::load(std::memory_order_relaxed);
+	}
+
+	template <typename Duration>
+	token_t wait_until(token_t t, const steady_time_point<Duration> &abs_time)
+	{
+		eventcount::key key = event_.prepare_wait();
+		token_t v = base::load(std::memory_order_acquire);
+		if (v != t) {
+			event_.cancel_wait();
+			return v;
+		}
+		event_.commit_wait_until(key, abs_time);
+		return base::load(std::memory_order_relaxed);
+	}
+
+	void wake(token_t t)
+	{
+		store(t, std::memory_order_release);
+		event_.notify_all();
 	}
+
+private:
+	eventcount event_;
 };
 
 template <typename Synch = default_synch>
@@ -230,6 +383,18 @@ public:
 		return v;
 	}
 
+	template <typename Duration>
+	token_t wait_until(token_t t, const steady_time_point<Duration> &abs_time)
+	{
+		lock_owner_type guard(lock_);
+		token_t v = base::load(std::memory_order_relaxed);
+		if (t == v) {
+			cond_.wait_until(guard, abs_time);
+			v = base::load(std::memory_order_relaxed);
+		}
+		return v;
+	}
+
 	void wake(token_t t)
 	{
 		lock_owner_type guard(lock_);
@@ -242,9 +407,107 @@ private:
 	cond_var_type cond_;
 };
 
-template <typename Value, typename Slot, typename ProducerCounter, typename ConsumerCounter>
+//
+// Slot layouts.
+//
+// A layout defines how ring slots are placed in memory and how tickets are
+// mapped to slots. This lets trade memory for contention explicitly.
+//
+
+// Every slot takes a separate cache line. This is the default.
+class padded_layout
+{
+public:
+	template <typename Slot, typename Value>
+	struct alignas(cache_line_size) slot : public Slot
+	{
+		Value value;
+	};
+
+	explicit padded_layout(count_t size) noexcept : mask_{size - 1}
+	{
+	}
+
+	template <typename RingSlot>
+	count_t index(count_t count) const noexcept
+	{
+		return count & mask_;
+	}
+
+private:
+	const count_t mask_;
+};
+
+// Slots are packed together. This is intended for small trivially copyable
+// values and saves lots of memory. Also sequential access from a single
+// thread touches fewer cache lines. But concurrent threads that work with
+// adjacent tickets suffer from false sharing.
+class dense_layout
+{
+public:
+	template <typename Slot, typename Value>
+	struct slot : public Slot
+	{
+		Value value;
+	};
+
+	explicit dense_layout(count_t size) noexcept : mask_{size - 1}
+	{
+	}
+
+	template <typename RingSlot>
+	count_t index(count_t count) const noexcept
+	{
+		return count & mask_;
+	}
+
+private:
+	const count_t mask_;
+};
+
+// Slots are packed together but adjacent tickets are spread across distinct
+// cache lines. For this the slot index is obtained by rotating the ticket
+// bits left by the number of bits that select a slot within a cache line.
+class spread_layout
+{
+public:
+	template <typename Slot, typename Value>
+	using slot = dense_layout::slot<Slot, Value>;
+
+	explicit spread_layout(count_t size) noexcept : mask_{size - 1}, order_{log2(size)}
+	{
+	}
+
+	template <typename RingSlot>
+	count_t index(count_t count) const noexcept
+	{
+		constexpr count_t shift = log2(cache_line_size / sizeof(RingSlot));
+		const count_t i = count & mask_;
+		if (shift == 0 || shift >= order_)
+			return i;
+		const count_t line_order = order_ - shift;
+		return ((i << shift) & mask_) | (i >> line_order);
+	}
+
+private:
+	static constexpr count_t log2(std::size_t n) noexcept
+	{
+		return n < 2 ? 0 : 1 + log2(n / 2);
+	}
+
+	const count_t mask_;
+	const count_t order_;
+};
+
+template <typename Value,
+	  typename Slot,
+	  typename ProducerCounter,
+	  typename ConsumerCounter,
+	  typename Layout = padded_layout>
 class ring : non_copyable
 {
+	using ring_slot = typename Layout::template slot<Slot, Value>;
+
 public:
 	using value_type = Value;
 	using reference = value_type &;
@@ -255,10 +518,18 @@ public:
 	static_assert(std::is_nothrow_destructible<value_type>::value,
 		      "value_type must be nothrow-destructible");
 
-	ring(count_t size) : ring_{create(size)}, mask_{size - 1}
+	ring(count_t size) : ring_{create(size)}, mask_{size - 1}, layout_{size}
+	{
+		for (count_t i = 0; i < size; i++)
+			slot_at(i).init(i & detail::ticket_mask);
+	}
+
+	// Place the ring memory according to a NUMA policy.
+	ring(count_t size, const numa_policy &policy)
+		: ring_{create(size, &policy)}, mask_{size - 1}, layout_{size}, numa_{true}
 	{
 		for (count_t i = 0; i < size; i++)
-			ring_[i].init(i & detail::ticket_mask);
+			slot_at(i).init(i & detail::ticket_mask);
 	}
 
 	~ring()
@@ -297,7 +568,7 @@ public:
 
 		// Wake up possibly sleeping producers and consumers.
 		for (count_t i = 0; i < size; i++) {
-			ring_slot &slot = ring_[(last_ + i) & mask_];
+			ring_slot &slot = slot_at(last_ + i);
 			slot.close();
 		}
 	}
@@ -367,7 +638,7 @@ public:
 	{
 		const count_t count = tail_.fetch_add(1);
 		const token_t token = count & detail::ticket_mask;
-		ring_slot &slot = ring_[count & mask_];
+		ring_slot &slot = slot_at(count);
 
 		auto status = wait_tail(slot, count, token, std::forward<Backoff>(backoff)...);
 		if (status != queue_op_status::success)
@@ -382,7 +653,7 @@ public:
 	{
 		const count_t count = tail_.fetch_add(1);
 		const token_t token = count & detail::ticket_mask;
-		ring_slot &slot = ring_[count & mask_];
+		ring_slot &slot = slot_at(count);
 
 		auto status = wait_tail(slot, count, token, std::forward<Backoff>(backoff)...);
 		if (status != queue_op_status::success)
@@ -398,7 +669,7 @@ public:
 		for (;;) {
 			const count_t count = head_.fetch_add(1);
 			const token_t token = count & detail::ticket_mask;
-			ring_slot &slot = ring_[count & mask_];
+			ring_slot &slot = slot_at(count);
 
 			auto status = wait_head(slot, count, token, std::forward<Backoff>(backoff)...);
 			if (status != queue_op_status::success) {
@@ -415,122 +686,699 @@ public:
 	}
 
 	//
-	// Non-waiting operations
+	// Bulk operations
+	//
+	// These claim a range of tickets with a single counter update and then
+	// fill or drain the corresponding slots one by one. This saves a lot
+	// of contended RMW operations when values come in batches.
 	//
 
-	queue_op_status try_push(const value_type &value)
+	// Push all the values from the given range. If the queue gets closed
+	// meanwhile then some leading part of the range might still be pushed
+	// before returning queue_op_status::closed.
+	template <typename ForwardIt, typename... Backoff>
+	queue_op_status wait_push_bulk(ForwardIt first, ForwardIt last, Backoff &&... backoff)
 	{
-		const count_t count = tail_.load(std::memory_order_relaxed);
-		const token_t token = count & detail::ticket_mask;
-		ring_slot &slot = ring_[count & mask_];
+		const count_t n = count_t(std::distance(first, last));
+		if (n == 0)
+			return queue_op_status::success;
 
-		token_t t = slot.load();
-		if ((t & detail::ticket_mask) != token) {
-			if (is_past_last(count))
-				return queue_op_status::closed;
-			return queue_op_status::empty;
+		const count_t count = tail_.fetch_add(n);
+		count_t next = 0;
+		try {
+			for (count_t i = 0; i < n; i++, ++first) {
+				const count_t c = count + i;
+				const token_t token = c & detail::ticket_mask;
+				ring_slot &slot = slot_at(c);
+
+				auto status = wait_tail(slot, c, token, backoff...);
+				if (status != queue_op_status::success)
+					return status;
+
+				auto &&value = *first;
+				next = i + 1;
+				put_value(slot, token, std::forward<decltype(value)>(value));
+			}
+		} catch (...) {
+			// On failure put_value() marks its slot as invalid. The
+			// rest of the claimed slots must be marked the same way
+			// so that consumers do not get stuck on them.
+			for (; next < n; next++) {
+				const count_t c = count + next;
+				const token_t token = c & detail::ticket_mask;
+				ring_slot &slot = slot_at(c);
+				if (wait_tail(slot, c, token) != queue_op_status::success)
+					break;
+				slot.wake(token | detail::status_invalid);
+			}
+			throw;
 		}
+		return queue_op_status::success;
+	}
 
-		if (!head_.try_increment(count))
-			return queue_op_status::full;
+	// Pop up to max values to the given output iterator. Waits until at
+	// least one value is available and takes as many as there are at the
+	// moment. Returns the number of popped values. It is zero only if the
+	// queue is closed and drained (or if max is zero).
+	template <typename OutputIt, typename... Backoff>
+	std::size_t wait_pop_bulk(OutputIt out, std::size_t max, Backoff &&... backoff)
+	{
+		if (max == 0)
+			return 0;
 
-		put_value(slot, token, value);
-		return queue_op_status::success;
+		for (;;) {
+			// Unlike producers that have to wait for free slots anyway
+			// consumers take only the slots that are already filled.
+			// Otherwise a consumer might sit on the values it got while
+			// waiting for the rest of its range. The slot tokens are
+			// checked rather than the tail counter as the latter is
+			// not atomic in the single-producer case.
+			const count_t count = head_.load();
+			const count_t limit = count_t(std::min<std::size_t>(max, mask_ + 1));
+			count_t n = 1;
+			while (n < limit && is_filled(count + n))
+				n++;
+			if (!head_.try_add(count, n))
+				continue;
+
+			std::size_t popped = 0;
+			count_t next = 0;
+			try {
+				for (count_t i = 0; i < n; i++) {
+					const count_t c = count + i;
+					const token_t token = c & detail::ticket_mask;
+					ring_slot &slot = slot_at(c);
+
+					auto status = wait_head(slot, c, token, backoff...);
+					if (status == queue_op_status::closed)
+						return popped;
+
+					next = i + 1;
+					if (status == queue_op_status::empty) {
+						slot.wake(token + mask_ + 1);
+						continue;
+					}
+
+					value_type value;
+					get_value(slot, token, value);
+					*out = std::move(value);
+					++out;
+					popped++;
+				}
+			} catch (...) {
+				// Release the rest of the claimed slots so that the
+				// queue stays usable. Their values are lost.
+				for (; next < n; next++) {
+					const count_t c = count + next;
+					const token_t token = c & detail::ticket_mask;
+					ring_slot &slot = slot_at(c);
+					auto status = wait_head(slot, c, token);
+					if (status == queue_op_status::closed)
+						break;
+					slot.wake(token + mask_ + 1);
+				}
+				throw;
+			}
+			if (popped)
+				return popped;
+		}
 	}
 
-	queue_op_status try_push(value_type &&value)
+	//
+	// Zero-copy operations
+	//
+	// These give direct access to the value in a ring slot. A producer
+	// gets a handle to a slot with reserve_push(), fills the value in
+	// place and then makes it visible to consumers with commit(). A
+	// consumer gets a handle to a filled slot with acquire_pop(), uses
+	// the value in place and then frees the slot with release().
+	//
+	// The slots always hold live default-constructed values so a value
+	// should be either assigned to or built with emplace() rather than
+	// with a bare placement new.
+	//
+	// If a push handle is dropped without commit() the slot is marked
+	// invalid and consumers skip it. If a pop handle is dropped without
+	// release() the slot is released anyway.
+	//
+
+	class push_handle : non_copyable
 	{
-		const count_t count = tail_.load(std::memory_order_relaxed);
-		const token_t token = count & detail::ticket_mask;
-		ring_slot &slot = ring_[count & mask_];
+	public:
+		push_handle() noexcept = default;
 
-		token_t t = slot.load();
-		if ((t & detail::ticket_mask) != token) {
-			if (is_past_last(count))
-				return queue_op_status::closed;
-			return queue_op_status::empty;
+		push_handle(push_handle &&other) noexcept
+			: slot_{other.slot_}, token_{other.token_}, status_{other.status_}
+		{
+			other.slot_ = nullptr;
 		}
 
-		if (!head_.try_increment(count))
-			return queue_op_status::full;
+		push_handle &operator=(push_handle &&other) noexcept
+		{
+			if (this != &other) {
+				cancel();
+				slot_ = other.slot_;
+				token_ = other.token_;
+				status_ = other.status_;
+				other.slot_ = nullptr;
+			}
+			return *this;
+		}
 
-		put_value(slot, token, std::move(value));
-		return queue_op_status::success;
-	}
+		~push_handle()
+		{
+			cancel();
+		}
 
-	queue_op_status try_pop(value_type &value)
-	{
-		const count_t count = head_.load(std::memory_order_relaxed);
-		const token_t token = count & detail::ticket_mask;
-		ring_slot &slot = ring_[count & mask_];
+		queue_op_status status() const noexcept
+		{
+			return status_;
+		}
 
-		token_t t = slot.load();
-		if ((t & detail::ticket_mask) != token || (t & detail::status_mask) == 0) {
-			if (is_past_last(count))
-				return queue_op_status::closed;
-			return queue_op_status::empty;
+		explicit operator bool() const noexcept
+		{
+			return slot_ != nullptr;
 		}
 
-		if (!head_.try_increment(count))
-			return queue_op_status::empty;
+		value_type *data() const noexcept
+		{
+			return &slot_->value;
+		}
 
-		if ((t & detail::status_valid) == 0) {
-			slot.wake(token + mask_ + 1);
-			return queue_op_status::empty;
+		value_type &value() const noexcept
+		{
+			return slot_->value;
 		}
 
-		get_value(slot, token, value);
-		return queue_op_status::success;
-	}
+		// Replace the slot value with a new one constructed in place.
+		// If the construction throws then the slot gets a default value
+		// which therefore must not throw.
+		template <typename... Args>
+		void emplace(Args &&... args)
+		{
+			static_assert(std::is_nothrow_default_constructible<value_type>::value,
+				      "emplace() needs a nothrow default constructor");
+			value_type *p = data();
+			p->~value_type();
+			try {
+				new (p) value_type(std::forward<Args>(args)...);
+			} catch (...) {
+				new (p) value_type();
+				throw;
+			}
+		}
 
-#if 0 && ENABLE_QUEUE_NONBLOCKING_OPS
-	//
-	// Non-blocking operations
-	//
+		void commit() noexcept
+		{
+			slot_->wake(token_ | detail::status_valid);
+			slot_ = nullptr;
+		}
 
-	queue_op_status nonblocking_pop(value_type &value)
-	{
-	}
-#endif
+	private:
+		friend class ring;
 
-private:
-	struct alignas(cache_line_size) ring_slot : public Slot
-	{
-		value_type value;
+		push_handle(queue_op_status status) noexcept : status_{status}
+		{
+		}
+
+		push_handle(ring_slot *slot, token_t token) noexcept
+			: slot_{slot}, token_{token}, status_{queue_op_status::success}
+		{
+		}
+
+		void cancel() noexcept
+		{
+			if (slot_ != nullptr) {
+				slot_->wake(token_ | detail::status_invalid);
+				slot_ = nullptr;
+			}
+		}
+
+		ring_slot *slot_ = nullptr;
+		token_t token_ = 0;
+		queue_op_status status_ = queue_op_status::closed;
 	};
 
-	static ring_slot* create(std::size_t size)
+	class pop_handle : non_copyable
 	{
-		if (size < detail::min_size)
-			throw std::invalid_argument(
-				"bounded_queue size must be at least" + std::to_string(detail::min_size));
-		if ((size & (size - 1)) != 0)
-			throw std::invalid_argument(
-				"bounded_queue size must be a power of two");
+	public:
+		pop_handle() noexcept = default;
 
-		void *ring = cache_aligned_alloc(size * sizeof(ring_slot));
-		return new (ring) ring_slot[size];
-	}
+		pop_handle(pop_handle &&other) noexcept
+			: slot_{other.slot_}, next_{other.next_}, status_{other.status_}
+		{
+			other.slot_ = nullptr;
+		}
 
-	void destroy()
-	{
-		const count_t size = mask_ + 1;
-		for (count_t i = 0; i < size; i++)
-			ring_[i].~ring_slot();
-		std::free(ring_);
-	}
+		pop_handle &operator=(pop_handle &&other) noexcept
+		{
+			if (this != &other) {
+				release();
+				slot_ = other.slot_;
+				next_ = other.next_;
+				status_ = other.status_;
+				other.slot_ = nullptr;
+			}
+			return *this;
+		}
 
-	// FIXME: If somebody incessantly does wait_push() or wait_pop() despite
-	// getting queue_op_status::closed then after 2^31 calls this check will
-	// produce a wrong result.
-	bool is_past_last(count_t count)
-	{
-		if (closed_.load(std::memory_order_acquire) != detail::closed)
-			return false;
-		return std::make_signed_t<count_t>(last_ - count) <= 0;
-	}
+		~pop_handle()
+		{
+			release();
+		}
 
-	queue_op_status wait_tail(ring_slot &slot, const count_t count, const token_t token)
+		queue_op_status status() const noexcept
+		{
+			return status_;
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return slot_ != nullptr;
+		}
+
+		value_type *data() const noexcept
+		{
+			return &slot_->value;
+		}
+
+		value_type &value() const noexcept
+		{
+			return slot_->value;
+		}
+
+		// Free the slot. The value is moved from first, just like with
+		// a plain pop, so that it does not hold on to its resources until
+		// the slot is reused.
+		void release() noexcept
+		{
+			if (slot_ != nullptr) {
+				discard(slot_->value);
+				slot_->wake(next_);
+				slot_ = nullptr;
+			}
+		}
+
+	private:
+		friend class ring;
+
+		pop_handle(queue_op_status status) noexcept : status_{status}
+		{
+		}
+
+		static void discard(value_type &value) noexcept
+		{
+			try {
+				value_type discarded = std::move(value);
+				static_cast<void>(discarded);
+			} catch (...) {
+				// Keep the value as is.
+			}
+		}
+
+		pop_handle(ring_slot *slot, token_t next) noexcept
+			: slot_{slot}, next_{next}, status_{queue_op_status::success}
+		{
+		}
+
+		ring_slot *slot_ = nullptr;
+		token_t next_ = 0;
+		queue_op_status status_ = queue_op_status::closed;
+	};
+
+	template <typename... Backoff>
+	push_handle reserve_push(Backoff &&... backoff)
+	{
+		const count_t count = tail_.fetch_add(1);
+		const token_t token = count & detail::ticket_mask;
+		ring_slot &slot = slot_at(count);
+
+		auto status = wait_tail(slot, count, token, std::forward<Backoff>(backoff)...);
+		if (status != queue_op_status::success)
+			return push_handle(status);
+
+		return push_handle(&slot, token);
+	}
+
+	template <typename... Backoff>
+	pop_handle acquire_pop(Backoff &&... backoff)
+	{
+		for (;;) {
+			const count_t count = head_.fetch_add(1);
+			const token_t token = count & detail::ticket_mask;
+			ring_slot &slot = slot_at(count);
+
+			auto status = wait_head(slot, count, token, backoff...);
+			if (status != queue_op_status::success) {
+				if (status == queue_op_status::empty) {
+					slot.wake(token + mask_ + 1);
+					continue;
+				}
+				return pop_handle(status);
+			}
+
+			return pop_handle(&slot, token + mask_ + 1);
+		}
+	}
+
+	//
+	// Timed waiting operations
+	//
+	// Unlike the plain waiting operations these do not take a ticket up
+	// front as it is impossible to give up a ticket on timeout. Instead
+	// they wait for the slot at the current head or tail to get ready and
+	// then claim it in the same way as the non-waiting operations do.
+	//
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_push_until(const value_type &value,
+			const steady_time_point<Duration> &abs_time,
+			Backoff backoff = Backoff{})
+	{
+		ring_slot *slot;
+		token_t token;
+		auto status = claim_tail(slot, token, abs_time, backoff);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(*slot, token, value);
+		return queue_op_status::success;
+	}
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_push_until(value_type &&value,
+			const steady_time_point<Duration> &abs_time,
+			Backoff backoff = Backoff{})
+	{
+		ring_slot *slot;
+		token_t token;
+		auto status = claim_tail(slot, token, abs_time, backoff);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(*slot, token, std::move(value));
+		return queue_op_status::success;
+	}
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_pop_until(value_type &value,
+		       const steady_time_point<Duration> &abs_time,
+		       Backoff backoff = Backoff{})
+	{
+		bool waiting = false;
+		for (;;) {
+			const count_t count = head_.load();
+			const token_t token = count & detail::ticket_mask;
+			ring_slot &slot = slot_at(count);
+
+			token_t t = slot.load();
+			bool ready = (t & detail::ticket_mask) == token
+				     && (t & detail::status_mask) != 0;
+			if (ready) {
+				if (!head_.try_increment(count))
+					continue;
+				if ((t & detail::status_valid) == 0) {
+					slot.wake(token + mask_ + 1);
+					continue;
+				}
+				get_value(slot, token, value);
+				return queue_op_status::success;
+			}
+
+			if (is_past_last(count))
+				return queue_op_status::closed;
+			if (count != head_.load())
+				continue;
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return queue_op_status::timeout;
+			if (waiting)
+				slot.wait_until(t, abs_time);
+			else
+				waiting = backoff();
+		}
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_push_for(const value_type &value,
+				      const std::chrono::duration<Rep, Period> &rel_time,
+				      Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_push_until(value, abs_time, backoff);
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_push_for(value_type &&value,
+				      const std::chrono::duration<Rep, Period> &rel_time,
+				      Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_push_until(std::move(value), abs_time, backoff);
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_pop_for(value_type &value,
+				     const std::chrono::duration<Rep, Period> &rel_time,
+				     Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_pop_until(value, abs_time, backoff);
+	}
+
+	//
+	// Non-waiting operations
+	//
+
+	queue_op_status try_push(const value_type &value)
+	{
+		const count_t count = tail_.load();
+		const token_t token = count & detail::ticket_mask;
+		ring_slot &slot = slot_at(count);
+
+		token_t t = slot.load();
+		if ((t & detail::ticket_mask) != token) {
+			if (is_past_last(count))
+				return queue_op_status::closed;
+			return queue_op_status::full;
+		}
+
+		if (!tail_.try_increment(count))
+			return queue_op_status::full;
+
+		put_value(slot, token, value);
+		return queue_op_status::success;
+	}
+
+	queue_op_status try_push(value_type &&value)
+	{
+		const count_t count = tail_.load();
+		const token_t token = count & detail::ticket_mask;
+		ring_slot &slot = slot_at(count);
+
+		token_t t = slot.load();
+		if ((t & detail::ticket_mask) != token) {
+			if (is_past_last(count))
+				return queue_op_status::closed;
+			return queue_op_status::full;
+		}
+
+		if (!tail_.try_increment(count))
+			return queue_op_status::full;
+
+		put_value(slot, token, std::move(value));
+		return queue_op_status::success;
+	}
+
+	queue_op_status try_pop(value_type &value)
+	{
+		const count_t count = head_.load();
+		const token_t token = count & detail::ticket_mask;
+		ring_slot &slot = slot_at(count);
+
+		token_t t = slot.load();
+		if ((t & detail::ticket_mask) != token || (t & detail::status_mask) == 0) {
+			if (is_past_last(count))
+				return queue_op_status::closed;
+			return queue_op_status::empty;
+		}
+
+		if (!head_.try_increment(count))
+			return queue_op_status::empty;
+
+		if ((t & detail::status_valid) == 0) {
+			slot.wake(token + mask_ + 1);
+			return queue_op_status::empty;
+		}
+
+		get_value(slot, token, value);
+		return queue_op_status::success;
+	}
+
+	// Prepare to wait until the head slot changes. This is used by the
+	// select_pop() function and requires futex slots. Returns false if
+	// the queue is not empty or has been closed so there is nothing to
+	// wait for.
+	bool prepare_pop_wait(futex_t *&futex, token_t &value)
+	{
+		const count_t count = head_.load();
+		const token_t token = count & detail::ticket_mask;
+		ring_slot &slot = slot_at(count);
+
+		token_t t = slot.load();
+		if ((t & detail::ticket_mask) == token && (t & detail::status_mask) != 0)
+			return false;
+		if (is_past_last(count))
+			return false;
+		if (!slot.prepare_wait(t))
+			return false;
+
+		futex = &slot.native_handle();
+		value = t;
+		return true;
+	}
+
+	//
+	// Coroutine operations
+	//
+
+	// Pop a value in a coroutine: co_await queue.async_pop(). Throws the
+	// closed status just like value_pop(). This requires futex slots. If
+	// the queue is empty the coroutine is parked on the head slot and later
+	// resumed by a push call on the pushing thread. All the coroutines that
+	// are parked on a slot are woken together so it is better to have just
+	// a few of them per queue.
+	class async_pop_op : public async_waiter
+	{
+	public:
+		explicit async_pop_op(ring &queue) noexcept : async_waiter(&wake), queue_(queue)
+		{
+		}
+
+		bool await_ready()
+		{
+			status_ = queue_.try_pop(value_);
+			return status_ != queue_op_status::empty;
+		}
+
+		template <typename Handle>
+		bool await_suspend(Handle handle)
+		{
+			set_handle(handle);
+			// Pairs with the fence in detail::unpark_slot().
+			detail::async_pop_waiters().fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return park();
+		}
+
+		value_type await_resume()
+		{
+			if (status_ != queue_op_status::success)
+				throw status_;
+			return std::move(value_);
+		}
+
+	private:
+		// Mark the head slot as waited for and park on it. The slot
+		// wakes the parked coroutines as it changes just as it wakes
+		// sleeping threads. Returns false if the operation has completed
+		// instead.
+		bool park()
+		{
+			for (;;) {
+				status_ = queue_.try_pop(value_);
+				if (status_ != queue_op_status::empty) {
+					detail::async_pop_waiters().fetch_sub(
+						1, std::memory_order_relaxed);
+					return false;
+				}
+
+				futex_t *futex;
+				token_t t;
+				if (!queue_.prepare_pop_wait(futex, t))
+					continue;
+				if (async_parking_lot::park(futex, *this, [futex, t] {
+					    return futex->load(std::memory_order_relaxed) == t;
+				    }))
+					return true;
+			}
+		}
+
+		static void wake(async_waiter &waiter)
+		{
+			async_pop_op &self = static_cast<async_pop_op &>(waiter);
+			if (!self.park())
+				self.resume();
+		}
+
+		ring &queue_;
+		queue_op_status status_ = queue_op_status::empty;
+		value_type value_;
+	};
+
+	async_pop_op async_pop() noexcept
+	{
+		return async_pop_op(*this);
+	}
+
+#if 0 && ENABLE_QUEUE_NONBLOCKING_OPS
+	//
+	// Non-blocking operations
+	//
+
+	queue_op_status nonblocking_pop(value_type &value)
+	{
+	}
+#endif
+
+private:
+
+	static ring_slot* create(std::size_t size, const numa_policy *policy = nullptr)
+	{
+		if (size < detail::min_size)
+			throw std::invalid_argument(
+				"bounded_queue size must be at least" + std::to_string(detail::min_size));
+		if ((size & (size - 1)) != 0)
+			throw std::invalid_argument(
+				"bounded_queue size must be a power of two");
+
+		void *ring;
+		if (policy != nullptr)
+			ring = numa_alloc(size * sizeof(ring_slot), *policy);
+		else
+			ring = cache_aligned_alloc(size * sizeof(ring_slot));
+		return new (ring) ring_slot[size];
+	}
+
+	void destroy()
+	{
+		const count_t size = mask_ + 1;
+		for (count_t i = 0; i < size; i++)
+			ring_[i].~ring_slot();
+		if (numa_)
+			numa_free(ring_, size * sizeof(ring_slot));
+		else
+			std::free(ring_);
+	}
+
+	ring_slot &slot_at(count_t count) noexcept
+	{
+		return ring_[layout_.template index<ring_slot>(count)];
+	}
+
+	// FIXME: If somebody incessantly does wait_push() or wait_pop() despite
+	// getting queue_op_status::closed then after 2^31 calls this check will
+	// produce a wrong result.
+	bool is_past_last(count_t count)
+	{
+		if (closed_.load(std::memory_order_acquire) != detail::closed)
+			return false;
+		return std::make_signed_t<count_t>(last_ - count) <= 0;
+	}
+
+	queue_op_status wait_tail(ring_slot &slot, const count_t count, const token_t token)
 	{
 		token_t t = slot.load();
 		while ((t & detail::ticket_mask) != token) {
@@ -559,6 +1407,39 @@ private:
 		return queue_op_status::success;
 	}
 
+	template <typename Duration, typename Backoff>
+	queue_op_status
+	claim_tail(ring_slot *&slot,
+		   token_t &token,
+		   const steady_time_point<Duration> &abs_time,
+		   Backoff &backoff)
+	{
+		bool waiting = false;
+		for (;;) {
+			const count_t count = tail_.load();
+			token = count & detail::ticket_mask;
+			slot = &slot_at(count);
+
+			token_t t = slot->load();
+			if ((t & detail::ticket_mask) == token) {
+				if (tail_.try_increment(count))
+					return queue_op_status::success;
+				continue;
+			}
+
+			if (is_past_last(count))
+				return queue_op_status::closed;
+			if (count != tail_.load())
+				continue;
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return queue_op_status::timeout;
+			if (waiting)
+				slot->wait_until(t, abs_time);
+			else
+				waiting = backoff();
+		}
+	}
+
 	queue_op_status wait_head(ring_slot &slot, count_t count, token_t token)
 	{
 		token_t t = slot.load();
@@ -577,6 +1458,14 @@ private:
 		return queue_op_status::success;
 	}
 
+	// Check if a slot is already filled for the given ticket.
+	bool is_filled(count_t count)
+	{
+		const token_t t = slot_at(count).load();
+		return (t & detail::ticket_mask) == (count & detail::ticket_mask)
+		       && (t & detail::status_mask) != 0;
+	}
+
 	template <typename Backoff>
 	queue_op_status wait_head(ring_slot &slot, count_t count, token_t token, Backoff backoff)
 	{
@@ -678,6 +1567,8 @@ private:
 
 	ring_slot *ring_;
 	const count_t mask_;
+	const Layout layout_;
+	const bool numa_ = false;
 
 	std::atomic<detail::close_t> closed_ = { detail::open };
 	count_t last_;
@@ -686,21 +1577,536 @@ private:
 	alignas(cache_line_size) ProducerCounter tail_;
 };
 
-// A single-producer single-consumer queue.
-template <typename Value, typename Slot = spin>
-using spsc = ring<Value, Slot, detail::counter, detail::counter>;
+//
+// Pop a value from the first non-empty queue of several ones. The queues are
+// tried in the argument order so it might be used to assign priorities. The
+// index of the queue is returned along with the value. The closed status is
+// returned only when all the queues are closed and empty.
+//
+// The queues must use futex slots. If the kernel supports futex_waitv() then
+// the caller sleeps on the head slots of all the queues at once and on wakeup
+// goes straight to the queue that caused it. Otherwise it sleeps on the head
+// slots one at a time for a short while.
+//
 
-// A single-producer multi-consumer queue.
-template <typename Value, typename Slot = spin>
-using spmc = ring<Value, Slot, detail::counter, detail::atomic_counter>;
+namespace detail {
 
-// A multi-producer single-consumer queue.
-template <typename Value, typename Slot = spin>
-using mpsc = ring<Value, Slot, detail::atomic_counter, detail::counter>;
+template <typename Ring>
+queue_op_status
+select_pop(std::size_t &index,
+	   typename Ring::value_type &value,
+	   Ring *const *rings,
+	   std::size_t count)
+{
+	std::atomic<bool> &no_waitv = select_no_waitv();
 
-// A multi-producer multi-consumer queue.
-template <typename Value, typename Slot = spin>
-using mpmc = ring<Value, Slot, detail::atomic_counter, detail::atomic_counter>;
+	std::size_t woken = count;
+	for (;;) {
+		if (woken < count && rings[woken]->try_pop(value) == queue_op_status::success) {
+			index = woken;
+			return queue_op_status::success;
+		}
+
+		bool closed[futex_waitv_max];
+		std::size_t closed_count = 0;
+		for (std::size_t i = 0; i < count; i++) {
+			auto status = rings[i]->try_pop(value);
+			if (status == queue_op_status::success) {
+				index = i;
+				return status;
+			}
+			closed[i] = (status == queue_op_status::closed);
+			if (closed[i])
+				closed_count++;
+		}
+		if (closed_count == count)
+			return queue_op_status::closed;
+
+		futex_waiter waiters[futex_waitv_max];
+		std::size_t waiter_rings[futex_waitv_max];
+		std::size_t n = 0;
+		for (std::size_t i = 0; i < count; i++) {
+			if (closed[i])
+				continue;
+			futex_t *futex;
+			token_t t;
+			if (!rings[i]->prepare_pop_wait(futex, t))
+				break;
+			waiters[n].init(*futex, t);
+			waiter_rings[n] = i;
+			n++;
+		}
+		if (n != count - closed_count) {
+			// Some queue has changed meanwhile.
+			woken = count;
+			continue;
+		}
+
+		if (!no_waitv.load(std::memory_order_relaxed)) {
+			int rc = futex_waitv(waiters, n);
+			if (rc >= 0) {
+				woken = waiter_rings[rc];
+				continue;
+			}
+			if (rc == -EAGAIN || rc == -EINTR) {
+				woken = count;
+				continue;
+			}
+			no_waitv.store(true, std::memory_order_relaxed);
+		}
+
+		// Without futex_waitv() sleep on the shared eventcount. The
+		// waiting bits are already set so a producer that changes any
+		// of the slots notifies it. Check the slots once again after
+		// announcing the wait to catch a change that has happened
+		// before.
+		eventcount &event = select_event();
+		auto key = event.prepare_wait();
+		woken = count;
+		for (std::size_t k = 0; k < n; k++) {
+			futex_t &futex = *reinterpret_cast<futex_t *>(waiters[k].address);
+			if (futex.load(std::memory_order_relaxed) != waiters[k].value) {
+				woken = waiter_rings[k];
+				break;
+			}
+		}
+		if (woken != count)
+			event.cancel_wait();
+		else
+			event.commit_wait(key);
+	}
+}
+
+} // namespace detail
+
+template <typename Ring, typename... Rings>
+queue_op_status
+select_pop(std::size_t &index, typename Ring::value_type &value, Ring &ring, Rings &... rings)
+{
+	static_assert(sizeof...(Rings) < futex_waitv_max, "too many queues to select from");
+	Ring *array[] = {&ring, &rings...};
+	return detail::select_pop(index, value, array, 1 + sizeof...(Rings));
+}
+
+// A single-producer single-consumer queue.
+template <typename Value, typename Slot = spin, typename Layout = padded_layout>
+using spsc = ring<Value, Slot, detail::counter, detail::counter, Layout>;
+
+// A single-producer multi-consumer queue.
+template <typename Value, typename Slot = spin, typename Layout = padded_layout>
+using spmc = ring<Value, Slot, detail::counter, detail::atomic_counter, Layout>;
+
+// A multi-producer single-consumer queue.
+template <typename Value, typename Slot = spin, typename Layout = padded_layout>
+using mpsc = ring<Value, Slot, detail::atomic_counter, detail::counter, Layout>;
+
+// A multi-producer multi-consumer queue.
+template <typename Value, typename Slot = spin, typename Layout = padded_layout>
+using mpmc = ring<Value, Slot, detail::atomic_counter, detail::atomic_counter, Layout>;
+
+//
+// A single-producer single-consumer queue with cached indices.
+//
+// Unlike the ring-based queues this one has no per-slot tokens. The producer
+// and consumer each keep a private copy of the other side's index and reload
+// the shared one only when the cached copy says that the queue is full or
+// empty. So in the steady state an operation touches only the value itself
+// and a cache line owned by the calling side.
+//
+// The waiting operations spin, possibly with backoff, there is no sleeping.
+//
+// A push that races with close() called from another thread might succeed
+// after the consumer has already seen the queue closed and empty. So if it
+// is required that every pushed value is delivered then close() should be
+// called by the producer.
+//
+
+template <typename Value>
+class cached_spsc : non_copyable
+{
+public:
+	using value_type = Value;
+	using reference = value_type &;
+	using const_reference = const value_type &;
+
+	static_assert(std::is_nothrow_default_constructible<value_type>::value,
+		      "value_type must be nothrow-default-constructible");
+	static_assert(std::is_nothrow_destructible<value_type>::value,
+		      "value_type must be nothrow-destructible");
+
+	cached_spsc(count_t size) : ring_{create(size)}, mask_{size - 1}
+	{
+	}
+
+	~cached_spsc()
+	{
+		destroy();
+	}
+
+	//
+	// State operations
+	//
+
+	void close() noexcept
+	{
+		closed_.store(true, std::memory_order_release);
+	}
+
+	bool is_closed() const noexcept
+	{
+		return closed_.load(std::memory_order_relaxed);
+	}
+
+	bool is_empty() const noexcept
+	{
+		count_t tail = tail_.load(std::memory_order_acquire);
+		count_t head = head_.load(std::memory_order_relaxed);
+		return head == tail;
+	}
+
+	bool is_full() const noexcept
+	{
+		count_t head = head_.load(std::memory_order_acquire);
+		count_t tail = tail_.load(std::memory_order_relaxed);
+		return tail - head > mask_;
+	}
+
+	static bool is_lock_free() noexcept
+	{
+		return true;
+	}
+
+	//
+	// Basic operations
+	//
+
+	template <typename... Backoff>
+	void push(const value_type &value, Backoff &&... backoff)
+	{
+		auto status = wait_push(value, std::forward<Backoff>(backoff)...);
+		if (status != queue_op_status::success)
+			throw status;
+	}
+
+	template <typename... Backoff>
+	void push(value_type &&value, Backoff &&... backoff)
+	{
+		auto status = wait_push(std::move(value), std::forward<Backoff>(backoff)...);
+		if (status != queue_op_status::success)
+			throw status;
+	}
+
+	template <typename... Backoff>
+	value_type value_pop(Backoff &&... backoff)
+	{
+		value_type value;
+		auto status = wait_pop(value, std::forward<Backoff>(backoff)...);
+		if (status != queue_op_status::success)
+			throw status;
+		return std::move(value);
+	}
+
+	//
+	// Waiting operations
+	//
+
+	template <typename... Backoff>
+	queue_op_status wait_push(const value_type &value, Backoff &&... backoff)
+	{
+		count_t tail;
+		auto status = wait_tail(tail, backoff...);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(tail, value);
+		return queue_op_status::success;
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_push(value_type &&value, Backoff &&... backoff)
+	{
+		count_t tail;
+		auto status = wait_tail(tail, backoff...);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(tail, std::move(value));
+		return queue_op_status::success;
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_pop(value_type &value, Backoff &&... backoff)
+	{
+		count_t head;
+		auto status = wait_head(head, backoff...);
+		if (status != queue_op_status::success)
+			return status;
+
+		get_value(head, value);
+		return queue_op_status::success;
+	}
+
+	//
+	// Timed waiting operations
+	//
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_push_until(const value_type &value,
+			const steady_time_point<Duration> &abs_time,
+			Backoff backoff = Backoff{})
+	{
+		count_t tail;
+		auto status = wait_tail_until(tail, abs_time, backoff);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(tail, value);
+		return queue_op_status::success;
+	}
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_push_until(value_type &&value,
+			const steady_time_point<Duration> &abs_time,
+			Backoff backoff = Backoff{})
+	{
+		count_t tail;
+		auto status = wait_tail_until(tail, abs_time, backoff);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(tail, std::move(value));
+		return queue_op_status::success;
+	}
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_pop_until(value_type &value,
+		       const steady_time_point<Duration> &abs_time,
+		       Backoff backoff = Backoff{})
+	{
+		count_t head;
+		auto status = wait_head_until(head, abs_time, backoff);
+		if (status != queue_op_status::success)
+			return status;
+
+		get_value(head, value);
+		return queue_op_status::success;
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_push_for(const value_type &value,
+				      const std::chrono::duration<Rep, Period> &rel_time,
+				      Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_push_until(value, abs_time, backoff);
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_push_for(value_type &&value,
+				      const std::chrono::duration<Rep, Period> &rel_time,
+				      Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_push_until(std::move(value), abs_time, backoff);
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_pop_for(value_type &value,
+				     const std::chrono::duration<Rep, Period> &rel_time,
+				     Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_pop_until(value, abs_time, backoff);
+	}
+
+	//
+	// Non-waiting operations
+	//
+
+	queue_op_status try_push(const value_type &value)
+	{
+		count_t tail;
+		auto status = check_tail(tail);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(tail, value);
+		return queue_op_status::success;
+	}
+
+	queue_op_status try_push(value_type &&value)
+	{
+		count_t tail;
+		auto status = check_tail(tail);
+		if (status != queue_op_status::success)
+			return status;
+
+		put_value(tail, std::move(value));
+		return queue_op_status::success;
+	}
+
+	queue_op_status try_pop(value_type &value)
+	{
+		count_t head;
+		auto status = check_head(head);
+		if (status != queue_op_status::success)
+			return status;
+
+		get_value(head, value);
+		return queue_op_status::success;
+	}
+
+private:
+	static value_type *create(count_t size)
+	{
+		if (size < 2 || (size & (size - 1)) != 0)
+			throw std::invalid_argument("cached_spsc size must be a power of two");
+
+		std::size_t bytes = size * sizeof(value_type);
+		bytes = (bytes + cache_line_size - 1) & ~(cache_line_size - 1);
+		void *ring = cache_aligned_alloc(bytes);
+		return new (ring) value_type[size];
+	}
+
+	void destroy()
+	{
+		const count_t size = mask_ + 1;
+		for (count_t i = 0; i < size; i++)
+			ring_[i].~value_type();
+		std::free(ring_);
+	}
+
+	static void pause() noexcept
+	{
+	}
+
+	template <typename Backoff>
+	static void pause(Backoff &backoff)
+	{
+		backoff();
+	}
+
+	// Check if there is a free slot. Called by the producer only.
+	queue_op_status check_tail(count_t &tail) noexcept
+	{
+		if (closed_.load(std::memory_order_relaxed))
+			return queue_op_status::closed;
+
+		tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_cache_ > mask_) {
+			head_cache_ = head_.load(std::memory_order_acquire);
+			if (tail - head_cache_ > mask_)
+				return queue_op_status::full;
+		}
+		return queue_op_status::success;
+	}
+
+	// Check if there is a value. Called by the consumer only.
+	queue_op_status check_head(count_t &head) noexcept
+	{
+		head = head_.load(std::memory_order_relaxed);
+		if (head == tail_cache_) {
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if (head == tail_cache_) {
+				if (!closed_.load(std::memory_order_acquire))
+					return queue_op_status::empty;
+				// Catch the values pushed just before close().
+				tail_cache_ = tail_.load(std::memory_order_acquire);
+				if (head == tail_cache_)
+					return queue_op_status::closed;
+			}
+		}
+		return queue_op_status::success;
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_tail(count_t &tail, Backoff &... backoff)
+	{
+		for (;;) {
+			auto status = check_tail(tail);
+			if (status != queue_op_status::full)
+				return status;
+			pause(backoff...);
+		}
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_head(count_t &head, Backoff &... backoff)
+	{
+		for (;;) {
+			auto status = check_head(head);
+			if (status != queue_op_status::empty)
+				return status;
+			pause(backoff...);
+		}
+	}
+
+	template <typename Duration, typename Backoff>
+	queue_op_status wait_tail_until(count_t &tail,
+					const steady_time_point<Duration> &abs_time,
+					Backoff &backoff)
+	{
+		for (;;) {
+			auto status = check_tail(tail);
+			if (status != queue_op_status::full)
+				return status;
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return queue_op_status::timeout;
+			backoff();
+		}
+	}
+
+	template <typename Duration, typename Backoff>
+	queue_op_status wait_head_until(count_t &head,
+					const steady_time_point<Duration> &abs_time,
+					Backoff &backoff)
+	{
+		for (;;) {
+			auto status = check_head(head);
+			if (status != queue_op_status::empty)
+				return status;
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return queue_op_status::timeout;
+			backoff();
+		}
+	}
+
+	// If the assignment throws the slot stays free and the queue intact.
+	template <typename V>
+	void put_value(count_t tail, V &&value)
+	{
+		ring_[tail & mask_] = std::forward<V>(value);
+		tail_.store(tail + 1, std::memory_order_release);
+	}
+
+	// If the assignment throws the value is lost as the slot is released
+	// anyway.
+	void get_value(count_t head, value_type &value)
+	{
+		try {
+			value = std::move(ring_[head & mask_]);
+		} catch (...) {
+			head_.store(head + 1, std::memory_order_release);
+			throw;
+		}
+		head_.store(head + 1, std::memory_order_release);
+	}
+
+	value_type *const ring_;
+	const count_t mask_;
+	std::atomic<bool> closed_ = ATOMIC_VAR_INIT(false);
+
+	// The consumer side.
+	alignas(cache_line_size) std::atomic<count_t> head_ = ATOMIC_VAR_INIT(0);
+	count_t tail_cache_ = 0;
+
+	// The producer side.
+	alignas(cache_line_size) std::atomic<count_t> tail_ = ATOMIC_VAR_INIT(0);
+	count_t head_cache_ = 0;
+};
 
 } // namespace bounded_queue
 } // namespace evenk
@@ -0,0 +1,301 @@
+//
+// NUMA-aware Cohort Locks
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_COHORT_LOCK_H_
+#define EVENK_COHORT_LOCK_H_
+
+//
+// The code in this file is based on the following paper:
+//    D. Dice, V. J. Marathe, N. Shavit. Lock Cohorting: A General Technique
+//    for Designing NUMA Locks. PPoPP 2012.
+//
+// A cohort lock consists of a global lock and a local lock per NUMA node.
+// A thread first acquires the local lock of its node and then the global
+// lock. On release, if there are other threads waiting for the same local
+// lock, the global lock is passed to them along with the local lock. This
+// way the lock stays within a single node for a while. To avoid starvation
+// of other nodes the number of such consecutive handoffs is limited.
+//
+// The global lock has to be thread-oblivious, that is it must allow to be
+// released by a thread other than the one that acquired it. The ticket_lock
+// and futex_lock classes meet this requirement.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if __linux__
+#include <sched.h>
+#endif
+
+#include "backoff.h"
+#include "basic.h"
+#include "spinlock.h"
+#include "topology.h"
+
+namespace evenk {
+
+//
+// A map from CPUs to NUMA nodes.
+//
+// By default it is taken from the topology of all the online CPUs. Another
+// topology might be given, e.g. one read from a canned sysfs tree, or a
+// directory with the /sys/devices/system/node layout. The nodes are numbered
+// densely as in cpu_topology::nodes(). Also it is possible to specify the
+// CPU to node table directly or to use a fake topology where threads rather
+// than CPUs are assigned to nodes in round-robin order. The latter is good
+// for testing on machines that have just a single node.
+//
+
+class cpu_node_map
+{
+public:
+	// The map covers all the online CPUs rather than just the allowed
+	// ones as the process affinity might change later.
+	cpu_node_map() : cpu_node_map(cpu_topology("/sys"))
+	{
+	}
+
+	explicit cpu_node_map(const cpu_topology &topology)
+		: cpu_nodes_(topology.cpuset_size()), node_count_(topology.nodes().size())
+	{
+		for (const cpu_topology::cpu_info &info : topology.cpus())
+			cpu_nodes_[info.id] = info.node;
+	}
+
+	static constexpr const char *default_sysfs_dir = "/sys/devices/system/node";
+
+	// Read the nodes listed in the possible file of the directory or, if
+	// there is no such file, the nodes from 0 up to the first missing one.
+	explicit cpu_node_map(const std::string &sysfs_dir)
+	{
+		cpuset nodes;
+		std::string list;
+		bool scan = !read_line(sysfs_dir + "/possible", list);
+		if (!scan)
+			nodes = cpuset::parse(list);
+
+		std::size_t count = 0;
+		for (std::size_t node = 0; scan || node < nodes.size(); node++) {
+			if (!scan && !nodes[node])
+				continue;
+			std::string name = "/node" + std::to_string(node) + "/cpulist";
+			if (!read_line(sysfs_dir + name, list)) {
+				if (scan)
+					break;
+				continue;
+			}
+			for (std::size_t cpu : cpuset::parse(list)) {
+				if (cpu >= cpu_nodes_.size())
+					cpu_nodes_.resize(cpu + 1);
+				cpu_nodes_[cpu] = count;
+			}
+			count++;
+		}
+		if (count)
+			node_count_ = count;
+	}
+
+	explicit cpu_node_map(std::vector<unsigned> cpu_nodes) : cpu_nodes_(std::move(cpu_nodes))
+	{
+		for (unsigned node : cpu_nodes_) {
+			if (node >= node_count_)
+				node_count_ = node + 1;
+		}
+	}
+
+	static cpu_node_map fake(std::size_t node_count)
+	{
+		cpu_node_map map{std::vector<unsigned>()};
+		map.node_count_ = node_count ? node_count : 1;
+		map.fake_ = true;
+		return map;
+	}
+
+	std::size_t node_count() const noexcept
+	{
+		return node_count_;
+	}
+
+	std::size_t cpu_node(unsigned cpu) const noexcept
+	{
+		if (cpu >= cpu_nodes_.size())
+			return 0;
+		return cpu_nodes_[cpu];
+	}
+
+	std::size_t current_node() const noexcept
+	{
+		if (fake_)
+			return fake_thread_index() % node_count_;
+#if __linux__
+		int cpu = sched_getcpu();
+		if (cpu >= 0)
+			return cpu_node(cpu);
+#endif
+		return 0;
+	}
+
+private:
+	std::vector<unsigned> cpu_nodes_;
+	std::size_t node_count_ = 1;
+	bool fake_ = false;
+
+	static bool read_line(const std::string &path, std::string &line)
+	{
+		std::ifstream file(path);
+		return file && std::getline(file, line);
+	}
+
+	static std::size_t fake_thread_index() noexcept
+	{
+		static std::atomic<std::size_t> next_index = ATOMIC_VAR_INIT(0);
+		static thread_local std::size_t index =
+			next_index.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+};
+
+template <typename GlobalLock = ticket_lock, typename LocalLock = ticket_lock>
+class cohort_lock : non_copyable
+{
+public:
+	using global_lock_type = GlobalLock;
+	using local_lock_type = LocalLock;
+
+	static constexpr std::uint32_t default_handoff_limit = 64;
+
+	explicit cohort_lock(std::uint32_t handoff_limit = default_handoff_limit)
+		: cohort_lock(cpu_node_map(), handoff_limit)
+	{
+	}
+
+	explicit cohort_lock(cpu_node_map map, std::uint32_t handoff_limit = default_handoff_limit)
+		: map_(std::move(map)), handoff_limit_(handoff_limit)
+	{
+		std::size_t count = map_.node_count();
+		void *memory = cache_aligned_alloc(count * sizeof(cohort));
+		cohorts_ = new (memory) cohort[count];
+	}
+
+	~cohort_lock() noexcept
+	{
+		std::size_t count = map_.node_count();
+		for (std::size_t i = 0; i < count; i++)
+			cohorts_[i].~cohort();
+		std::free(cohorts_);
+	}
+
+	const cpu_node_map &node_map() const noexcept
+	{
+		return map_;
+	}
+
+	void lock()
+	{
+		lock(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff)
+	{
+		std::size_t index = map_.current_node();
+		cohort &c = cohorts_[index];
+
+		c.waiting.fetch_add(1, std::memory_order_relaxed);
+		c.lock.lock(backoff);
+		c.waiting.fetch_sub(1, std::memory_order_relaxed);
+
+		if (!c.global_owned) {
+			global_.lock(backoff);
+			c.global_owned = true;
+		}
+		owner_ = index;
+	}
+
+	bool try_lock()
+	{
+		std::size_t index = map_.current_node();
+		cohort &c = cohorts_[index];
+
+		if (!c.lock.try_lock())
+			return false;
+		if (!c.global_owned) {
+			if (!global_.try_lock()) {
+				c.lock.unlock();
+				return false;
+			}
+			c.global_owned = true;
+		}
+		owner_ = index;
+		return true;
+	}
+
+	void unlock()
+	{
+		cohort &c = cohorts_[owner_];
+
+		// A waiter that is not yet counted will find the global lock
+		// released and acquire it on its own. A counted waiter surely
+		// gets the local lock and so takes over the global lock too.
+		if (c.waiting.load(std::memory_order_relaxed) != 0
+		    && ++c.handoffs < handoff_limit_) {
+			c.lock.unlock();
+			return;
+		}
+
+		c.handoffs = 0;
+		c.global_owned = false;
+		global_.unlock();
+		c.lock.unlock();
+	}
+
+private:
+	struct alignas(cache_line_size) cohort
+	{
+		local_lock_type lock;
+		std::atomic<std::uint32_t> waiting = ATOMIC_VAR_INIT(0);
+		// These fields are only accessed under the local lock.
+		std::uint32_t handoffs = 0;
+		bool global_owned = false;
+	};
+
+	global_lock_type global_;
+
+	const cpu_node_map map_;
+	const std::uint32_t handoff_limit_;
+
+	cohort *cohorts_;
+
+	// The cohort index of the current owner, it is only accessed under
+	// the lock.
+	std::size_t owner_ = 0;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_COHORT_LOCK_H_
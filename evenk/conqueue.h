@@ -42,9 +42,9 @@
 namespace evenk {
 
 #if ENABLE_QUEUE_NONBLOCKING_OPS
-enum class queue_op_status { success = 0, empty, full, closed, busy };
+enum class queue_op_status { success = 0, empty, full, closed, busy, timeout };
 #else
-enum class queue_op_status { success = 0, empty, full, closed };
+enum class queue_op_status { success = 0, empty, full, closed, timeout };
 #endif
 
 template <typename Value>
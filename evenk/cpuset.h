@@ -0,0 +1,546 @@
+//
+// Dynamic CPU Sets
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_CPUSET_H_
+#define EVENK_CPUSET_H_
+
+//
+// A set of CPU numbers of arbitrary size. Unlike the fixed cpu_set_t it is
+// not limited to CPU_SETSIZE CPUs. Where glibc provides CPU_ALLOC the bits
+// are kept in its dynamically sized cpu_set_t so they might be passed to the
+// affinity calls as is.
+//
+// The set grows as needed when CPUs are added to it. Its size() is the
+// number of CPUs it covers, not the number of CPUs in it. Sets of different
+// sizes with the same CPUs compare equal.
+//
+// Iteration goes over the CPUs in the set in increasing order.
+//
+
+#include "config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+
+#include "basic.h"
+
+namespace evenk {
+
+class cpuset
+{
+public:
+	using word_type = unsigned long;
+
+	static constexpr std::size_t word_bits = sizeof(word_type) * CHAR_BIT;
+	static constexpr std::size_t npos = std::size_t(-1);
+
+	class reference
+	{
+	public:
+		reference(cpuset &set, std::size_t cpu) noexcept : set_(set), cpu_(cpu)
+		{
+		}
+
+		operator bool() const noexcept
+		{
+			return set_.test(cpu_);
+		}
+
+		reference &operator=(bool value)
+		{
+			set_.set(cpu_, value);
+			return *this;
+		}
+
+		reference &operator=(const reference &other)
+		{
+			return *this = bool(other);
+		}
+
+	private:
+		cpuset &set_;
+		std::size_t cpu_;
+	};
+
+	class iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::size_t;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::size_t *;
+		using reference = std::size_t;
+
+		iterator(const cpuset *set, std::size_t cpu) noexcept : set_(set), cpu_(cpu)
+		{
+		}
+
+		std::size_t operator*() const noexcept
+		{
+			return cpu_;
+		}
+
+		iterator &operator++() noexcept
+		{
+			cpu_ = set_->next(cpu_ + 1);
+			return *this;
+		}
+
+		iterator operator++(int) noexcept
+		{
+			iterator tmp = *this;
+			++*this;
+			return tmp;
+		}
+
+		bool operator==(const iterator &other) const noexcept
+		{
+			return cpu_ == other.cpu_;
+		}
+
+		bool operator!=(const iterator &other) const noexcept
+		{
+			return cpu_ != other.cpu_;
+		}
+
+	private:
+		const cpuset *set_;
+		std::size_t cpu_;
+	};
+
+	cpuset() noexcept = default;
+
+	explicit cpuset(std::size_t size, bool value = false) : cpuset()
+	{
+		resize(size);
+		if (value) {
+			for (std::size_t cpu = 0; cpu < size; cpu++)
+				set(cpu);
+		}
+	}
+
+	cpuset(std::initializer_list<std::size_t> cpus) : cpuset()
+	{
+		for (std::size_t cpu : cpus)
+			set(cpu);
+	}
+
+	cpuset(const cpuset &other) : cpuset()
+	{
+		resize(other.size_);
+		copy_words(words_, other.words_, word_count(size_));
+	}
+
+	cpuset(cpuset &&other) noexcept : cpuset()
+	{
+		swap(other);
+	}
+
+	cpuset &operator=(const cpuset &other)
+	{
+		cpuset tmp(other);
+		swap(tmp);
+		return *this;
+	}
+
+	cpuset &operator=(cpuset &&other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+
+	~cpuset() noexcept
+	{
+		deallocate(words_);
+	}
+
+	void swap(cpuset &other) noexcept
+	{
+		std::swap(words_, other.words_);
+		std::swap(size_, other.size_);
+	}
+
+	//
+	// Conversion to and from the Linux list format: "0-3,8,10-15".
+	//
+
+	static cpuset parse(const std::string &list)
+	{
+		cpuset result;
+		std::size_t pos = 0;
+		while (pos < list.size()) {
+			std::size_t end = list.find(',', pos);
+			if (end == std::string::npos)
+				end = list.size();
+			std::string item = list.substr(pos, end - pos);
+			pos = end + 1;
+			if (item.empty())
+				continue;
+
+			std::size_t dash = item.find('-');
+			std::size_t first = parse_number(item.substr(0, dash));
+			std::size_t last = first;
+			if (dash != std::string::npos)
+				last = parse_number(item.substr(dash + 1));
+			if (last < first)
+				throw std::invalid_argument("cpuset: bad list range");
+			result.resize(std::max(result.size_, last + 1));
+			for (std::size_t cpu = first; cpu <= last; cpu++)
+				result.set(cpu);
+		}
+		return result;
+	}
+
+	std::string to_string() const
+	{
+		std::string result;
+		for (std::size_t first = next(0); first != npos;) {
+			std::size_t last = first;
+			while (test(last + 1))
+				last++;
+			if (!result.empty())
+				result += ',';
+			result += std::to_string(first);
+			if (last != first)
+				result += '-' + std::to_string(last);
+			first = next(last + 1);
+		}
+		return result;
+	}
+
+	//
+	// Size management.
+	//
+
+	std::size_t size() const noexcept
+	{
+		return size_;
+	}
+
+	void resize(std::size_t size)
+	{
+		std::size_t old_count = word_count(size_);
+		std::size_t new_count = word_count(size);
+		if (old_count != new_count) {
+			word_type *words = allocate(new_count);
+			copy_words(words, words_, std::min(old_count, new_count));
+			deallocate(words_);
+			words_ = words;
+		}
+		size_ = size;
+		if (size % word_bits)
+			words_[size / word_bits] &= (word_type(1) << (size % word_bits)) - 1;
+	}
+
+	// Drop the clear bits past the last CPU in the set.
+	void trim()
+	{
+		std::size_t size = 0;
+		for (std::size_t cpu : *this)
+			size = cpu + 1;
+		resize(size);
+	}
+
+	//
+	// Access to single CPUs.
+	//
+
+	bool test(std::size_t cpu) const noexcept
+	{
+		if (cpu >= size_)
+			return false;
+		return (words_[cpu / word_bits] >> (cpu % word_bits)) & 1;
+	}
+
+	void set(std::size_t cpu, bool value = true)
+	{
+		if (!value) {
+			reset(cpu);
+			return;
+		}
+		if (cpu >= size_)
+			resize(cpu + 1);
+		words_[cpu / word_bits] |= word_type(1) << (cpu % word_bits);
+	}
+
+	void reset(std::size_t cpu) noexcept
+	{
+		if (cpu < size_)
+			words_[cpu / word_bits] &= ~(word_type(1) << (cpu % word_bits));
+	}
+
+	bool operator[](std::size_t cpu) const noexcept
+	{
+		return test(cpu);
+	}
+
+	reference operator[](std::size_t cpu) noexcept
+	{
+		return reference(*this, cpu);
+	}
+
+	//
+	// Queries over the whole set.
+	//
+
+	std::size_t count() const noexcept
+	{
+		std::size_t result = 0;
+		for (std::size_t i = 0; i < word_count(size_); i++)
+			result += __builtin_popcountl(words_[i]);
+		return result;
+	}
+
+	bool any() const noexcept
+	{
+		for (std::size_t i = 0; i < word_count(size_); i++)
+			if (words_[i])
+				return true;
+		return false;
+	}
+
+	bool none() const noexcept
+	{
+		return !any();
+	}
+
+	// Find the first CPU in the set starting from the given one.
+	std::size_t next(std::size_t cpu) const noexcept
+	{
+		if (cpu >= size_)
+			return npos;
+		std::size_t i = cpu / word_bits;
+		word_type word = words_[i] & (~word_type(0) << (cpu % word_bits));
+		for (;;) {
+			if (word)
+				return i * word_bits + __builtin_ctzl(word);
+			if (++i >= word_count(size_))
+				return npos;
+			word = words_[i];
+		}
+	}
+
+	iterator begin() const noexcept
+	{
+		return iterator(this, next(0));
+	}
+
+	iterator end() const noexcept
+	{
+		return iterator(this, npos);
+	}
+
+	//
+	// Set operations.
+	//
+
+	cpuset &operator|=(const cpuset &other)
+	{
+		if (size_ < other.size_)
+			resize(other.size_);
+		for (std::size_t i = 0; i < word_count(other.size_); i++)
+			words_[i] |= other.words_[i];
+		return *this;
+	}
+
+	cpuset &operator&=(const cpuset &other) noexcept
+	{
+		for (std::size_t i = 0; i < word_count(size_); i++)
+			words_[i] &= other.word(i);
+		return *this;
+	}
+
+	// Set difference.
+	cpuset &operator-=(const cpuset &other) noexcept
+	{
+		for (std::size_t i = 0; i < word_count(size_); i++)
+			words_[i] &= ~other.word(i);
+		return *this;
+	}
+
+	friend cpuset operator|(cpuset a, const cpuset &b)
+	{
+		return a |= b;
+	}
+
+	friend cpuset operator&(cpuset a, const cpuset &b)
+	{
+		return a &= b;
+	}
+
+	friend cpuset operator-(cpuset a, const cpuset &b)
+	{
+		return a -= b;
+	}
+
+	friend bool operator==(const cpuset &a, const cpuset &b) noexcept
+	{
+		std::size_t n = std::max(word_count(a.size_), word_count(b.size_));
+		for (std::size_t i = 0; i < n; i++)
+			if (a.word(i) != b.word(i))
+				return false;
+		return true;
+	}
+
+	friend bool operator!=(const cpuset &a, const cpuset &b) noexcept
+	{
+		return !(a == b);
+	}
+
+	// The raw bits, also suitable as a node mask for the NUMA calls.
+	const word_type *data() const noexcept
+	{
+		return words_;
+	}
+
+#ifdef CPU_ALLOC
+
+	//
+	// Access for the affinity system calls.
+	//
+
+	cpu_set_t *native_handle() const noexcept
+	{
+		return reinterpret_cast<cpu_set_t *>(words_);
+	}
+
+	std::size_t native_size() const noexcept
+	{
+		return CPU_ALLOC_SIZE(word_count(size_) * word_bits);
+	}
+
+	// Get a CPU set with a call like sched_getaffinity(). The set size is
+	// not known in advance so keep doubling it while the call fails with
+	// EINVAL.
+	template <typename Query>
+	static cpuset query(Query get, const char *what)
+	{
+		std::size_t size = CPU_SETSIZE;
+		for (;;) {
+			cpuset result(size);
+			int rc = get(result.native_size(), result.native_handle());
+			if (rc == 0) {
+				result.trim();
+				return result;
+			}
+			if (rc != EINVAL || size > (std::size_t(1) << 20))
+				throw_system_error(rc, what);
+			size *= 2;
+		}
+	}
+
+	// The CPUs the process is allowed to run on. This is the mask set up
+	// by the parent process, taskset, or a cpuset cgroup of a container.
+	static cpuset process_affinity()
+	{
+		return query(
+			[](std::size_t size, cpu_set_t *set) {
+				return sched_getaffinity(0, size, set) ? errno : 0;
+			},
+			"sched_getaffinity");
+	}
+
+#else // CPU_ALLOC
+
+	static cpuset process_affinity()
+	{
+		std::size_t n = std::thread::hardware_concurrency();
+		return cpuset(n ? n : 1, true);
+	}
+
+#endif // !CPU_ALLOC
+
+private:
+	word_type *words_ = nullptr;
+	std::size_t size_ = 0;
+
+	static constexpr std::size_t word_count(std::size_t size) noexcept
+	{
+		return (size + word_bits - 1) / word_bits;
+	}
+
+	word_type word(std::size_t index) const noexcept
+	{
+		return index < word_count(size_) ? words_[index] : 0;
+	}
+
+	static word_type *allocate(std::size_t count)
+	{
+		if (count == 0)
+			return nullptr;
+#ifdef CPU_ALLOC
+		void *memory = CPU_ALLOC(count * word_bits);
+#else
+		void *memory = std::malloc(count * sizeof(word_type));
+#endif
+		if (memory == nullptr)
+			throw std::bad_alloc();
+		std::memset(memory, 0, count * sizeof(word_type));
+		return static_cast<word_type *>(memory);
+	}
+
+	static void deallocate(word_type *words) noexcept
+	{
+		if (words == nullptr)
+			return;
+#ifdef CPU_ALLOC
+		CPU_FREE(reinterpret_cast<cpu_set_t *>(words));
+#else
+		std::free(words);
+#endif
+	}
+
+	static void copy_words(word_type *dst, const word_type *src, std::size_t count) noexcept
+	{
+		if (count)
+			std::memcpy(dst, src, count * sizeof(word_type));
+	}
+
+	static std::size_t parse_number(const std::string &text)
+	{
+		if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+			throw std::invalid_argument("cpuset: bad number in list");
+		return std::stoul(text);
+	}
+
+};
+
+} // namespace evenk
+
+#endif // !EVENK_CPUSET_H_
@@ -0,0 +1,770 @@
+//
+// Stackful Fibers
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_FIBER_H_
+#define EVENK_FIBER_H_
+
+//
+// Fibers are user-mode threads with their own stacks. Unlike coroutines
+// they may block anywhere deep in a call chain so plain blocking code runs
+// on them as is. A fiber switch only saves the callee-saved registers and
+// swaps the stack pointer. So passing control to another fiber takes tens of
+// nanoseconds rather than microseconds of a futex wakeup and a kernel context
+// switch.
+//
+// A scheduler runs fibers on a fixed number of worker threads. Each worker
+// has its own run queue. A fiber is bound to a worker when it is spawned
+// and never migrates. So a fiber that is going to block might be put back
+// to the run queue by another thread even before it has switched out. The
+// worker cannot take it from the queue until the switch is complete.
+//
+// A worker with an empty run queue sleeps on a futex. So a fiber that is
+// woken by a fiber on the same worker costs nothing but a queue push and
+// a pop, while a wakeup from another worker might involve a kernel call.
+//
+// Blocking operations from synch.h and others block the whole worker. The
+// fiber_synch traits provide the locks and condition variables that block
+// just the calling fiber. These can be used with synch_queue and with the
+// bounded_queue::synch slot:
+//
+//   evenk::fiber_scheduler scheduler(4);
+//   evenk::synch_queue<int, evenk::fiber_synch> queue;
+//   scheduler.spawn([&queue] { queue.push(1); });
+//   scheduler.spawn([&queue] { std::cout << queue.value_pop(); });
+//   scheduler.join();
+//
+// Fiber stacks are mapped with mmap() and have a guard page at the bottom.
+// A NUMA policy might be given for them.
+// The context switch is written for x86-64 only.
+//
+
+#if !defined(__x86_64__)
+#error "fibers are only implemented for x86-64"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+
+#include "backoff.h"
+#include "basic.h"
+#include "futex.h"
+#include "mpsc_queue.h"
+#include "numa.h"
+#include "spinlock.h"
+#include "synch.h"
+#include "task.h"
+#include "thread.h"
+
+// Save the callee-saved registers on the current stack, store the stack
+// pointer to the first argument, load the stack pointer from the second
+// argument and restore the registers from there. The symbols are weak as
+// this header might be included in many translation units.
+asm(R"(
+	.pushsection .text
+	.weak evenk_fiber_switch
+	.type evenk_fiber_switch, @function
+	.p2align 4
+evenk_fiber_switch:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size evenk_fiber_switch, .-evenk_fiber_switch
+
+	.weak evenk_fiber_start
+	.type evenk_fiber_start, @function
+	.p2align 4
+evenk_fiber_start:
+	movq %r12, %rdi
+	jmpq *%r13
+	.size evenk_fiber_start, .-evenk_fiber_start
+	.popsection
+)");
+
+extern "C" void evenk_fiber_switch(void **save_sp, void *load_sp);
+extern "C" void evenk_fiber_start();
+
+namespace evenk {
+
+namespace detail {
+
+struct fiber_worker;
+
+struct fiber : mpsc_queue_hook
+{
+	using task_type = task<void, 2 * fptr_size>;
+	using timer_map = std::multimap<std::chrono::steady_clock::time_point, fiber *>;
+
+	fiber(task_type &&b, void *s, std::size_t n) noexcept
+		: body(std::move(b)), stack(s), stack_size(n)
+	{
+	}
+
+	task_type body;
+	void *stack;
+	std::size_t stack_size;
+
+	fiber_worker *worker = nullptr;
+	void *sp = nullptr;
+	bool done = false;
+
+	// The waiting state. A fiber that waits with a timeout might be
+	// woken both by a notification and by the timer. The one that resets
+	// the state first wakes it, the other one has to leave it alone.
+	fiber *wait_next = nullptr;
+	std::atomic<std::uint32_t> wait_state = ATOMIC_VAR_INIT(0);
+	void (*wait_cancel)(fiber &) = nullptr;
+	void *wait_object = nullptr;
+	bool timed_out = false;
+
+	bool timer_armed = false;
+	timer_map::iterator timer;
+};
+
+struct alignas(cache_line_size) fiber_worker
+{
+	intrusive_mpsc_queue<fiber> ready;
+	void *sp = nullptr;
+	fiber *current = nullptr;
+
+	// Only the worker thread itself touches the timers.
+	fiber::timer_map timers;
+};
+
+inline fiber_worker *&
+current_fiber_worker() noexcept
+{
+	static thread_local fiber_worker *worker = nullptr;
+	return worker;
+}
+
+inline fiber *
+current_fiber() noexcept
+{
+	fiber_worker *worker = current_fiber_worker();
+	return worker != nullptr ? worker->current : nullptr;
+}
+
+// Switch from the fiber back to its worker. Returns when the fiber is
+// resumed.
+inline void
+fiber_park(fiber *self) noexcept
+{
+	evenk_fiber_switch(&self->sp, self->worker->sp);
+}
+
+// Put the fiber to the run queue of its worker. This might be done from
+// any thread.
+inline void
+fiber_resume(fiber *f) noexcept
+{
+	f->worker->ready.try_push(f);
+}
+
+template <typename Duration>
+void
+fiber_arm_timer(fiber *self, const steady_time_point<Duration> &abs_time)
+{
+	auto time = std::chrono::time_point_cast<std::chrono::steady_clock::duration>(abs_time);
+	self->timer = self->worker->timers.emplace(time, self);
+	self->timer_armed = true;
+}
+
+inline void
+fiber_disarm_timer(fiber *self) noexcept
+{
+	if (self->timer_armed) {
+		self->worker->timers.erase(self->timer);
+		self->timer_armed = false;
+	}
+}
+
+} // namespace detail
+
+//
+// The fiber scheduler.
+//
+
+class fiber_scheduler : non_copyable
+{
+public:
+	static constexpr std::size_t default_stack_size = 64 * 1024;
+
+	explicit fiber_scheduler(std::size_t size, std::size_t stack_size = default_stack_size)
+		: fiber_scheduler(size, stack_size, numa_policy())
+	{
+	}
+
+	// Place the fiber stacks according to a NUMA policy.
+	fiber_scheduler(std::size_t size,
+			std::size_t stack_size,
+			const numa_policy &stack_policy)
+		: stack_policy_(stack_policy)
+	{
+		page_size_ = ::sysconf(_SC_PAGESIZE);
+		stack_size_ = (stack_size + page_size_ - 1) & ~(page_size_ - 1);
+		// Add a guard page.
+		stack_size_ += page_size_;
+
+		if (size == 0)
+			size = 1;
+		void *memory = cache_aligned_alloc(size * sizeof(detail::fiber_worker));
+		if (memory == nullptr)
+			throw std::bad_alloc();
+
+		workers_ = static_cast<detail::fiber_worker *>(memory);
+		for (; size_ < size; size_++)
+			new (&workers_[size_]) detail::fiber_worker();
+
+		threads_.reserve(size_);
+		for (std::size_t i = 0; i < size_; i++)
+			threads_.emplace_back(&fiber_scheduler::work, this, &workers_[i]);
+	}
+
+	// Wait for all the fibers and stop the worker threads.
+	~fiber_scheduler() noexcept
+	{
+		join();
+		for (std::size_t i = 0; i < size_; i++)
+			workers_[i].ready.close();
+		for (std::size_t i = 0; i < size_; i++)
+			threads_[i].join();
+
+		for (std::size_t i = 0; i < size_; i++)
+			workers_[i].~fiber_worker();
+		std::free(workers_);
+		for (void *stack : stacks_)
+			::munmap(stack, stack_size_);
+	}
+
+	std::size_t size() const noexcept
+	{
+		return size_;
+	}
+
+	thread &operator[](std::size_t index)
+	{
+		return threads_[index];
+	}
+
+	// Start a new fiber. The fibers are spread over the workers in turn.
+	template <typename Callable>
+	void spawn(Callable &&callable)
+	{
+		detail::fiber::task_type body(std::forward<Callable>(callable));
+		detail::fiber *f = create(std::move(body));
+		std::size_t index = next_worker_.fetch_add(1, std::memory_order_relaxed);
+		f->worker = &workers_[index % size_];
+
+		live_.fetch_add(1, std::memory_order_relaxed);
+		f->worker->ready.push(f);
+	}
+
+	// Wait until all the fibers finish. This includes the fibers that are
+	// spawned by other fibers in the meantime. It must not be called from
+	// a fiber.
+	void join() noexcept
+	{
+		std::uint32_t count;
+		while ((count = live_.load(std::memory_order_acquire)) != 0)
+			futex_wait(live_, count);
+	}
+
+private:
+	// The number of cached stacks.
+	static constexpr std::size_t stack_cache_size = 64;
+
+	detail::fiber_worker *workers_ = nullptr;
+	std::size_t size_ = 0;
+	std::vector<thread> threads_;
+	std::atomic<std::size_t> next_worker_ = ATOMIC_VAR_INIT(0);
+
+	std::size_t page_size_;
+	std::size_t stack_size_;
+	numa_policy stack_policy_;
+	default_synch::lock_type stacks_lock_;
+	std::vector<void *> stacks_;
+
+	alignas(cache_line_size) futex_t live_ = ATOMIC_VAR_INIT(0);
+
+	void *take_stack()
+	{
+		{
+			default_synch::lock_owner_type guard(stacks_lock_);
+			if (!stacks_.empty()) {
+				void *stack = stacks_.back();
+				stacks_.pop_back();
+				return stack;
+			}
+		}
+
+		void *stack = ::mmap(nullptr,
+				     stack_size_,
+				     PROT_READ | PROT_WRITE,
+				     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+				     -1,
+				     0);
+		if (stack == MAP_FAILED)
+			throw_system_error(errno, "mmap()");
+		if (::mprotect(stack, page_size_, PROT_NONE) != 0) {
+			int err = errno;
+			::munmap(stack, stack_size_);
+			throw_system_error(err, "mprotect()");
+		}
+		try {
+			stack_policy_.bind(stack, stack_size_);
+		} catch (...) {
+			::munmap(stack, stack_size_);
+			throw;
+		}
+		return stack;
+	}
+
+	void put_stack(void *stack) noexcept
+	{
+		{
+			default_synch::lock_owner_type guard(stacks_lock_);
+			if (stacks_.size() < stack_cache_size) {
+				stacks_.push_back(stack);
+				return;
+			}
+		}
+		::munmap(stack, stack_size_);
+	}
+
+	// Place the fiber control block at the top of its stack and below it
+	// an initial frame that evenk_fiber_switch() returns from right into
+	// evenk_fiber_start() that in turn calls entry().
+	detail::fiber *create(detail::fiber::task_type &&body)
+	{
+		void *stack = take_stack();
+#if defined(__SANITIZE_ADDRESS__)
+		// Forget the frames of a previous fiber that had the same stack.
+		ASAN_UNPOISON_MEMORY_REGION(static_cast<char *>(stack) + page_size_,
+					    stack_size_ - page_size_);
+#endif
+		char *top = static_cast<char *>(stack) + stack_size_ - sizeof(detail::fiber);
+		top = reinterpret_cast<char *>(reinterpret_cast<std::uintptr_t>(top) & ~15);
+		detail::fiber *f = new (top) detail::fiber(std::move(body), stack, stack_size_);
+
+		void **sp = reinterpret_cast<void **>(top);
+		*--sp = nullptr; // the return address of entry()
+		*--sp = reinterpret_cast<void *>(&evenk_fiber_start);
+		*--sp = nullptr; // rbp
+		*--sp = nullptr; // rbx
+		*--sp = f; // r12
+		*--sp = reinterpret_cast<void *>(&entry); // r13
+		*--sp = nullptr; // r14
+		*--sp = nullptr; // r15
+		// The default MXCSR and x87 control word.
+		*--sp = reinterpret_cast<void *>(std::uintptr_t(0x037f00001f80));
+		f->sp = sp;
+		return f;
+	}
+
+	void destroy(detail::fiber *f) noexcept
+	{
+		void *stack = f->stack;
+		f->~fiber();
+		put_stack(stack);
+
+		if (live_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			futex_wake(live_, INT32_MAX);
+	}
+
+	static void entry(void *arg) noexcept
+	{
+		detail::fiber *self = static_cast<detail::fiber *>(arg);
+		self->body();
+		self->body = detail::fiber::task_type();
+		self->done = true;
+		detail::fiber_park(self);
+		__builtin_unreachable();
+	}
+
+	// Wake the fibers with expired timers.
+	static void expire(detail::fiber_worker &worker)
+	{
+		auto now = std::chrono::steady_clock::now();
+		while (!worker.timers.empty() && worker.timers.begin()->first <= now) {
+			detail::fiber *f = worker.timers.begin()->second;
+			worker.timers.erase(worker.timers.begin());
+			f->timer_armed = false;
+			if (f->wait_state.exchange(0, std::memory_order_acq_rel) != 0) {
+				f->timed_out = true;
+				if (f->wait_cancel != nullptr)
+					f->wait_cancel(*f);
+				worker.ready.try_push(f);
+			}
+		}
+	}
+
+	void work(detail::fiber_worker *self)
+	{
+		detail::current_fiber_worker() = self;
+
+		for (;;) {
+			expire(*self);
+
+			detail::fiber *f;
+			queue_op_status status;
+			if (self->timers.empty()) {
+				status = self->ready.wait_pop(f);
+			} else {
+				auto deadline = self->timers.begin()->first;
+				status = self->ready.wait_pop_until(f, deadline);
+			}
+			if (status == queue_op_status::closed)
+				break;
+			if (status != queue_op_status::success)
+				continue;
+
+			self->current = f;
+			evenk_fiber_switch(&self->sp, f->sp);
+			self->current = nullptr;
+
+			if (f->done)
+				destroy(f);
+		}
+
+		detail::current_fiber_worker() = nullptr;
+	}
+};
+
+//
+// Operations on the current fiber. If called outside of a fiber they act
+// on the current thread.
+//
+
+namespace this_fiber {
+
+inline bool
+is_fiber() noexcept
+{
+	return detail::current_fiber() != nullptr;
+}
+
+inline void
+yield() noexcept
+{
+	detail::fiber *self = detail::current_fiber();
+	if (self == nullptr) {
+		std::this_thread::yield();
+		return;
+	}
+	detail::fiber_resume(self);
+	detail::fiber_park(self);
+}
+
+template <typename Duration>
+void
+sleep_until(const steady_time_point<Duration> &abs_time)
+{
+	detail::fiber *self = detail::current_fiber();
+	if (self == nullptr) {
+		std::this_thread::sleep_until(abs_time);
+		return;
+	}
+	self->wait_cancel = nullptr;
+	self->wait_state.store(1, std::memory_order_relaxed);
+	detail::fiber_arm_timer(self, abs_time);
+	detail::fiber_park(self);
+}
+
+template <typename Rep, typename Period>
+void
+sleep_for(const std::chrono::duration<Rep, Period> &rel_time)
+{
+	sleep_until(std::chrono::steady_clock::now() + rel_time);
+}
+
+} // namespace this_fiber
+
+//
+// A lock that blocks fibers. The lock is handed over to the first waiting
+// fiber on unlock. A plain thread might use it too but it spins waiting.
+//
+
+class fiber_mutex : non_copyable
+{
+public:
+	constexpr fiber_mutex() noexcept = default;
+
+	void lock() noexcept
+	{
+		detail::fiber *self = detail::current_fiber();
+		if (self == nullptr) {
+			while (!try_lock())
+				std::this_thread::yield();
+			return;
+		}
+
+		guard_.lock(yield_backoff{});
+		if (!locked_) {
+			locked_ = true;
+			guard_.unlock();
+			return;
+		}
+		self->wait_next = nullptr;
+		if (tail_ == nullptr)
+			head_ = self;
+		else
+			tail_->wait_next = self;
+		tail_ = self;
+		guard_.unlock();
+
+		// On return the lock is owned.
+		detail::fiber_park(self);
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff) noexcept
+	{
+		while (!try_lock()) {
+			if (backoff()) {
+				lock();
+				break;
+			}
+		}
+	}
+
+	bool try_lock() noexcept
+	{
+		guard_.lock(yield_backoff{});
+		bool acquired = !locked_;
+		locked_ = true;
+		guard_.unlock();
+		return acquired;
+	}
+
+	void unlock() noexcept
+	{
+		guard_.lock(yield_backoff{});
+		detail::fiber *next = head_;
+		if (next == nullptr) {
+			locked_ = false;
+		} else {
+			head_ = next->wait_next;
+			if (head_ == nullptr)
+				tail_ = nullptr;
+		}
+		guard_.unlock();
+
+		if (next != nullptr)
+			detail::fiber_resume(next);
+	}
+
+private:
+	tatas_lock guard_;
+	bool locked_ = false;
+	detail::fiber *head_ = nullptr;
+	detail::fiber *tail_ = nullptr;
+};
+
+//
+// A condition variable that blocks fibers. A plain thread might use it too
+// but its wait calls do not block and just return as if spuriously woken.
+//
+
+class fiber_cond_var : non_copyable
+{
+public:
+	constexpr fiber_cond_var() noexcept = default;
+
+	void wait(lock_guard<fiber_mutex> &guard) noexcept
+	{
+		fiber_mutex *owner = guard.mutex();
+		detail::fiber *self = detail::current_fiber();
+		if (self == nullptr) {
+			owner->unlock();
+			std::this_thread::yield();
+			owner->lock();
+			return;
+		}
+
+		self->wait_cancel = nullptr;
+		enqueue(self);
+		owner->unlock();
+		detail::fiber_park(self);
+		owner->lock();
+	}
+
+	template <typename Duration>
+	std::cv_status wait_until(lock_guard<fiber_mutex> &guard,
+				  const steady_time_point<Duration> &abs_time)
+	{
+		fiber_mutex *owner = guard.mutex();
+		detail::fiber *self = detail::current_fiber();
+		if (self == nullptr) {
+			owner->unlock();
+			std::this_thread::yield();
+			owner->lock();
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return std::cv_status::timeout;
+			return std::cv_status::no_timeout;
+		}
+
+		self->wait_cancel = &cancel;
+		self->wait_object = this;
+		self->timed_out = false;
+		detail::fiber_arm_timer(self, abs_time);
+		enqueue(self);
+		owner->unlock();
+		detail::fiber_park(self);
+		detail::fiber_disarm_timer(self);
+		owner->lock();
+		return self->timed_out ? std::cv_status::timeout : std::cv_status::no_timeout;
+	}
+
+	template <typename Rep, typename Period>
+	std::cv_status wait_for(lock_guard<fiber_mutex> &guard,
+				const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		return wait_until(guard, std::chrono::steady_clock::now() + rel_time);
+	}
+
+	void notify_one() noexcept
+	{
+		guard_.lock(yield_backoff{});
+		detail::fiber *next;
+		while ((next = head_) != nullptr) {
+			head_ = next->wait_next;
+			if (head_ == nullptr)
+				tail_ = nullptr;
+			if (next->wait_state.exchange(0, std::memory_order_acq_rel) != 0)
+				break;
+		}
+		guard_.unlock();
+
+		if (next != nullptr)
+			detail::fiber_resume(next);
+	}
+
+	void notify_all() noexcept
+	{
+		// Pick the fibers that are not timed out yet. A timed out
+		// fiber is not resumed until it is removed from the list with
+		// the guard lock held so it is safe to look at it here.
+		guard_.lock(yield_backoff{});
+		detail::fiber *list = nullptr;
+		detail::fiber **list_tail = &list;
+		for (detail::fiber *f = head_; f != nullptr;) {
+			detail::fiber *next = f->wait_next;
+			if (f->wait_state.exchange(0, std::memory_order_acq_rel) != 0) {
+				*list_tail = f;
+				list_tail = &f->wait_next;
+			}
+			f = next;
+		}
+		*list_tail = nullptr;
+		head_ = tail_ = nullptr;
+		guard_.unlock();
+
+		while (list != nullptr) {
+			detail::fiber *next = list->wait_next;
+			detail::fiber_resume(list);
+			list = next;
+		}
+	}
+
+private:
+	tatas_lock guard_;
+	detail::fiber *head_ = nullptr;
+	detail::fiber *tail_ = nullptr;
+
+	void enqueue(detail::fiber *self) noexcept
+	{
+		guard_.lock(yield_backoff{});
+		self->wait_state.store(1, std::memory_order_relaxed);
+		self->wait_next = nullptr;
+		if (tail_ == nullptr)
+			head_ = self;
+		else
+			tail_->wait_next = self;
+		tail_ = self;
+		guard_.unlock();
+	}
+
+	// Remove a timed out fiber from the list.
+	static void cancel(detail::fiber &f) noexcept
+	{
+		fiber_cond_var *cond = static_cast<fiber_cond_var *>(f.wait_object);
+		cond->guard_.lock(yield_backoff{});
+		detail::fiber *prev = nullptr;
+		for (detail::fiber *p = cond->head_; p != nullptr; p = p->wait_next) {
+			if (p == &f) {
+				if (prev == nullptr)
+					cond->head_ = p->wait_next;
+				else
+					prev->wait_next = p->wait_next;
+				if (cond->tail_ == p)
+					cond->tail_ = prev;
+				break;
+			}
+			prev = p;
+		}
+		cond->guard_.unlock();
+	}
+};
+
+struct fiber_synch
+{
+	using lock_type = fiber_mutex;
+	using cond_var_type = fiber_cond_var;
+	using lock_owner_type = lock_guard<fiber_mutex>;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_FIBER_H_
@@ -27,7 +27,10 @@
 
 #include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <ctime>
 
 #if __linux__
 #include <linux/futex.h>
@@ -39,6 +42,10 @@ namespace evenk {
 
 typedef std::atomic<std::uint32_t> futex_t;
 
+// The deadline type for timed waits.
+template <typename Duration = std::chrono::steady_clock::duration>
+using steady_time_point = std::chrono::time_point<std::chrono::steady_clock, Duration>;
+
 inline int
 futex_wait(futex_t &futex __attribute__((unused)), std::uint32_t value __attribute__((unused)))
 {
@@ -62,6 +69,79 @@ futex_wait(futex_t &futex __attribute__((unused)), std::uint32_t value __attribu
 #endif
 }
 
+//
+// Wait with an absolute CLOCK_MONOTONIC deadline. FUTEX_WAIT_BITSET is used
+// rather than FUTEX_WAIT as the latter takes a relative timeout. So repeated
+// waits, possibly interleaved with requeues, do not drift the deadline.
+//
+
+inline int
+futex_wait_until(futex_t &futex __attribute__((unused)),
+		 std::uint32_t value __attribute__((unused)),
+		 const struct timespec *abs_time __attribute__((unused)))
+{
+#if __linux__
+#if __x86_64__
+	unsigned result;
+	register const struct timespec *arg4 __asm__("r10") = abs_time;
+	register void *arg5 __asm__("r8") = nullptr;
+	register std::uint32_t arg6 __asm__("r9") = FUTEX_BITSET_MATCH_ANY;
+	__asm__ __volatile__("syscall"
+			     : "=a"(result), "+m"(futex)
+			     : "0"(SYS_futex),
+			       "D"(&futex),
+			       "S"(FUTEX_WAIT_BITSET_PRIVATE),
+			       "d"(value),
+			       "r"(arg4),
+			       "r"(arg5),
+			       "r"(arg6)
+			     : "cc", "rcx", "r11", "memory");
+	return (result > (unsigned) -4096) ? (int) result : 0;
+#else
+	if (syscall(SYS_futex,
+		    &futex,
+		    FUTEX_WAIT_BITSET_PRIVATE,
+		    value,
+		    abs_time,
+		    NULL,
+		    FUTEX_BITSET_MATCH_ANY)
+	    == -1)
+		return -errno;
+	else
+		return 0;
+#endif
+#else
+	return -ENOSYS;
+#endif
+}
+
+// The steady_clock epoch is the same as the one of CLOCK_MONOTONIC.
+template <typename Duration>
+inline int
+futex_wait_until(futex_t &futex,
+		 std::uint32_t value,
+		 const steady_time_point<Duration> &abs_time)
+{
+	auto since_epoch = abs_time.time_since_epoch();
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count();
+	if (ns < 0)
+		ns = 0;
+
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	return futex_wait_until(futex, value, &ts);
+}
+
+template <typename Rep, typename Period>
+inline int
+futex_wait_for(futex_t &futex,
+	       std::uint32_t value,
+	       const std::chrono::duration<Rep, Period> &rel_time)
+{
+	return futex_wait_until(futex, value, std::chrono::steady_clock::now() + rel_time);
+}
+
 inline int
 futex_wake(futex_t &futex __attribute__((unused)), int count __attribute__((unused)))
 {
@@ -165,6 +245,60 @@ futex_requeue(futex_t &futex __attribute__((unused)),
 #endif
 }
 
+//
+// Wait on several futexes at once (Linux 5.16+). The futex_waiter structure
+// has the same layout as the kernel struct futex_waitv. If the kernel does
+// not support the operation -ENOSYS is returned.
+//
+
+struct futex_waiter
+{
+	std::uint64_t value;
+	std::uint64_t address;
+	std::uint32_t flags;
+	std::uint32_t reserved;
+
+	void init(futex_t &futex, std::uint32_t v) noexcept
+	{
+		value = v;
+		address = reinterpret_cast<std::uintptr_t>(&futex);
+		// FUTEX_32 | FUTEX_PRIVATE_FLAG
+		flags = 2 | 128;
+		reserved = 0;
+	}
+};
+
+// The maximum number of futexes to wait on.
+constexpr std::size_t futex_waitv_max = 128;
+
+// Kernel headers older than 5.16 lack the syscall number. It is the same for
+// all the architectures that share the common syscall table since 5.1.
+#if __linux__ && !defined(SYS_futex_waitv)
+#if defined(__NR_futex_waitv)
+#define SYS_futex_waitv __NR_futex_waitv
+#elif (defined(__x86_64__) && !defined(__ILP32__)) || defined(__i386__) \
+	|| defined(__aarch64__) || defined(__arm__) || defined(__riscv) \
+	|| defined(__powerpc__) || defined(__s390__)
+#define SYS_futex_waitv 449
+#endif
+#endif
+
+// Returns the index of the woken futex on success.
+inline int
+futex_waitv(futex_waiter *waiters __attribute__((unused)),
+	    unsigned count __attribute__((unused)))
+{
+#if __linux__ && defined(SYS_futex_waitv)
+	long result = syscall(SYS_futex_waitv, waiters, count, 0, NULL, 0);
+	if (result == -1)
+		return -errno;
+	else
+		return (int) result;
+#else
+	return -ENOSYS;
+#endif
+}
+
 } // namespace evenk
 
 #endif // !EVENK_FUTEX_H_
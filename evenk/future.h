@@ -0,0 +1,664 @@
+//
+// Lightweight Futures
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_FUTURE_H_
+#define EVENK_FUTURE_H_
+
+//
+// A future is the result of a thread pool task submitted with the pool's
+// submit_with_result() method.
+//
+// The shared state of a future is allocated from per-thread caches of
+// cache-line sized blocks. It keeps the submitted callable object too, so
+// the pool task itself only refers to the state with a pointer and does
+// not allocate anything. Completion is signaled with a futex.
+//
+// A continuation may be attached to a future with then(). It is called with
+// the result of the future and is scheduled on the same pool when the result
+// is ready. So there is no need to block a pool worker waiting for a result.
+// If the future is completed with an exception the continuation is skipped
+// and the exception goes on to the continuation's future.
+//
+// Examples:
+//
+//   evenk::ws_thread_pool<queue> pool(4);
+//
+//   auto f1 = pool.submit_with_result([] { return 42; });
+//   int x = f1.get();
+//
+//   auto f2 = pool.submit_with_result([] { return read_request(); })
+//                     .then([](request r) { return handle_request(r); })
+//                     .then([](response r) { send_response(r); });
+//   f2.wait();
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "basic.h"
+#include "futex.h"
+#include "task.h"
+
+namespace evenk {
+
+template <typename R>
+class future;
+
+namespace detail {
+
+//
+// Per-thread caches of memory blocks for shared states.
+//
+
+class future_memory
+{
+public:
+	static void *allocate(std::size_t size)
+	{
+		std::size_t index = size_class(size);
+		if (index < class_count) {
+			cache &c = local();
+			block *b = c.free_[index];
+			if (b != nullptr) {
+				c.free_[index] = b->next_;
+				c.count_[index]--;
+				return b;
+			}
+		}
+
+		void *memory = cache_aligned_alloc(block_size(size));
+		if (memory == nullptr)
+			throw std::bad_alloc();
+		return memory;
+	}
+
+	static void deallocate(void *memory, std::size_t size) noexcept
+	{
+		std::size_t index = size_class(size);
+		if (index < class_count) {
+			cache &c = local();
+			if (c.count_[index] < cache_limit) {
+				block *b = static_cast<block *>(memory);
+				b->next_ = c.free_[index];
+				c.free_[index] = b;
+				c.count_[index]++;
+				return;
+			}
+		}
+		std::free(memory);
+	}
+
+private:
+	static constexpr std::size_t class_count = 4;
+	static constexpr std::size_t cache_limit = 64;
+
+	struct block
+	{
+		block *next_;
+	};
+
+	struct cache
+	{
+		block *free_[class_count] = {};
+		std::size_t count_[class_count] = {};
+
+		~cache() noexcept
+		{
+			for (std::size_t i = 0; i < class_count; i++) {
+				while (free_[i] != nullptr) {
+					block *b = free_[i];
+					free_[i] = b->next_;
+					std::free(b);
+				}
+			}
+		}
+	};
+
+	static std::size_t size_class(std::size_t size) noexcept
+	{
+		return (size - 1) / cache_line_size;
+	}
+
+	static std::size_t block_size(std::size_t size) noexcept
+	{
+		return (size_class(size) + 1) * cache_line_size;
+	}
+
+	static cache &local() noexcept
+	{
+		static thread_local cache c;
+		return c;
+	}
+};
+
+//
+// Shared states.
+//
+
+class future_state_base : non_copyable
+{
+public:
+	using schedule_type = void (*)(void *, future_state_base *);
+
+	future_state_base(void *pool, schedule_type schedule) noexcept
+		: pool_(pool), schedule_(schedule)
+	{
+	}
+
+	// A continuation is scheduled on the same pool as its predecessor.
+	explicit future_state_base(const future_state_base *prev) noexcept
+		: pool_(prev->pool_), schedule_(prev->schedule_)
+	{
+	}
+
+	virtual ~future_state_base() noexcept
+	{
+	}
+
+	// Produces the result. Called by a pool task.
+	virtual void run() noexcept = 0;
+
+	// Called if a pool task is destroyed without being run. This might
+	// happen while the pool is being destroyed so a continuation is not
+	// scheduled on it but abandoned right away.
+	virtual void abandon() noexcept
+	{
+		error_ = std::make_exception_ptr(
+			std::runtime_error("future task is destroyed without being run"));
+		future_state_base *next = finish();
+		if (next != nullptr)
+			next->abandon();
+		release();
+	}
+
+	void release() noexcept
+	{
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::size_t size = size_;
+			this->~future_state_base();
+			future_memory::deallocate(this, size);
+		}
+	}
+
+	bool is_ready() const noexcept
+	{
+		return (state_.load(std::memory_order_acquire) & ready_bit) != 0;
+	}
+
+	void wait() noexcept
+	{
+		std::uint32_t state = state_.load(std::memory_order_acquire);
+		while ((state & ready_bit) == 0) {
+			if (announce_wait(state))
+				futex_wait(state_, state);
+			state = state_.load(std::memory_order_acquire);
+		}
+	}
+
+	template <typename Duration>
+	bool wait_until(const steady_time_point<Duration> &abs_time) noexcept
+	{
+		std::uint32_t state = state_.load(std::memory_order_acquire);
+		while ((state & ready_bit) == 0) {
+			if (announce_wait(state)
+			    && futex_wait_until(state_, state, abs_time) == -ETIMEDOUT)
+				return is_ready();
+			state = state_.load(std::memory_order_acquire);
+		}
+		return true;
+	}
+
+	// Links a continuation state that is to be scheduled when this
+	// state is ready.
+	void attach(future_state_base *next) noexcept
+	{
+		next_ = next;
+		std::uint32_t state = state_.fetch_or(attached_bit, std::memory_order_acq_rel);
+		if ((state & ready_bit) != 0)
+			schedule(next);
+	}
+
+	void set_exception(std::exception_ptr error) noexcept
+	{
+		error_ = std::move(error);
+		complete();
+	}
+
+	template <typename State, typename... Args>
+	static State *create(Args &&... args)
+	{
+		void *memory = future_memory::allocate(sizeof(State));
+		try {
+			State *state = new (memory) State(std::forward<Args>(args)...);
+			state->size_ = sizeof(State);
+			return state;
+		} catch (...) {
+			future_memory::deallocate(memory, sizeof(State));
+			throw;
+		}
+	}
+
+protected:
+	void *pool_;
+	schedule_type schedule_;
+	std::exception_ptr error_;
+
+	void complete() noexcept
+	{
+		future_state_base *next = finish();
+		if (next != nullptr)
+			schedule(next);
+	}
+
+	// Makes the state ready and wakes up the waiters. Returns the attached
+	// continuation if any.
+	future_state_base *finish() noexcept
+	{
+		std::uint32_t state = state_.fetch_or(ready_bit, std::memory_order_acq_rel);
+		if ((state & waiting_bit) != 0)
+			futex_wake(state_, std::numeric_limits<int>::max());
+		if ((state & attached_bit) != 0)
+			return next_;
+		return nullptr;
+	}
+
+	void rethrow() const
+	{
+		if (error_)
+			std::rethrow_exception(error_);
+	}
+
+private:
+	static constexpr std::uint32_t ready_bit = 1;
+	static constexpr std::uint32_t waiting_bit = 2;
+	static constexpr std::uint32_t attached_bit = 4;
+
+	// The future and the producer hold a reference each.
+	std::atomic<std::uint32_t> refs_ = ATOMIC_VAR_INIT(2);
+	futex_t state_ = ATOMIC_VAR_INIT(0);
+
+	future_state_base *next_ = nullptr;
+	std::size_t size_ = 0;
+
+	bool announce_wait(std::uint32_t &state) noexcept
+	{
+		if ((state & waiting_bit) != 0)
+			return true;
+		if (!state_.compare_exchange_weak(state,
+						  state | waiting_bit,
+						  std::memory_order_acquire,
+						  std::memory_order_acquire))
+			return false;
+		state |= waiting_bit;
+		return true;
+	}
+
+	void schedule(future_state_base *next) noexcept
+	{
+		try {
+			schedule_(pool_, next);
+		} catch (...) {
+			// The pool does not accept new tasks anymore. The
+			// continuation is abandoned by its runner then.
+		}
+	}
+};
+
+template <typename R>
+class future_state : public future_state_base
+{
+public:
+	using future_state_base::future_state_base;
+
+	~future_state() noexcept
+	{
+		if (has_value_)
+			value()->~R();
+	}
+
+	template <typename... Args>
+	void set_value(Args &&... args)
+	{
+		new (&storage_) R(std::forward<Args>(args)...);
+		has_value_ = true;
+		complete();
+	}
+
+	R take()
+	{
+		rethrow();
+		return std::move(*value());
+	}
+
+private:
+	typename std::aligned_storage<sizeof(R), alignof(R)>::type storage_;
+	bool has_value_ = false;
+
+	R *value() noexcept
+	{
+		return reinterpret_cast<R *>(&storage_);
+	}
+};
+
+template <>
+class future_state<void> : public future_state_base
+{
+public:
+	using future_state_base::future_state_base;
+
+	void set_value() noexcept
+	{
+		complete();
+	}
+
+	void take() const
+	{
+		rethrow();
+	}
+};
+
+// Stores the result of a call in a state.
+template <typename R>
+struct future_setter
+{
+	template <typename F, typename... Args>
+	static void apply(future_state<R> &state, F &f, Args &&... args)
+	{
+		state.set_value(f(std::forward<Args>(args)...));
+	}
+};
+
+template <>
+struct future_setter<void>
+{
+	template <typename F, typename... Args>
+	static void apply(future_state<void> &state, F &f, Args &&... args)
+	{
+		f(std::forward<Args>(args)...);
+		state.set_value();
+	}
+};
+
+template <typename R, typename F>
+struct continuation_result
+{
+	using type = decltype(std::declval<F &>()(std::declval<R>()));
+};
+
+template <typename F>
+struct continuation_result<void, F>
+{
+	using type = decltype(std::declval<F &>()());
+};
+
+template <typename R, typename Callable>
+using continuation_result_t =
+	typename continuation_result<R, typename std::decay<Callable>::type>::type;
+
+// The state of a task submitted to a pool.
+template <typename R, typename F>
+class future_task_state final : public future_state<R>
+{
+public:
+	template <typename Callable>
+	future_task_state(void *pool, future_state_base::schedule_type schedule, Callable &&f)
+		: future_state<R>(pool, schedule), f_(std::forward<Callable>(f))
+	{
+	}
+
+	virtual void run() noexcept override
+	{
+		try {
+			future_setter<R>::apply(*this, f_);
+		} catch (...) {
+			this->set_exception(std::current_exception());
+		}
+		this->release();
+	}
+
+private:
+	F f_;
+};
+
+// The state of a continuation.
+template <typename R, typename Next, typename F>
+class future_continuation_state final : public future_state<Next>
+{
+public:
+	template <typename Callable>
+	future_continuation_state(future_state<R> *prev, Callable &&f)
+		: future_state<Next>(prev), prev_(prev), f_(std::forward<Callable>(f))
+	{
+	}
+
+	virtual void run() noexcept override
+	{
+		try {
+			invoke(std::is_void<R>());
+		} catch (...) {
+			this->set_exception(std::current_exception());
+		}
+		prev_->release();
+		this->release();
+	}
+
+	virtual void abandon() noexcept override
+	{
+		prev_->release();
+		future_state<Next>::abandon();
+	}
+
+private:
+	future_state<R> *prev_;
+	F f_;
+
+	void invoke(std::true_type)
+	{
+		prev_->take();
+		future_setter<Next>::apply(*this, f_);
+	}
+
+	void invoke(std::false_type)
+	{
+		future_setter<Next>::apply(*this, f_, prev_->take());
+	}
+};
+
+// A pool task that runs a state.
+class future_runner
+{
+public:
+	explicit future_runner(future_state_base *state) noexcept : state_(state)
+	{
+	}
+
+	future_runner(future_runner &&other) noexcept : state_(other.state_)
+	{
+		other.state_ = nullptr;
+	}
+
+	future_runner(const future_runner &) = delete;
+	future_runner &operator=(const future_runner &) = delete;
+
+	~future_runner() noexcept
+	{
+		if (state_ != nullptr)
+			state_->abandon();
+	}
+
+	void operator()() noexcept
+	{
+		future_state_base *state = state_;
+		state_ = nullptr;
+		state->run();
+	}
+
+private:
+	future_state_base *state_;
+};
+
+template <typename Pool>
+void
+future_schedule(void *pool, future_state_base *state)
+{
+	static_cast<Pool *>(pool)->submit(future_runner(state));
+}
+
+template <typename Pool, typename Callable>
+future<typename task_result<typename std::decay<Callable>::type>::type>
+future_submit(Pool &pool, Callable &&callable)
+{
+	using target_type = typename std::decay<Callable>::type;
+	using result_type = typename task_result<target_type>::type;
+	using state_type = future_task_state<result_type, target_type>;
+
+	auto state = future_state_base::create<state_type>(
+		&pool, &future_schedule<Pool>, std::forward<Callable>(callable));
+	future<result_type> result(state);
+	pool.submit(future_runner(state));
+	return result;
+}
+
+} // namespace detail
+
+template <typename R>
+class future
+{
+public:
+	using result_type = R;
+
+	future() noexcept = default;
+
+	explicit future(detail::future_state<R> *state) noexcept : state_(state)
+	{
+	}
+
+	future(future &&other) noexcept : state_(other.state_)
+	{
+		other.state_ = nullptr;
+	}
+
+	future &operator=(future &&other) noexcept
+	{
+		std::swap(state_, other.state_);
+		return *this;
+	}
+
+	future(const future &) = delete;
+	future &operator=(const future &) = delete;
+
+	~future() noexcept
+	{
+		if (state_ != nullptr)
+			state_->release();
+	}
+
+	bool valid() const noexcept
+	{
+		return state_ != nullptr;
+	}
+
+	bool is_ready() const
+	{
+		return checked_state()->is_ready();
+	}
+
+	void wait() const
+	{
+		checked_state()->wait();
+	}
+
+	template <typename Duration>
+	bool wait_until(const steady_time_point<Duration> &abs_time) const
+	{
+		return checked_state()->wait_until(abs_time);
+	}
+
+	template <typename Rep, typename Period>
+	bool wait_for(const std::chrono::duration<Rep, Period> &rel_time) const
+	{
+		return wait_until(std::chrono::steady_clock::now() + rel_time);
+	}
+
+	// Waits for the result and takes it out. The future becomes invalid.
+	R get()
+	{
+		checked_state()->wait();
+		holder state(state_);
+		state_ = nullptr;
+		return state.ptr_->take();
+	}
+
+	// Attaches a continuation. The future becomes invalid.
+	template <typename Callable>
+	future<detail::continuation_result_t<R, Callable>> then(Callable &&callable)
+	{
+		using target_type = typename std::decay<Callable>::type;
+		using next_type = detail::continuation_result_t<R, Callable>;
+		using state_type = detail::future_continuation_state<R, next_type, target_type>;
+
+		auto prev = checked_state();
+		auto next = detail::future_state_base::create<state_type>(
+			prev, std::forward<Callable>(callable));
+
+		// The continuation takes over the reference to this state.
+		state_ = nullptr;
+		prev->attach(next);
+		return future<next_type>(next);
+	}
+
+private:
+	struct holder
+	{
+		explicit holder(detail::future_state<R> *ptr) noexcept : ptr_(ptr)
+		{
+		}
+		~holder() noexcept
+		{
+			ptr_->release();
+		}
+		detail::future_state<R> *ptr_;
+	};
+
+	detail::future_state<R> *state_ = nullptr;
+
+	detail::future_state<R> *checked_state() const
+	{
+		if (state_ == nullptr)
+			throw std::logic_error("future has no state");
+		return state_;
+	}
+};
+
+} // namespace evenk
+
+#endif // !EVENK_FUTURE_H_
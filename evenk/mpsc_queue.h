@@ -0,0 +1,325 @@
+//
+// Intrusive Multi-Producer Single-Consumer Queue
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_MPSC_QUEUE_H_
+#define EVENK_MPSC_QUEUE_H_
+
+//
+// The queue is based on the intrusive MPSC node-based queue algorithm by
+// Dmitry Vyukov:
+//    http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+//
+// The queue does not own its elements and never allocates. An element type
+// has to derive from mpsc_queue_hook and the queue links the elements through
+// it. So an element may be in at most one queue at a time.
+//
+// A push is wait-free: a single exchange and a store. There might be a short
+// moment when a producer has done the exchange but not yet the store. Then
+// the consumer cannot get to the element and the following ones and treats
+// the queue as empty.
+//
+// A push that races with close() might succeed after the consumer has seen
+// the queue closed and drained. The element then stays in the queue and can
+// still be taken with try_pop(). If this matters close() should be called by
+// the consumer and followed by a final try_pop() loop.
+//
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "backoff.h"
+#include "basic.h"
+#include "conqueue.h"
+#include "futex.h"
+
+namespace evenk {
+
+class mpsc_queue_hook
+{
+public:
+	mpsc_queue_hook() noexcept = default;
+
+	// Copying an element does not copy its queue link.
+	mpsc_queue_hook(const mpsc_queue_hook &) noexcept
+	{
+	}
+	mpsc_queue_hook &operator=(const mpsc_queue_hook &) noexcept
+	{
+		return *this;
+	}
+
+private:
+	template <typename T>
+	friend class intrusive_mpsc_queue;
+
+	std::atomic<mpsc_queue_hook *> mpsc_next_ = ATOMIC_VAR_INIT(nullptr);
+};
+
+template <typename T>
+class intrusive_mpsc_queue : non_copyable
+{
+public:
+	using value_type = T *;
+
+	intrusive_mpsc_queue() noexcept : head_{&stub_}, tail_{&stub_}
+	{
+	}
+
+	//
+	// State operations
+	//
+
+	void close() noexcept
+	{
+		closed_.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		wake();
+	}
+
+	bool is_closed() const noexcept
+	{
+		return closed_.load(std::memory_order_relaxed);
+	}
+
+	// The head might point to the stub while there are still elements
+	// before it that the consumer has not taken yet. So the check is done
+	// from the consumer side and should only be called by the consumer.
+	bool is_empty() const noexcept
+	{
+		return tail_ == &stub_
+		       && stub_.mpsc_next_.load(std::memory_order_acquire) == nullptr;
+	}
+
+	static bool is_lock_free() noexcept
+	{
+		return true;
+	}
+
+	//
+	// Basic operations
+	//
+
+	void push(T *node)
+	{
+		auto status = try_push(node);
+		if (status != queue_op_status::success)
+			throw status;
+	}
+
+	template <typename... Backoff>
+	T *value_pop(Backoff &&... backoff)
+	{
+		T *node;
+		auto status = wait_pop(node, std::forward<Backoff>(backoff)...);
+		if (status != queue_op_status::success)
+			throw status;
+		return node;
+	}
+
+	//
+	// Waiting operations
+	//
+
+	// The queue is never full so producers never wait.
+	template <typename... Backoff>
+	queue_op_status wait_push(T *node, Backoff &&...)
+	{
+		return try_push(node);
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_pop(T *&node, Backoff &&... backoff)
+	{
+		bool waiting = false;
+		for (;;) {
+			auto status = try_pop(node);
+			if (status != queue_op_status::empty)
+				return status;
+
+			if (!waiting) {
+				waiting = pause(backoff...);
+				continue;
+			}
+
+			if (prepare_wait())
+				futex_wait(waiting_, 1);
+			waiting_.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	//
+	// Timed waiting operations
+	//
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_pop_until(T *&node,
+		       const steady_time_point<Duration> &abs_time,
+		       Backoff backoff = Backoff{})
+	{
+		bool waiting = false;
+		for (;;) {
+			auto status = try_pop(node);
+			if (status != queue_op_status::empty)
+				return status;
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return queue_op_status::timeout;
+
+			if (!waiting) {
+				waiting = backoff();
+				continue;
+			}
+
+			if (prepare_wait())
+				futex_wait_until(waiting_, 1, abs_time);
+			waiting_.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_pop_for(T *&node,
+				     const std::chrono::duration<Rep, Period> &rel_time,
+				     Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_pop_until(node, abs_time, backoff);
+	}
+
+	//
+	// Non-waiting operations
+	//
+
+	queue_op_status try_push(T *node) noexcept
+	{
+		if (closed_.load(std::memory_order_relaxed))
+			return queue_op_status::closed;
+
+		link(node);
+
+		// Wake the consumer if it is about to sleep. This pairs with
+		// the fence in prepare_wait().
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting_.load(std::memory_order_relaxed) != 0)
+			wake();
+		return queue_op_status::success;
+	}
+
+	queue_op_status try_pop(T *&node) noexcept
+	{
+		mpsc_queue_hook *tail = tail_;
+		mpsc_queue_hook *next = tail->mpsc_next_.load(std::memory_order_acquire);
+		if (tail == &stub_) {
+			if (next == nullptr)
+				return drained_status();
+			tail_ = tail = next;
+			next = next->mpsc_next_.load(std::memory_order_acquire);
+		}
+		if (next != nullptr) {
+			tail_ = next;
+			node = static_cast<T *>(tail);
+			return queue_op_status::success;
+		}
+
+		// The tail is the last element. Put the stub after it to be
+		// able to take it out. But if a producer is in the middle of
+		// push then wait for it to finish.
+		if (tail != head_.load(std::memory_order_acquire))
+			return queue_op_status::empty;
+		link(&stub_);
+		next = tail->mpsc_next_.load(std::memory_order_acquire);
+		if (next != nullptr) {
+			tail_ = next;
+			node = static_cast<T *>(tail);
+			return queue_op_status::success;
+		}
+		return queue_op_status::empty;
+	}
+
+private:
+	static bool pause() noexcept
+	{
+		return true;
+	}
+
+	template <typename Backoff>
+	static bool pause(Backoff &backoff)
+	{
+		return backoff();
+	}
+
+	void link(mpsc_queue_hook *node) noexcept
+	{
+		node->mpsc_next_.store(nullptr, std::memory_order_relaxed);
+		mpsc_queue_hook *prev = head_.exchange(node, std::memory_order_seq_cst);
+		prev->mpsc_next_.store(node, std::memory_order_release);
+	}
+
+	queue_op_status drained_status() const noexcept
+	{
+		if (head_.load(std::memory_order_acquire) == &stub_
+		    && closed_.load(std::memory_order_acquire))
+			return queue_op_status::closed;
+		return queue_op_status::empty;
+	}
+
+	// Announce that the consumer is going to sleep and check if it still
+	// makes sense. Either a producer sees the announcement or the consumer
+	// sees the producer's element linked after the stub or after the last
+	// taken element. Checking the head would not do: after try_pop() puts
+	// the stub back the head points to it even if a concurrent push has
+	// got in before it.
+	bool prepare_wait() noexcept
+	{
+		waiting_.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (is_empty() && !closed_.load(std::memory_order_relaxed))
+			return true;
+
+		// There is some element but maybe it is not linked yet.
+		std::this_thread::yield();
+		return false;
+	}
+
+	void wake() noexcept
+	{
+		if (waiting_.exchange(0, std::memory_order_relaxed) != 0)
+			futex_wake(waiting_, 1);
+	}
+
+	// The producer side.
+	alignas(cache_line_size) std::atomic<mpsc_queue_hook *> head_;
+	std::atomic<bool> closed_ = ATOMIC_VAR_INIT(false);
+
+	// The consumer side.
+	alignas(cache_line_size) mpsc_queue_hook *tail_;
+	mpsc_queue_hook stub_;
+
+	// The consumer sleep flag.
+	alignas(cache_line_size) futex_t waiting_ = ATOMIC_VAR_INIT(0);
+};
+
+} // namespace evenk
+
+#endif // !EVENK_MPSC_QUEUE_H_
@@ -0,0 +1,487 @@
+//
+// NUMA Memory Placement
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_NUMA_H_
+#define EVENK_NUMA_H_
+
+//
+// A NUMA policy tells where the pages of a memory block should reside:
+//
+//   node_local(n) - on the given node, or on another one if it runs out of
+//                   memory (MPOL_PREFERRED);
+//   interleave()  - spread page by page over all the nodes or the given
+//                   ones (MPOL_INTERLEAVE);
+//   first_touch() - on the node of the thread that writes a page first
+//                   (the kernel default).
+//
+// The memory for a policy is obtained directly with mmap() and the policy is
+// set with the mbind() system call before any page is touched. There is no
+// dependency on libnuma.
+//
+// The first-touch policy is only useful if the memory is first written by
+// its consumer. A bounded_queue ring initializes all its slots in its
+// constructor. So to get its pages local to the consumer either construct
+// the ring on a consumer thread or use node_local(numa_current_node()) there.
+//
+// The fake single-node mode pretends there is just one node. All the nodes
+// map to it and mbind() is never called. This lets tests run the same way
+// on any host including those where containers forbid the NUMA calls.
+//
+// The numa_alloc() blocks are rounded up to whole pages. This is fine for
+// rings and stacks. The numa_allocator class is meant for small objects such
+// as tasks so it cuts blocks up to 2 KiB from larger chunks with the same
+// policy and keeps freed blocks for reuse. The chunks are never returned to
+// the system.
+//
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "backoff.h"
+#include "basic.h"
+#include "cpuset.h"
+#include "spinlock.h"
+#include "topology.h"
+
+namespace evenk {
+
+namespace detail {
+
+// The constants from <linux/mempolicy.h>.
+enum : int {
+	mpol_default = 0,
+	mpol_preferred = 1,
+	mpol_bind = 2,
+	mpol_interleave = 3,
+};
+
+inline std::atomic<bool> &
+numa_fake_flag() noexcept
+{
+	static std::atomic<bool> flag = ATOMIC_VAR_INIT(false);
+	return flag;
+}
+
+inline std::size_t
+numa_page_size() noexcept
+{
+	static const std::size_t size = ::sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+} // namespace detail
+
+//
+// System information.
+//
+
+// Turn the fake single-node mode on or off.
+inline void
+numa_set_fake(bool enable) noexcept
+{
+	detail::numa_fake_flag().store(enable, std::memory_order_relaxed);
+}
+
+inline bool
+numa_is_fake() noexcept
+{
+	return detail::numa_fake_flag().load(std::memory_order_relaxed);
+}
+
+// The number of possible NUMA nodes. The node numbers might have gaps so
+// this is actually the highest node number plus one.
+inline std::size_t
+numa_node_count()
+{
+	if (numa_is_fake())
+		return 1;
+
+	static const std::size_t count = [] {
+		std::size_t size = cpu_topology::possible_nodes().size();
+		return size ? size : std::size_t(1);
+	}();
+	return count;
+}
+
+// The node of the CPU the calling thread runs on.
+inline std::size_t
+numa_current_node() noexcept
+{
+	if (numa_is_fake())
+		return 0;
+
+	unsigned cpu, node;
+	if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+		return 0;
+	return node;
+}
+
+//
+// Memory policies.
+//
+
+class numa_policy
+{
+public:
+	enum class kind { first_touch, node_local, interleave };
+
+	// The default policy is first-touch.
+	numa_policy() noexcept = default;
+
+	static numa_policy first_touch() noexcept
+	{
+		return numa_policy();
+	}
+
+	static numa_policy node_local(std::size_t node)
+	{
+		return numa_policy(kind::node_local, cpuset({node}));
+	}
+
+	// Interleave over all the nodes.
+	static numa_policy interleave()
+	{
+		return numa_policy(kind::interleave, cpuset(numa_node_count(), true));
+	}
+
+	static numa_policy interleave(const cpuset &nodes)
+	{
+		if (nodes.none())
+			throw std::invalid_argument("numa_policy: no nodes to interleave");
+		return numa_policy(kind::interleave, nodes);
+	}
+
+	kind type() const noexcept
+	{
+		return kind_;
+	}
+
+	const cpuset &nodes() const noexcept
+	{
+		return nodes_;
+	}
+
+	// Set the policy for a page-aligned memory range. The pages that are
+	// already in memory are not moved.
+	void bind(void *addr, std::size_t size) const
+	{
+		if (kind_ == kind::first_touch || numa_is_fake())
+			return;
+		cpuset nodes = node_mask();
+		long rc = ::syscall(SYS_mbind,
+				    addr,
+				    size,
+				    mode(),
+				    nodes.data(),
+				    nodes.size() + 1,
+				    0);
+		if (rc != 0)
+			throw_system_error(errno, "mbind()");
+	}
+
+	// Set the policy for the future allocations of the calling thread.
+	// It affects the pages the thread touches first. This includes its
+	// stack and all the memory from malloc().
+	void apply_to_thread() const
+	{
+		if (numa_is_fake())
+			return;
+		long rc;
+		if (kind_ == kind::first_touch) {
+			rc = ::syscall(SYS_set_mempolicy, detail::mpol_default, nullptr, 0);
+		} else {
+			cpuset nodes = node_mask();
+			rc = ::syscall(SYS_set_mempolicy,
+				       mode(),
+				       nodes.data(),
+				       nodes.size() + 1);
+		}
+		if (rc != 0)
+			throw_system_error(errno, "set_mempolicy()");
+	}
+
+	friend bool operator==(const numa_policy &a, const numa_policy &b) noexcept
+	{
+		return a.kind_ == b.kind_ && a.nodes_ == b.nodes_;
+	}
+
+	friend bool operator!=(const numa_policy &a, const numa_policy &b) noexcept
+	{
+		return !(a == b);
+	}
+
+private:
+	kind kind_ = kind::first_touch;
+	cpuset nodes_;
+
+	numa_policy(kind k, const cpuset &nodes) : kind_(k), nodes_(nodes)
+	{
+		nodes_.trim();
+	}
+
+	// The kernel wants the mask to cover all the possible nodes. A node
+	// past them is left for the kernel to reject.
+	cpuset node_mask() const
+	{
+		cpuset nodes = nodes_;
+		if (nodes.size() < numa_node_count())
+			nodes.resize(numa_node_count());
+		return nodes;
+	}
+
+	int mode() const noexcept
+	{
+		return kind_ == kind::node_local ? detail::mpol_preferred
+						 : detail::mpol_interleave;
+	}
+};
+
+//
+// Memory allocation.
+//
+
+// Allocate a page-aligned block with the given policy. The block is zeroed.
+inline void *
+numa_alloc(std::size_t size, const numa_policy &policy)
+{
+	std::size_t page_size = detail::numa_page_size();
+	size = (size + page_size - 1) & ~(page_size - 1);
+
+	void *memory = ::mmap(nullptr,
+			      size,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS,
+			      -1,
+			      0);
+	if (memory == MAP_FAILED)
+		throw std::bad_alloc();
+	try {
+		policy.bind(memory, size);
+	} catch (...) {
+		::munmap(memory, size);
+		throw;
+	}
+	return memory;
+}
+
+// Free a block with the same size it was allocated with.
+inline void
+numa_free(void *memory, std::size_t size) noexcept
+{
+	std::size_t page_size = detail::numa_page_size();
+	size = (size + page_size - 1) & ~(page_size - 1);
+	::munmap(memory, size);
+}
+
+namespace detail {
+
+// Small blocks with a given policy. Every power-of-two size class has its
+// own free list. An empty list is refilled with a new chunk of pages.
+class numa_arena : non_copyable
+{
+public:
+	static constexpr std::size_t min_block = 16;
+	static constexpr std::size_t class_count = 8;
+	static constexpr std::size_t max_block = min_block << (class_count - 1);
+	static constexpr std::size_t chunk_pages = 16;
+
+	// Get the shared arena for a policy. The arenas live to the end of
+	// the program so that any late deallocation finds its arena.
+	static numa_arena &get(const numa_policy &policy)
+	{
+		static std::mutex lock;
+		static auto arenas = new std::vector<std::unique_ptr<numa_arena>>;
+
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto &arena : *arenas) {
+			if (arena->policy() == policy)
+				return *arena;
+		}
+		arenas->emplace_back(new numa_arena(policy));
+		return *arenas->back();
+	}
+
+	const numa_policy &policy() const noexcept
+	{
+		return policy_;
+	}
+
+	void *allocate(std::size_t size)
+	{
+		if (size > max_block)
+			return numa_alloc(size, policy_);
+
+		size_class &c = classes_[class_index(size)];
+		for (;;) {
+			c.lock.lock(yield_backoff{});
+			block *b = c.free;
+			if (b != nullptr) {
+				c.free = b->next;
+				c.lock.unlock();
+				return b;
+			}
+			c.lock.unlock();
+			refill(c, min_block << class_index(size));
+		}
+	}
+
+	void deallocate(void *memory, std::size_t size) noexcept
+	{
+		if (size > max_block) {
+			numa_free(memory, size);
+			return;
+		}
+
+		size_class &c = classes_[class_index(size)];
+		block *b = static_cast<block *>(memory);
+		c.lock.lock(yield_backoff{});
+		b->next = c.free;
+		c.free = b;
+		c.lock.unlock();
+	}
+
+private:
+	struct block
+	{
+		block *next;
+	};
+
+	struct size_class
+	{
+		tatas_lock lock;
+		block *free = nullptr;
+	};
+
+	const numa_policy policy_;
+	size_class classes_[class_count];
+
+	explicit numa_arena(const numa_policy &policy) : policy_(policy)
+	{
+	}
+
+	static std::size_t class_index(std::size_t size) noexcept
+	{
+		std::size_t index = 0;
+		while ((min_block << index) < size)
+			index++;
+		return index;
+	}
+
+	// Cut a new chunk into blocks and put them to the free list.
+	void refill(size_class &c, std::size_t block_size)
+	{
+		const std::size_t chunk_size = chunk_pages * numa_page_size();
+		char *chunk = static_cast<char *>(numa_alloc(chunk_size, policy_));
+		block *first = reinterpret_cast<block *>(chunk);
+		block *last = first;
+		for (std::size_t off = block_size; off < chunk_size; off += block_size) {
+			block *b = reinterpret_cast<block *>(chunk + off);
+			last->next = b;
+			last = b;
+		}
+
+		c.lock.lock(yield_backoff{});
+		last->next = c.free;
+		c.free = first;
+		c.lock.unlock();
+	}
+};
+
+} // namespace detail
+
+// A standard allocator for a policy. It refers to the shared arena of the
+// policy so it is cheap to copy around. Sizes up to numa_arena::max_block
+// come from the arena and larger ones directly from numa_alloc().
+template <typename T>
+class numa_allocator
+{
+public:
+	using value_type = T;
+
+	numa_allocator() : arena_(&detail::numa_arena::get(numa_policy()))
+	{
+	}
+
+	explicit numa_allocator(const numa_policy &policy)
+		: arena_(&detail::numa_arena::get(policy))
+	{
+	}
+
+	template <typename U>
+	numa_allocator(const numa_allocator<U> &other) noexcept : arena_(other.arena_)
+	{
+	}
+
+	const numa_policy &policy() const noexcept
+	{
+		return arena_->policy();
+	}
+
+	T *allocate(std::size_t n)
+	{
+		if (n > std::size_t(-1) / sizeof(T))
+			throw std::bad_alloc();
+		return static_cast<T *>(arena_->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, std::size_t n) noexcept
+	{
+		arena_->deallocate(ptr, n * sizeof(T));
+	}
+
+	// The instances with the same policy share the arena and so might
+	// free memory from each other. Every arena has its own policy copy.
+	template <typename U>
+	friend bool operator==(const numa_allocator &a, const numa_allocator<U> &b) noexcept
+	{
+		return &a.policy() == &b.policy();
+	}
+
+	template <typename U>
+	friend bool operator!=(const numa_allocator &a, const numa_allocator<U> &b) noexcept
+	{
+		return !(a == b);
+	}
+
+private:
+	template <typename U>
+	friend class numa_allocator;
+
+	detail::numa_arena *arena_;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_NUMA_H_
@@ -0,0 +1,388 @@
+//
+// Parallel Algorithms
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_PARALLEL_H_
+#define EVENK_PARALLEL_H_
+
+//
+// Loop algorithms that run on a thread pool (either thread_pool or
+// ws_thread_pool).
+//
+// A range is split into chunks on the fly. Each thread that takes part in
+// a loop grabs a new chunk when it is done with the previous one. The chunk
+// size is a fraction of the remaining range but at least the given grain.
+// So the chunks are big at the beginning and get smaller towards the end
+// of the range to balance the load.
+//
+// The calling thread takes part in the loop too. When it runs out of chunks
+// and other threads are still busy it runs other pending pool tasks rather
+// than blocking. So it is fine to start a loop from a pool task.
+//
+// The loop state is kept on the calling thread's stack and pool tasks only
+// refer to it with a pointer. So no memory is allocated for chunks.
+//
+// Examples:
+//
+//   template <typename T>
+//   using queue = evenk::unbounded_queue<T>;
+//   ...
+//   evenk::ws_thread_pool<queue> pool(8);
+//   std::vector<double> v(1000000);
+//
+//   evenk::parallel_for(pool, evenk::make_range(std::size_t(0), v.size()),
+//                       [&v](evenk::range<std::size_t> r) {
+//                               for (auto i = r.begin(); i != r.end(); i++)
+//                                       v[i] = std::sqrt(double(i));
+//                       });
+//
+//   double sum = evenk::parallel_reduce(
+//           pool, evenk::make_range(v.cbegin(), v.cend()), 0.0,
+//           [](auto r, double acc) { return std::accumulate(r.begin(), r.end(), acc); },
+//           std::plus<double>());
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <utility>
+
+#include "basic.h"
+#include "synch.h"
+
+namespace evenk {
+
+//
+// A range of integers or random access iterators.
+//
+
+template <typename T>
+class range
+{
+public:
+	using value_type = T;
+
+	range() : first_(), last_()
+	{
+	}
+
+	range(T first, T last) : first_(first), last_(last)
+	{
+	}
+
+	T begin() const
+	{
+		return first_;
+	}
+
+	T end() const
+	{
+		return last_;
+	}
+
+	std::size_t size() const
+	{
+		return first_ < last_ ? std::size_t(last_ - first_) : 0;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+private:
+	T first_;
+	T last_;
+};
+
+template <typename T>
+range<T>
+make_range(T first, T last)
+{
+	return range<T>(first, last);
+}
+
+namespace detail {
+
+// Hands out chunks of a range to competing threads.
+template <typename T>
+class parallel_chunks : non_copyable
+{
+public:
+	parallel_chunks(const range<T> &r, std::size_t grain, std::size_t parts) noexcept
+		: range_(r), size_(r.size()), grain_(std::max(grain, std::size_t(1))),
+		  parts_(2 * parts)
+	{
+	}
+
+	std::size_t size() const noexcept
+	{
+		return size_;
+	}
+
+	std::size_t grain() const noexcept
+	{
+		return grain_;
+	}
+
+	bool next(range<T> &chunk) noexcept
+	{
+		std::size_t first = next_.load(std::memory_order_relaxed);
+		for (;;) {
+			if (first >= size_)
+				return false;
+			std::size_t count = std::max((size_ - first) / parts_, grain_);
+			std::size_t last = std::min(first + count, size_);
+			if (next_.compare_exchange_weak(
+				    first, last, std::memory_order_relaxed)) {
+				chunk = range<T>(range_.begin() + first, range_.begin() + last);
+				return true;
+			}
+		}
+	}
+
+	void cancel() noexcept
+	{
+		next_.store(size_, std::memory_order_relaxed);
+	}
+
+private:
+	const range<T> range_;
+	const std::size_t size_;
+	const std::size_t grain_;
+	const std::size_t parts_;
+
+	alignas(cache_line_size) std::atomic<std::size_t> next_ = ATOMIC_VAR_INIT(0);
+};
+
+// Runs the same work in the calling thread and in a number of pool tasks
+// and joins them all.
+template <typename Work>
+class parallel_job : non_copyable
+{
+public:
+	explicit parallel_job(Work &work) noexcept : work_(work)
+	{
+	}
+
+	template <typename Pool>
+	void run(Pool &pool, std::size_t helpers)
+	{
+		for (std::size_t i = 0; i < helpers; i++) {
+			pending_.fetch_add(1, std::memory_order_relaxed);
+			try {
+				pool.submit([this] {
+					execute();
+					pending_.fetch_sub(1, std::memory_order_release);
+				});
+			} catch (...) {
+				// Do without more helpers if the pool is closed.
+				pending_.fetch_sub(1, std::memory_order_relaxed);
+				break;
+			}
+		}
+
+		execute();
+
+		// Help the pool while the helpers are busy. The job is on
+		// the stack so it is necessary to wait for every one of them.
+		while (pending_.load(std::memory_order_acquire) != 0) {
+			if (!pool.try_run_one())
+				std::this_thread::yield();
+		}
+
+		if (error_)
+			std::rethrow_exception(error_);
+	}
+
+private:
+	Work &work_;
+
+	std::atomic<std::size_t> pending_ = ATOMIC_VAR_INIT(0);
+
+	std::atomic<bool> failed_ = ATOMIC_VAR_INIT(false);
+	std::exception_ptr error_;
+
+	void execute() noexcept
+	{
+		try {
+			work_();
+		} catch (...) {
+			if (!failed_.exchange(true, std::memory_order_relaxed))
+				error_ = std::current_exception();
+			work_.cancel();
+		}
+	}
+};
+
+template <typename Pool, typename Work>
+void
+parallel_run(Pool &pool, Work &work, std::size_t size, std::size_t grain)
+{
+	// The number of chunks of at least the grain size.
+	std::size_t chunks = (size + grain - 1) / grain;
+	std::size_t helpers = std::min(pool.size(), chunks > 0 ? chunks - 1 : 0);
+
+	parallel_job<Work> job(work);
+	job.run(pool, helpers);
+}
+
+template <typename T, typename Body>
+class parallel_for_work
+{
+public:
+	parallel_for_work(const range<T> &r, Body &body, std::size_t grain, std::size_t parts)
+		: chunks_(r, grain, parts), body_(body)
+	{
+	}
+
+	std::size_t size() const noexcept
+	{
+		return chunks_.size();
+	}
+
+	std::size_t grain() const noexcept
+	{
+		return chunks_.grain();
+	}
+
+	void operator()()
+	{
+		range<T> chunk;
+		while (chunks_.next(chunk))
+			body_(chunk);
+	}
+
+	void cancel() noexcept
+	{
+		chunks_.cancel();
+	}
+
+private:
+	parallel_chunks<T> chunks_;
+	Body &body_;
+};
+
+template <typename T, typename Value, typename Body, typename Reduce>
+class parallel_reduce_work
+{
+public:
+	parallel_reduce_work(const range<T> &r,
+			     const Value &identity,
+			     Body &body,
+			     Reduce &reduce,
+			     std::size_t grain,
+			     std::size_t parts)
+		: chunks_(r, grain, parts), identity_(identity), body_(body), reduce_(reduce),
+		  result_(identity)
+	{
+	}
+
+	std::size_t size() const noexcept
+	{
+		return chunks_.size();
+	}
+
+	std::size_t grain() const noexcept
+	{
+		return chunks_.grain();
+	}
+
+	Value &result() noexcept
+	{
+		return result_;
+	}
+
+	void operator()()
+	{
+		range<T> chunk;
+		if (!chunks_.next(chunk))
+			return;
+
+		Value value = body_(chunk, identity_);
+		while (chunks_.next(chunk))
+			value = body_(chunk, std::move(value));
+
+		default_synch::lock_owner_type guard(lock_);
+		result_ = reduce_(std::move(result_), std::move(value));
+	}
+
+	void cancel() noexcept
+	{
+		chunks_.cancel();
+	}
+
+private:
+	parallel_chunks<T> chunks_;
+	const Value &identity_;
+	Body &body_;
+	Reduce &reduce_;
+
+	default_synch::lock_type lock_;
+	Value result_;
+};
+
+} // namespace detail
+
+//
+// Call the body for successive chunks of the range. The body takes a range
+// argument.
+//
+
+template <typename Pool, typename T, typename Body>
+void
+parallel_for(Pool &pool, const range<T> &r, Body body, std::size_t grain = 1)
+{
+	detail::parallel_for_work<T, Body> work(r, body, grain, pool.size() + 1);
+	detail::parallel_run(pool, work, work.size(), work.grain());
+}
+
+//
+// Reduce the range to a single value. The body takes a chunk of the range
+// and a value accumulated so far and returns the new accumulated value. It
+// starts with the identity value. The reduce function combines two values
+// that are accumulated separately. The order of the combined values is not
+// specified so the reduce function has to be both associative and
+// commutative.
+//
+
+template <typename Pool, typename T, typename Value, typename Body, typename Reduce>
+Value
+parallel_reduce(Pool &pool,
+		const range<T> &r,
+		const Value &identity,
+		Body body,
+		Reduce reduce,
+		std::size_t grain = 1)
+{
+	detail::parallel_reduce_work<T, Value, Body, Reduce> work(
+		r, identity, body, reduce, grain, pool.size() + 1);
+	detail::parallel_run(pool, work, work.size(), work.grain());
+	return std::move(work.result());
+}
+
+} // namespace evenk
+
+#endif // !EVENK_PARALLEL_H_
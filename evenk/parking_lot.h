@@ -0,0 +1,488 @@
+//
+// Parking Lot
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_PARKING_LOT_H_
+#define EVENK_PARKING_LOT_H_
+
+//
+// The parking lot is a global table of wait queues keyed by address in the
+// spirit of the WebKit WTF::ParkingLot. It lets any atomic word block its
+// waiters without embedding a futex of its own. So a lock might take as
+// little as two bits of some word.
+//
+// The table has a fixed number of buckets, each bucket has its own lock and
+// a FIFO list of parked threads. Different addresses that hash to the same
+// bucket share the list. Every thread has a single wait record with a futex
+// that it sleeps on while parked.
+//
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+
+#include "backoff.h"
+#include "basic.h"
+#include "futex.h"
+#include "synch.h"
+
+namespace evenk {
+
+namespace detail {
+
+struct parking_record
+{
+	const void *address = nullptr;
+	parking_record *next = nullptr;
+	futex_t futex = ATOMIC_VAR_INIT(0);
+};
+
+struct alignas(cache_line_size) parking_bucket
+{
+	futex_lock lock;
+	parking_record *head = nullptr;
+	parking_record *tail = nullptr;
+};
+
+} // namespace detail
+
+class parking_lot
+{
+public:
+	static constexpr unsigned bucket_bits = 10;
+	static constexpr std::size_t bucket_count = std::size_t(1) << bucket_bits;
+
+	struct unpark_result
+	{
+		// A thread was actually unparked.
+		bool unparked = false;
+		// There might be more threads parked at the same address.
+		bool may_have_more = false;
+	};
+
+	parking_lot() = delete;
+
+	// Park the current thread at the given address if the validate function
+	// returns true. The function is called with the bucket lock held so it
+	// runs atomically with respect to unpark calls. The before_sleep function
+	// is called after the thread is enqueued and the bucket lock is released.
+	// Returns false if the validation failed.
+	template <typename Validate, typename BeforeSleep>
+	static bool park(const void *address, Validate validate, BeforeSleep before_sleep)
+	{
+		detail::parking_record &self = thread_record();
+		if (!enqueue(address, self, validate))
+			return false;
+
+		before_sleep();
+
+		while (self.futex.load(std::memory_order_acquire) == 0)
+			futex_wait(self.futex, 0);
+		return true;
+	}
+
+	template <typename Validate>
+	static bool park(const void *address, Validate validate)
+	{
+		return park(address, validate, [] {});
+	}
+
+	// The same as park() but gives up at the given deadline. Returns false
+	// on timeout too.
+	template <typename Validate, typename BeforeSleep, typename Duration>
+	static bool park_until(const void *address,
+			       Validate validate,
+			       BeforeSleep before_sleep,
+			       const steady_time_point<Duration> &abs_time)
+	{
+		detail::parking_record &self = thread_record();
+		if (!enqueue(address, self, validate))
+			return false;
+
+		before_sleep();
+
+		while (self.futex.load(std::memory_order_acquire) == 0) {
+			if (futex_wait_until(self.futex, 0, abs_time) != -ETIMEDOUT)
+				continue;
+
+			detail::parking_bucket &bucket = address_bucket(address);
+			bucket.lock.lock(bucket_backoff());
+			bool removed = remove(bucket, self);
+			bucket.lock.unlock();
+			if (removed)
+				return false;
+
+			// An unpark call has just taken the record so it is
+			// about to set the futex.
+			while (self.futex.load(std::memory_order_acquire) == 0)
+				futex_wait(self.futex, 0);
+		}
+		return true;
+	}
+
+	// Unpark the first thread parked at the given address. The callback
+	// function is called with the bucket lock held and is given the result
+	// of the operation before the thread is actually woken up.
+	template <typename Callback>
+	static unpark_result unpark_one(const void *address, Callback callback)
+	{
+		unpark_result result;
+		detail::parking_bucket &bucket = address_bucket(address);
+
+		bucket.lock.lock(bucket_backoff());
+		detail::parking_record *record = bucket.head;
+		detail::parking_record *prev = nullptr;
+		while (record != nullptr && record->address != address) {
+			prev = record;
+			record = record->next;
+		}
+		if (record != nullptr) {
+			if (prev == nullptr)
+				bucket.head = record->next;
+			else
+				prev->next = record->next;
+			if (bucket.tail == record)
+				bucket.tail = prev;
+			result.unparked = true;
+
+			detail::parking_record *r = record->next;
+			for (; r != nullptr; r = r->next) {
+				if (r->address == address) {
+					result.may_have_more = true;
+					break;
+				}
+			}
+		}
+		callback(result);
+		bucket.lock.unlock();
+
+		if (record != nullptr)
+			wake(*record);
+		return result;
+	}
+
+	static unpark_result unpark_one(const void *address)
+	{
+		return unpark_one(address, [](unpark_result) {});
+	}
+
+	// Unpark all the threads parked at the given address. Returns the number
+	// of unparked threads.
+	static std::size_t unpark_all(const void *address)
+	{
+		detail::parking_bucket &bucket = address_bucket(address);
+
+		bucket.lock.lock(bucket_backoff());
+		detail::parking_record *list = nullptr;
+		detail::parking_record **list_tail = &list;
+		detail::parking_record *prev = nullptr;
+		detail::parking_record *r = bucket.head;
+		while (r != nullptr) {
+			detail::parking_record *next = r->next;
+			if (r->address != address) {
+				prev = r;
+			} else {
+				if (prev == nullptr)
+					bucket.head = next;
+				else
+					prev->next = next;
+				r->next = nullptr;
+				*list_tail = r;
+				list_tail = &r->next;
+			}
+			r = next;
+		}
+		bucket.tail = prev;
+		bucket.lock.unlock();
+
+		std::size_t count = 0;
+		while (list != nullptr) {
+			detail::parking_record *next = list->next;
+			wake(*list);
+			list = next;
+			count++;
+		}
+		return count;
+	}
+
+private:
+	// The bucket lock is held just for a few list operations so it is
+	// better to spin for a while before sleeping.
+	static linear_backoff<cpu_relax, 100, 10> bucket_backoff() noexcept
+	{
+		return linear_backoff<cpu_relax, 100, 10>{};
+	}
+
+	template <typename Validate>
+	static bool
+	enqueue(const void *address, detail::parking_record &self, Validate &validate)
+	{
+		detail::parking_bucket &bucket = address_bucket(address);
+
+		bucket.lock.lock(bucket_backoff());
+		if (!validate()) {
+			bucket.lock.unlock();
+			return false;
+		}
+		self.address = address;
+		self.next = nullptr;
+		self.futex.store(0, std::memory_order_relaxed);
+		if (bucket.tail == nullptr)
+			bucket.head = &self;
+		else
+			bucket.tail->next = &self;
+		bucket.tail = &self;
+		bucket.lock.unlock();
+		return true;
+	}
+
+	static bool
+	remove(detail::parking_bucket &bucket, detail::parking_record &record) noexcept
+	{
+		detail::parking_record *prev = nullptr;
+		for (detail::parking_record *r = bucket.head; r != nullptr; r = r->next) {
+			if (r == &record) {
+				if (prev == nullptr)
+					bucket.head = r->next;
+				else
+					prev->next = r->next;
+				if (bucket.tail == r)
+					bucket.tail = prev;
+				return true;
+			}
+			prev = r;
+		}
+		return false;
+	}
+
+	static detail::parking_bucket &address_bucket(const void *address) noexcept
+	{
+		static detail::parking_bucket buckets[bucket_count];
+
+		// Fibonacci hashing.
+		std::uint64_t key = reinterpret_cast<std::uintptr_t>(address);
+		key *= UINT64_C(0x9e3779b97f4a7c15);
+		return buckets[key >> (64 - bucket_bits)];
+	}
+
+	static detail::parking_record &thread_record() noexcept
+	{
+		static thread_local detail::parking_record record;
+		return record;
+	}
+
+	static void wake(detail::parking_record &record) noexcept
+	{
+		// Once the futex is set the record might be reused by its
+		// owner. In the worst case this leads to a spurious wakeup.
+		record.futex.store(1, std::memory_order_release);
+		futex_wake(record.futex, 1);
+	}
+};
+
+//
+// A lock that takes just two bits of a word. The rest of the bits are left
+// intact so they might be used for any other purpose.
+//
+
+template <typename Word = std::uint8_t, Word LockBit = 1, Word ParkBit = 2>
+class basic_parking_lock : non_copyable
+{
+public:
+	using word_type = Word;
+	using native_handle_type = std::atomic<word_type> &;
+
+	static_assert(LockBit != ParkBit, "lock and park bits must be different");
+
+	static constexpr word_type lock_bit = LockBit;
+	static constexpr word_type park_bit = ParkBit;
+
+	constexpr basic_parking_lock() noexcept = default;
+
+	void lock() noexcept
+	{
+		lock(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff) noexcept
+	{
+		word_type value = word_.load(std::memory_order_relaxed);
+		for (;;) {
+			if ((value & lock_bit) == 0) {
+				if (word_.compare_exchange_weak(value,
+								value | lock_bit,
+								std::memory_order_acquire,
+								std::memory_order_relaxed))
+					return;
+				continue;
+			}
+
+			if ((value & park_bit) == 0) {
+				if (!backoff()) {
+					value = word_.load(std::memory_order_relaxed);
+					continue;
+				}
+				if (!word_.compare_exchange_weak(value,
+								 value | park_bit,
+								 std::memory_order_relaxed,
+								 std::memory_order_relaxed))
+					continue;
+			}
+
+			parking_lot::park(&word_, [this] {
+				word_type v = word_.load(std::memory_order_relaxed);
+				return (v & (lock_bit | park_bit)) == (lock_bit | park_bit);
+			});
+			value = word_.load(std::memory_order_relaxed);
+		}
+	}
+
+	bool try_lock() noexcept
+	{
+		word_type value = word_.load(std::memory_order_relaxed);
+		while ((value & lock_bit) == 0) {
+			if (word_.compare_exchange_weak(value,
+							value | lock_bit,
+							std::memory_order_acquire,
+							std::memory_order_relaxed))
+				return true;
+		}
+		return false;
+	}
+
+	void unlock() noexcept
+	{
+		word_type value = word_.load(std::memory_order_relaxed);
+		while ((value & park_bit) == 0) {
+			if (word_.compare_exchange_weak(value,
+							value & ~lock_bit,
+							std::memory_order_release,
+							std::memory_order_relaxed))
+				return;
+		}
+
+		// With the bucket lock held no thread can park here so the park
+		// bit is updated reliably.
+		parking_lot::unpark_one(&word_, [this](parking_lot::unpark_result result) {
+			word_type v = word_.load(std::memory_order_relaxed);
+			word_type x;
+			do {
+				x = v & ~(lock_bit | park_bit);
+				if (result.may_have_more)
+					x |= park_bit;
+			} while (!word_.compare_exchange_weak(
+				v, x, std::memory_order_release, std::memory_order_relaxed));
+		});
+	}
+
+	native_handle_type native_handle() noexcept
+	{
+		return word_;
+	}
+
+private:
+	std::atomic<word_type> word_ = ATOMIC_VAR_INIT(0);
+};
+
+using parking_lock = basic_parking_lock<>;
+
+//
+// A condition variable that takes a single byte.
+//
+
+class parking_cond_var : non_copyable
+{
+public:
+	constexpr parking_cond_var() noexcept = default;
+
+	template <typename Lock>
+	void wait(lock_guard<Lock> &guard) noexcept
+	{
+		Lock *owner = guard.mutex();
+		parking_lot::park(this,
+				  [this] {
+					  waiters_.store(true, std::memory_order_relaxed);
+					  return true;
+				  },
+				  [owner] { owner->unlock(); });
+		owner->lock();
+	}
+
+	template <typename Lock, typename Duration>
+	std::cv_status wait_until(
+		lock_guard<Lock> &guard,
+		const steady_time_point<Duration> &abs_time) noexcept
+	{
+		Lock *owner = guard.mutex();
+		auto validate = [this] {
+			waiters_.store(true, std::memory_order_relaxed);
+			return true;
+		};
+		auto before_sleep = [owner] { owner->unlock(); };
+		bool unparked = parking_lot::park_until(this, validate, before_sleep, abs_time);
+		owner->lock();
+		return unparked ? std::cv_status::no_timeout : std::cv_status::timeout;
+	}
+
+	template <typename Lock, typename Rep, typename Period>
+	std::cv_status wait_for(lock_guard<Lock> &guard,
+				const std::chrono::duration<Rep, Period> &rel_time) noexcept
+	{
+		return wait_until(guard, std::chrono::steady_clock::now() + rel_time);
+	}
+
+	void notify_one() noexcept
+	{
+		if (!waiters_.load(std::memory_order_relaxed))
+			return;
+		parking_lot::unpark_one(this, [this](parking_lot::unpark_result result) {
+			if (!result.may_have_more)
+				waiters_.store(false, std::memory_order_relaxed);
+		});
+	}
+
+	void notify_all() noexcept
+	{
+		if (!waiters_.load(std::memory_order_relaxed))
+			return;
+		waiters_.store(false, std::memory_order_relaxed);
+		parking_lot::unpark_all(this);
+	}
+
+private:
+	std::atomic<bool> waiters_ = ATOMIC_VAR_INIT(false);
+};
+
+struct parking_synch
+{
+	using lock_type = parking_lock;
+	using cond_var_type = parking_cond_var;
+	using lock_owner_type = lock_guard<parking_lock>;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_PARKING_LOT_H_
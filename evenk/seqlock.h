@@ -0,0 +1,190 @@
+//
+// Sequence Locks
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_SEQLOCK_H_
+#define EVENK_SEQLOCK_H_
+
+//
+// A sequence lock protects a small trivially copyable value. Readers never
+// write to shared memory. They take an optimistic snapshot of the value and
+// check that the sequence number has not changed meanwhile. Writers are
+// serialized with an ordinary lock and bump the sequence number before and
+// after the update. An odd sequence number means there is a write underway.
+//
+// To stay clear of data races in the C++ memory model sense the value is
+// kept as an array of relaxed atomic words as suggested in:
+//    H.-J. Boehm. Can Seqlocks Get Along With Programming Language Memory
+//    Models? MSPC 2012.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "backoff.h"
+#include "basic.h"
+#include "spinlock.h"
+#include "synch.h"
+
+namespace evenk {
+
+template <typename T, typename Lock = spin_lock>
+class seq_lock : non_copyable
+{
+public:
+	using value_type = T;
+	using lock_type = Lock;
+
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "seq_lock requires a trivially copyable value type");
+
+	seq_lock() noexcept : seq_lock(T{})
+	{
+	}
+
+	explicit seq_lock(const T &value) noexcept
+	{
+		store(value);
+	}
+
+	//
+	// Reader operations
+	//
+
+	T read() const noexcept
+	{
+		return read(no_backoff{});
+	}
+
+	template <typename Backoff>
+	T read(Backoff backoff) const noexcept
+	{
+		T value;
+		while (!try_read(value))
+			backoff();
+		return value;
+	}
+
+	bool try_read(T &value) const noexcept
+	{
+		std::uint32_t seq = seq_.load(std::memory_order_acquire);
+		if ((seq & 1) != 0)
+			return false;
+
+		word data[word_count];
+		for (std::size_t i = 0; i < word_count; i++)
+			data[i] = data_[i].load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (seq != seq_.load(std::memory_order_relaxed))
+			return false;
+
+		std::memcpy(&value, data, sizeof(T));
+		return true;
+	}
+
+	//
+	// Writer operations
+	//
+
+	void write(const T &value)
+	{
+		write(value, no_backoff{});
+	}
+
+	template <typename Backoff>
+	void write(const T &value, Backoff backoff)
+	{
+		lock_guard<lock_type> guard(lock_, backoff);
+		begin_write();
+		store(value);
+		end_write();
+	}
+
+	// Modify the value in place with the given function that takes a
+	// reference to the value.
+	template <typename Function>
+	void update(Function function)
+	{
+		update(function, no_backoff{});
+	}
+
+	template <typename Function, typename Backoff>
+	void update(Function function, Backoff backoff)
+	{
+		lock_guard<lock_type> guard(lock_, backoff);
+
+		// With writers serialized the value cannot change under us.
+		T value;
+		load(value);
+		function(value);
+
+		begin_write();
+		store(value);
+		end_write();
+	}
+
+private:
+	using word = std::uintptr_t;
+
+	static constexpr std::size_t word_count = (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+
+	std::atomic<std::uint32_t> seq_ = ATOMIC_VAR_INIT(0);
+	std::atomic<word> data_[word_count];
+
+	// Keep the writer lock away from the data the readers poll.
+	alignas(cache_line_size) lock_type lock_;
+
+	void begin_write() noexcept
+	{
+		seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void end_write() noexcept
+	{
+		seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void load(T &value) const noexcept
+	{
+		word data[word_count];
+		for (std::size_t i = 0; i < word_count; i++)
+			data[i] = data_[i].load(std::memory_order_relaxed);
+		std::memcpy(&value, data, sizeof(T));
+	}
+
+	void store(const T &value) noexcept
+	{
+		word data[word_count] = {};
+		std::memcpy(data, &value, sizeof(T));
+		for (std::size_t i = 0; i < word_count; i++)
+			data_[i].store(data[i], std::memory_order_relaxed);
+	}
+};
+
+} // namespace evenk
+
+#endif // !EVENK_SEQLOCK_H_
@@ -27,6 +27,7 @@
 
 #include <atomic>
 #include <cstdint>
+#include <new>
 
 #include "backoff.h"
 #include "basic.h"
@@ -136,6 +137,334 @@ private:
 	std::atomic<base_type> tail_ = ATOMIC_VAR_INIT(0);
 };
 
+//
+// MCS queue lock. Every waiter spins on its own cache-line-aligned queue
+// node so that lock handoff touches only the successor's cache line.
+//
+// Queue nodes might be supplied explicitly with lock(node &)/unlock(node &)
+// calls or with the mcs_lock::guard helper that keeps its node on the stack.
+// The plain lock()/unlock() calls take nodes from a small per-thread cache
+// so that the lock could be used as any other lock in this file.
+//
+
+namespace detail {
+
+struct alignas(cache_line_size) queue_lock_node
+{
+	std::atomic<queue_lock_node *> next;
+	std::atomic<bool> wait;
+};
+
+// A process-wide free list of queue lock nodes. The nodes are only released
+// to the system on exit. So a stale node pointer is always safe to peek at.
+class queue_lock_node_pool : non_copyable
+{
+public:
+	~queue_lock_node_pool() noexcept
+	{
+		while (free_ != nullptr) {
+			queue_lock_node *node = free_;
+			free_ = node->next.load(std::memory_order_relaxed);
+			node->~queue_lock_node();
+			std::free(node);
+		}
+	}
+
+	static queue_lock_node_pool &instance() noexcept
+	{
+		static queue_lock_node_pool pool;
+		return pool;
+	}
+
+	queue_lock_node *take() noexcept
+	{
+		lock_.lock();
+		queue_lock_node *list = free_;
+		free_ = nullptr;
+		lock_.unlock();
+		return list;
+	}
+
+	void give(queue_lock_node *list) noexcept
+	{
+		queue_lock_node *last = list;
+		while (last->next.load(std::memory_order_relaxed) != nullptr)
+			last = last->next.load(std::memory_order_relaxed);
+
+		lock_.lock();
+		last->next.store(free_, std::memory_order_relaxed);
+		free_ = list;
+		lock_.unlock();
+	}
+
+private:
+	spin_lock lock_;
+	queue_lock_node *free_ = nullptr;
+};
+
+// A per-thread free list of queue lock nodes.
+class queue_lock_node_cache : non_copyable
+{
+public:
+	~queue_lock_node_cache() noexcept
+	{
+		if (free_ != nullptr)
+			queue_lock_node_pool::instance().give(free_);
+	}
+
+	static queue_lock_node_cache &instance() noexcept
+	{
+		static thread_local queue_lock_node_cache cache;
+		return cache;
+	}
+
+	queue_lock_node *get()
+	{
+		if (free_ == nullptr) {
+			free_ = queue_lock_node_pool::instance().take();
+			if (free_ == nullptr)
+				return new (cache_aligned_alloc(sizeof(queue_lock_node)))
+					queue_lock_node;
+		}
+		queue_lock_node *node = free_;
+		free_ = node->next.load(std::memory_order_relaxed);
+		return node;
+	}
+
+	void put(queue_lock_node *node) noexcept
+	{
+		node->next.store(free_, std::memory_order_relaxed);
+		free_ = node;
+	}
+
+private:
+	queue_lock_node *free_ = nullptr;
+};
+
+} // namespace detail
+
+class mcs_lock : non_copyable
+{
+public:
+	using node = detail::queue_lock_node;
+
+	class guard;
+
+	void lock()
+	{
+		lock(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff)
+	{
+		auto &cache = detail::queue_lock_node_cache::instance();
+		node *n = cache.get();
+		lock(*n, backoff);
+		owner_ = n;
+	}
+
+	bool try_lock()
+	{
+		auto &cache = detail::queue_lock_node_cache::instance();
+		node *n = cache.get();
+		if (!try_lock(*n)) {
+			cache.put(n);
+			return false;
+		}
+		owner_ = n;
+		return true;
+	}
+
+	void unlock() noexcept
+	{
+		node *n = owner_;
+		unlock(*n);
+		detail::queue_lock_node_cache::instance().put(n);
+	}
+
+	void lock(node &n) noexcept
+	{
+		lock(n, no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(node &n, Backoff backoff) noexcept
+	{
+		n.next.store(nullptr, std::memory_order_relaxed);
+		n.wait.store(true, std::memory_order_relaxed);
+		node *pred = tail_.exchange(&n, std::memory_order_acq_rel);
+		if (pred != nullptr) {
+			pred->next.store(&n, std::memory_order_release);
+			while (n.wait.load(std::memory_order_acquire))
+				backoff();
+		}
+	}
+
+	bool try_lock(node &n) noexcept
+	{
+		n.next.store(nullptr, std::memory_order_relaxed);
+		node *tail = nullptr;
+		return tail_.compare_exchange_strong(
+			tail, &n, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void unlock(node &n) noexcept
+	{
+		node *next = n.next.load(std::memory_order_acquire);
+		if (next == nullptr) {
+			node *tail = &n;
+			if (tail_.compare_exchange_strong(
+				    tail, nullptr, std::memory_order_release, std::memory_order_relaxed))
+				return;
+			// A successor has already swapped the tail but has not yet
+			// linked itself to this node.
+			while ((next = n.next.load(std::memory_order_acquire)) == nullptr)
+				cpu_relax{}(1);
+		}
+		next->wait.store(false, std::memory_order_release);
+	}
+
+private:
+	std::atomic<node *> tail_ = ATOMIC_VAR_INIT(nullptr);
+	// The node of the current owner, it is only accessed under the lock.
+	node *owner_ = nullptr;
+};
+
+// A scoped MCS lock holder that keeps its queue node in place.
+class mcs_lock::guard : non_copyable
+{
+public:
+	guard(mcs_lock &lock) noexcept : lock_(lock)
+	{
+		lock_.lock(node_);
+	}
+
+	template <typename Backoff>
+	guard(mcs_lock &lock, Backoff backoff) noexcept : lock_(lock)
+	{
+		lock_.lock(node_, backoff);
+	}
+
+	~guard() noexcept
+	{
+		lock_.unlock(node_);
+	}
+
+private:
+	mcs_lock &lock_;
+	node node_;
+};
+
+//
+// CLH queue lock. Every waiter spins on the node of its predecessor. On
+// acquisition the predecessor node is taken over for later reuse and on
+// release the owner node is handed to the successor. So unlike MCS the
+// unlock operation is a single store.
+//
+
+class clh_lock : non_copyable
+{
+public:
+	using node = detail::queue_lock_node;
+
+	clh_lock() : tail_(detail::queue_lock_node_cache::instance().get())
+	{
+		node *n = tail_.load(std::memory_order_relaxed);
+		n->wait.store(false, std::memory_order_relaxed);
+		// Make sure the pool outlives a lock with static storage.
+		detail::queue_lock_node_pool::instance();
+	}
+
+	// The node goes straight to the process-wide pool as the per-thread
+	// cache might be already destroyed if this is a static object.
+	~clh_lock() noexcept
+	{
+		node *n = tail_.load(std::memory_order_relaxed);
+		n->next.store(nullptr, std::memory_order_relaxed);
+		detail::queue_lock_node_pool::instance().give(n);
+	}
+
+	void lock()
+	{
+		lock(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff)
+	{
+		auto &cache = detail::queue_lock_node_cache::instance();
+		node *n = cache.get();
+		n->next.store(nullptr, std::memory_order_relaxed);
+		n->wait.store(true, std::memory_order_relaxed);
+		node *pred = tail_.exchange(n, std::memory_order_acq_rel);
+		while (pred->wait.load(std::memory_order_acquire)) {
+			// The predecessor has given up its place in a failed
+			// try_lock() call. Take over its own predecessor.
+			node *next = pred->next.load(std::memory_order_acquire);
+			if (next != nullptr) {
+				cache.put(pred);
+				pred = next;
+				continue;
+			}
+			backoff();
+		}
+		owner_ = n;
+		pred_ = pred;
+	}
+
+	bool try_lock()
+	{
+		node *pred = tail_.load(std::memory_order_acquire);
+		if (pred->wait.load(std::memory_order_relaxed))
+			return false;
+
+		auto &cache = detail::queue_lock_node_cache::instance();
+		node *n = cache.get();
+		n->next.store(nullptr, std::memory_order_relaxed);
+		n->wait.store(true, std::memory_order_relaxed);
+		if (!tail_.compare_exchange_strong(
+			    pred, n, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+			cache.put(n);
+			return false;
+		}
+
+		// The predecessor node might have been recycled and enqueued
+		// again in between. Then the lock is busy. Rather than wait
+		// for it leave the queue. If nobody has got behind the node
+		// yet just restore the tail. Otherwise let the successor skip
+		// the node and wait for the predecessor directly.
+		if (pred->wait.load(std::memory_order_acquire)) {
+			node *tail = n;
+			if (tail_.compare_exchange_strong(tail,
+							  pred,
+							  std::memory_order_acq_rel,
+							  std::memory_order_relaxed))
+				cache.put(n);
+			else
+				n->next.store(pred, std::memory_order_release);
+			return false;
+		}
+
+		owner_ = n;
+		pred_ = pred;
+		return true;
+	}
+
+	void unlock() noexcept
+	{
+		node *pred = pred_;
+		owner_->wait.store(false, std::memory_order_release);
+		detail::queue_lock_node_cache::instance().put(pred);
+	}
+
+private:
+	std::atomic<node *> tail_;
+	// The nodes of the current owner, they are only accessed under the lock.
+	node *owner_ = nullptr;
+	node *pred_ = nullptr;
+};
+
 class shared_ticket_lock : non_copyable
 {
 public:
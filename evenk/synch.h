@@ -25,6 +25,7 @@
 #ifndef EVENK_SYNCH_H_
 #define EVENK_SYNCH_H_
 
+#include <chrono>
 #include <condition_variable>
 #include <limits>
 #include <mutex>
@@ -118,6 +119,26 @@ public:
 			value, 1, std::memory_order_acquire, std::memory_order_relaxed);
 	}
 
+	template <typename Duration>
+	bool try_lock_until(
+		const steady_time_point<Duration> &abs_time) noexcept
+	{
+		if (try_lock())
+			return true;
+		while (futex_.exchange(2, std::memory_order_acquire)) {
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return false;
+			futex_wait_until(futex_, 2, abs_time);
+		}
+		return true;
+	}
+
+	template <typename Rep, typename Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &rel_time) noexcept
+	{
+		return try_lock_until(std::chrono::steady_clock::now() + rel_time);
+	}
+
 	void unlock() noexcept
 	{
 		if (futex_.fetch_sub(1, std::memory_order_release) != 1) {
@@ -135,6 +156,121 @@ private:
 	futex_t futex_ = ATOMIC_VAR_INIT(0);
 };
 
+//
+// A ticket-based shared lock that blocks waiters on a futex as soon as the
+// backoff ceiling is reached. It keeps the FIFO fairness of shared_ticket_lock
+// but does not burn CPU when the lock is held for a long time. All waiters
+// sleep on the same futex and are woken together on every release, then the
+// ones that have not got their turn yet go back to sleep.
+//
+
+class futex_shared_lock : non_copyable
+{
+public:
+	using native_handle_type = futex_t &;
+
+	constexpr futex_shared_lock() noexcept = default;
+
+	void lock() noexcept
+	{
+		lock(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock(Backoff backoff) noexcept
+	{
+		std::uint32_t tail = tail_.fetch_add(exclusive_step, std::memory_order_relaxed);
+		wait(tail, ~std::uint32_t(0), backoff);
+	}
+
+	bool try_lock() noexcept
+	{
+		std::uint32_t head = head_.load(std::memory_order_acquire);
+		std::uint32_t tail = tail_.load(std::memory_order_relaxed);
+		return head == tail
+		       && tail_.compare_exchange_strong(
+				  tail, tail + exclusive_step, std::memory_order_relaxed);
+	}
+
+	void unlock() noexcept
+	{
+		std::uint32_t head = head_.load(std::memory_order_relaxed);
+		head_.store(head + exclusive_step, std::memory_order_release);
+		wake();
+	}
+
+	void lock_shared() noexcept
+	{
+		lock_shared(no_backoff{});
+	}
+
+	template <typename Backoff>
+	void lock_shared(Backoff backoff) noexcept
+	{
+		std::uint32_t tail = tail_.fetch_add(shared_step, std::memory_order_relaxed);
+		wait(tail & exclusive_mask, exclusive_mask, backoff);
+	}
+
+	bool try_lock_shared() noexcept
+	{
+		std::uint32_t head = head_.load(std::memory_order_acquire);
+		std::uint32_t tail = tail_.load(std::memory_order_relaxed);
+		return (head & exclusive_mask) == (tail & exclusive_mask)
+		       && tail_.compare_exchange_strong(
+				  tail, tail + shared_step, std::memory_order_relaxed);
+	}
+
+	void unlock_shared() noexcept
+	{
+		head_.fetch_add(shared_step, std::memory_order_release);
+		wake();
+	}
+
+	native_handle_type native_handle() noexcept
+	{
+		return head_;
+	}
+
+private:
+	static constexpr std::uint32_t shared_step = 1 << 16;
+	static constexpr std::uint32_t exclusive_mask = shared_step - 1;
+	static constexpr std::uint32_t exclusive_step = 1;
+
+	futex_t head_ = ATOMIC_VAR_INIT(0);
+	futex_t waiters_ = ATOMIC_VAR_INIT(0);
+	std::atomic<std::uint32_t> tail_ = ATOMIC_VAR_INIT(0);
+
+	template <typename Backoff>
+	void wait(std::uint32_t tail, std::uint32_t mask, Backoff &backoff) noexcept
+	{
+		bool sleep = false;
+		for (;;) {
+			std::uint32_t head = head_.load(std::memory_order_acquire);
+			if (tail == (head & mask))
+				break;
+			if (!sleep) {
+				sleep = backoff();
+				continue;
+			}
+
+			// Announce the waiter before the final check so that
+			// either the check or the waker sees the other side.
+			waiters_.fetch_add(1, std::memory_order_seq_cst);
+			head = head_.load(std::memory_order_seq_cst);
+			if (tail != (head & mask))
+				futex_wait(head_, head);
+			waiters_.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	void wake() noexcept
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters_.load(std::memory_order_relaxed))
+			futex_wake(head_, std::numeric_limits<int>::max());
+	}
+};
+
 //
 // Lock Guard
 //
@@ -226,6 +362,94 @@ private:
 	bool owns_lock_;
 };
 
+//
+// Event Count
+//
+// An eventcount lets a thread wait for an arbitrary condition expressed on
+// other shared data without a lock. The waiter announces its intent with
+// prepare_wait(), re-checks the condition and then either cancels the wait
+// or commits to sleep. The notifier first makes the condition true and then
+// calls notify_one() or notify_all(). The notifier makes a futex syscall only
+// if there is some prepared waiter. So as long as nobody waits producers do
+// not pay anything more than a fence and a load.
+//
+
+class eventcount : non_copyable
+{
+public:
+	class key
+	{
+	public:
+		explicit key(std::uint32_t epoch) noexcept : epoch_(epoch)
+		{
+		}
+
+	private:
+		friend class eventcount;
+		std::uint32_t epoch_;
+	};
+
+	constexpr eventcount() noexcept = default;
+
+	key prepare_wait() noexcept
+	{
+		waiters_.fetch_add(1, std::memory_order_seq_cst);
+		return key(epoch_.load(std::memory_order_seq_cst));
+	}
+
+	void cancel_wait() noexcept
+	{
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void commit_wait(key k) noexcept
+	{
+		while (epoch_.load(std::memory_order_acquire) == k.epoch_)
+			futex_wait(epoch_, k.epoch_);
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Returns false on timeout.
+	template <typename Duration>
+	bool commit_wait_until(key k, const steady_time_point<Duration> &abs_time) noexcept
+	{
+		bool notified = true;
+		while (epoch_.load(std::memory_order_acquire) == k.epoch_) {
+			if (futex_wait_until(epoch_, k.epoch_, abs_time) == -ETIMEDOUT) {
+				notified = epoch_.load(std::memory_order_acquire) != k.epoch_;
+				break;
+			}
+		}
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+		return notified;
+	}
+
+	void notify_one() noexcept
+	{
+		notify(1);
+	}
+
+	void notify_all() noexcept
+	{
+		notify(std::numeric_limits<int>::max());
+	}
+
+private:
+	futex_t epoch_ = ATOMIC_VAR_INIT(0);
+	futex_t waiters_ = ATOMIC_VAR_INIT(0);
+
+	void notify(int count) noexcept
+	{
+		// Either the notifier sees a prepared waiter or the waiter sees
+		// the condition that the notifier has set.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters_.load(std::memory_order_relaxed) == 0)
+			return;
+		epoch_.fetch_add(1, std::memory_order_release);
+		futex_wake(epoch_, count);
+	}
+};
+
 //
 // Condition Variables
 //
@@ -249,6 +473,36 @@ public:
 			throw_system_error(rc, "pthread_cond_wait()");
 	}
 
+	template <typename Duration>
+	std::cv_status wait_until(
+		std::unique_lock<posix_mutex> &lock,
+		const steady_time_point<Duration> &abs_time)
+	{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+		struct timespec ts = to_timespec(abs_time.time_since_epoch());
+		int rc = pthread_cond_clockwait(
+			&cond_, lock.mutex()->native_handle(), CLOCK_MONOTONIC, &ts);
+#else
+		// The condition variable uses CLOCK_REALTIME by default.
+		auto rel_time = abs_time - std::chrono::steady_clock::now();
+		auto sys_time = std::chrono::system_clock::now() + rel_time;
+		struct timespec ts = to_timespec(sys_time.time_since_epoch());
+		int rc = pthread_cond_timedwait(&cond_, lock.mutex()->native_handle(), &ts);
+#endif
+		if (rc == ETIMEDOUT)
+			return std::cv_status::timeout;
+		if (rc)
+			throw_system_error(rc, "pthread_cond_timedwait()");
+		return std::cv_status::no_timeout;
+	}
+
+	template <typename Rep, typename Period>
+	std::cv_status wait_for(std::unique_lock<posix_mutex> &lock,
+				const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		return wait_until(lock, std::chrono::steady_clock::now() + rel_time);
+	}
+
 	void notify_one() noexcept
 	{
 		pthread_cond_signal(&cond_);
@@ -266,6 +520,20 @@ public:
 
 private:
 	pthread_cond_t cond_ = PTHREAD_COND_INITIALIZER;
+
+	template <typename Duration>
+	static struct timespec to_timespec(const Duration &duration) noexcept
+	{
+		using std::chrono::nanoseconds;
+		auto ns = std::chrono::duration_cast<nanoseconds>(duration).count();
+		if (ns < 0)
+			ns = 0;
+
+		struct timespec ts;
+		ts.tv_sec = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		return ts;
+	}
 };
 
 class futex_cond_var : non_copyable
@@ -299,6 +567,41 @@ public:
 			futex_wait(owner_futex, 2);
 	}
 
+	// If the waiter gets requeued to the lock futex by notify_all() then
+	// the deadline stays in effect as it is absolute.
+	template <typename Duration>
+	std::cv_status wait_until(
+		lock_guard<futex_lock> &guard,
+		const steady_time_point<Duration> &abs_time) noexcept
+	{
+		futex_lock *owner = guard.mutex();
+		if (owner_ != nullptr && owner_ != owner)
+			std::terminate();
+		owner_.store(owner, std::memory_order_relaxed);
+
+		count_.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acq_rel);
+		std::uint32_t value = futex_.load(std::memory_order_relaxed);
+
+		owner->unlock();
+
+		int rc = futex_wait_until(futex_, value, abs_time);
+
+		futex_t &owner_futex = owner->native_handle();
+		count_.fetch_sub(1, std::memory_order_relaxed);
+		while (owner_futex.exchange(2, std::memory_order_acquire))
+			futex_wait(owner_futex, 2);
+
+		return rc == -ETIMEDOUT ? std::cv_status::timeout : std::cv_status::no_timeout;
+	}
+
+	template <typename Rep, typename Period>
+	std::cv_status wait_for(lock_guard<futex_lock> &guard,
+				const std::chrono::duration<Rep, Period> &rel_time) noexcept
+	{
+		return wait_until(guard, std::chrono::steady_clock::now() + rel_time);
+	}
+
 	void notify_one() noexcept
 	{
 		futex_.fetch_add(1, std::memory_order_acquire);
@@ -326,6 +629,124 @@ private:
 	std::atomic<futex_lock *> owner_ = ATOMIC_VAR_INIT(nullptr);
 };
 
+class futex_shared_cond_var : non_copyable
+{
+public:
+	constexpr futex_shared_cond_var() noexcept = default;
+
+	void wait(lock_guard<futex_shared_lock> &guard) noexcept
+	{
+		futex_shared_lock *owner = guard.mutex();
+
+		count_.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acq_rel);
+		std::uint32_t value = futex_.load(std::memory_order_relaxed);
+
+		owner->unlock();
+
+		futex_wait(futex_, value);
+
+		count_.fetch_sub(1, std::memory_order_relaxed);
+		owner->lock();
+	}
+
+	template <typename Duration>
+	std::cv_status wait_until(
+		lock_guard<futex_shared_lock> &guard,
+		const steady_time_point<Duration> &abs_time) noexcept
+	{
+		futex_shared_lock *owner = guard.mutex();
+
+		count_.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acq_rel);
+		std::uint32_t value = futex_.load(std::memory_order_relaxed);
+
+		owner->unlock();
+
+		int rc = futex_wait_until(futex_, value, abs_time);
+
+		count_.fetch_sub(1, std::memory_order_relaxed);
+		owner->lock();
+
+		return rc == -ETIMEDOUT ? std::cv_status::timeout : std::cv_status::no_timeout;
+	}
+
+	template <typename Rep, typename Period>
+	std::cv_status wait_for(lock_guard<futex_shared_lock> &guard,
+				const std::chrono::duration<Rep, Period> &rel_time) noexcept
+	{
+		return wait_until(guard, std::chrono::steady_clock::now() + rel_time);
+	}
+
+	void notify_one() noexcept
+	{
+		futex_.fetch_add(1, std::memory_order_acquire);
+		if (count_.load(std::memory_order_relaxed))
+			futex_wake(futex_, 1);
+	}
+
+	void notify_all() noexcept
+	{
+		futex_.fetch_add(1, std::memory_order_acquire);
+		if (count_.load(std::memory_order_relaxed))
+			futex_wake(futex_, std::numeric_limits<int>::max());
+	}
+
+private:
+	futex_t futex_ = ATOMIC_VAR_INIT(0);
+	futex_t count_ = ATOMIC_VAR_INIT(0);
+};
+
+//
+// A condition variable that works with any lock and does not make a syscall
+// on notification unless there are waiters.
+//
+
+class eventcount_cond_var : non_copyable
+{
+public:
+	constexpr eventcount_cond_var() noexcept = default;
+
+	template <typename Guard>
+	void wait(Guard &guard)
+	{
+		eventcount::key key = event_.prepare_wait();
+		guard.unlock();
+		event_.commit_wait(key);
+		guard.lock();
+	}
+
+	template <typename Guard, typename Duration>
+	std::cv_status wait_until(Guard &guard, const steady_time_point<Duration> &abs_time)
+	{
+		eventcount::key key = event_.prepare_wait();
+		guard.unlock();
+		bool notified = event_.commit_wait_until(key, abs_time);
+		guard.lock();
+		return notified ? std::cv_status::no_timeout : std::cv_status::timeout;
+	}
+
+	template <typename Guard, typename Rep, typename Period>
+	std::cv_status
+	wait_for(Guard &guard, const std::chrono::duration<Rep, Period> &rel_time)
+	{
+		return wait_until(guard, std::chrono::steady_clock::now() + rel_time);
+	}
+
+	void notify_one() noexcept
+	{
+		event_.notify_one();
+	}
+
+	void notify_all() noexcept
+	{
+		event_.notify_all();
+	}
+
+private:
+	eventcount event_;
+};
+
 //
 // Synchronization Traits
 //
@@ -351,6 +772,20 @@ struct futex_synch
 	using lock_owner_type = lock_guard<futex_lock>;
 };
 
+struct futex_shared_synch
+{
+	using lock_type = futex_shared_lock;
+	using cond_var_type = futex_shared_cond_var;
+	using lock_owner_type = lock_guard<futex_shared_lock>;
+};
+
+struct eventcount_synch
+{
+	using lock_type = futex_lock;
+	using cond_var_type = eventcount_cond_var;
+	using lock_owner_type = lock_guard<futex_lock>;
+};
+
 #if __linux__
 using default_synch = futex_synch;
 #else
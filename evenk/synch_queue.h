@@ -25,8 +25,11 @@
 #ifndef EVENK_SYNCH_QUEUE_H_
 #define EVENK_SYNCH_QUEUE_H_
 
+#include <chrono>
+#include <cstddef>
 #include <deque>
 
+#include "async.h"
 #include "conqueue.h"
 #include "synch.h"
 
@@ -64,6 +67,12 @@ public:
 		lock_owner_type guard(lock_);
 		closed_ = true;
 		cond_.notify_all();
+
+		std::size_t waiters = async_waiters_;
+		async_waiters_ = 0;
+		guard.unlock();
+		if (waiters != 0)
+			async_parking_lot::unpark_all(this);
 	}
 
 	bool is_closed() const noexcept
@@ -146,6 +155,36 @@ public:
 		return status;
 	}
 
+	template <typename Duration, typename... Backoff>
+	queue_op_status
+	wait_pop_until(value_type &value,
+		       const steady_time_point<Duration> &abs_time,
+		       Backoff &&... backoff)
+	{
+		lock_owner_type guard(lock_, std::forward<Backoff>(backoff)...);
+		auto status = locked_pop(value);
+		while (status == queue_op_status::empty) {
+			if (cond_.wait_until(guard, abs_time) == std::cv_status::timeout) {
+				status = locked_pop(value);
+				if (status == queue_op_status::empty)
+					return queue_op_status::timeout;
+				break;
+			}
+			status = locked_pop(value);
+		}
+		return status;
+	}
+
+	template <typename Rep, typename Period, typename... Backoff>
+	queue_op_status wait_pop_for(value_type &value,
+				     const std::chrono::duration<Rep, Period> &rel_time,
+				     Backoff &&... backoff)
+	{
+		return wait_pop_until(value,
+				      std::chrono::steady_clock::now() + rel_time,
+				      std::forward<Backoff>(backoff)...);
+	}
+
 	//
 	// Non-waiting operations
 	//
@@ -154,14 +193,14 @@ public:
 	queue_op_status try_push(const value_type &value, Backoff &&... backoff)
 	{
 		lock_owner_type guard(lock_, std::forward<Backoff>(backoff)...);
-		return locked_push(value);
+		return wake_async_waiter(guard, locked_push(value));
 	}
 
 	template <typename... Backoff>
 	queue_op_status try_push(value_type &&value, Backoff &&... backoff)
 	{
 		lock_owner_type guard(lock_, std::forward<Backoff>(backoff)...);
-		return locked_push(std::move(value));
+		return wake_async_waiter(guard, locked_push(std::move(value)));
 	}
 
 	template <typename... Backoff>
@@ -181,7 +220,7 @@ public:
 		lock_owner_type guard(lock_, std::try_to_lock);
 		if (!guard.owns_lock())
 			return queue_op_status::busy;
-		return locked_push(value);
+		return wake_async_waiter(guard, locked_push(value));
 	}
 
 	queue_op_status nonblocking_push(value_type &&value)
@@ -189,7 +228,7 @@ public:
 		lock_owner_type guard(lock_, std::try_to_lock);
 		if (!guard.owns_lock())
 			return queue_op_status::busy;
-		return locked_push(std::move(value));
+		return wake_async_waiter(guard, locked_push(std::move(value)));
 	}
 
 	queue_op_status nonblocking_pop(value_type &value)
@@ -201,7 +240,88 @@ public:
 	}
 #endif // ENABLE_QUEUE_NONBLOCKING_OPS
 
+	//
+	// Coroutine operations
+	//
+
+	// Pop a value in a coroutine: co_await queue.async_pop(). Throws the
+	// closed status just like value_pop(). If the queue is empty the
+	// coroutine is parked and later resumed by a push call on the pushing
+	// thread.
+	class async_pop_op : public async_waiter
+	{
+	public:
+		explicit async_pop_op(synch_queue &queue) noexcept
+			: async_waiter(&wake), queue_(queue)
+		{
+		}
+
+		bool await_ready()
+		{
+			status_ = queue_.try_pop(value_);
+			return status_ != queue_op_status::empty;
+		}
+
+		template <typename Handle>
+		bool await_suspend(Handle handle)
+		{
+			set_handle(handle);
+			return park();
+		}
+
+		value_type await_resume()
+		{
+			if (status_ != queue_op_status::success)
+				throw status_;
+			return std::move(value_);
+		}
+
+	private:
+		// Returns false if the operation has completed instead.
+		bool park()
+		{
+			lock_owner_type guard(queue_.lock_);
+			status_ = queue_.locked_pop(value_);
+			if (status_ != queue_op_status::empty)
+				return false;
+
+			// Pushers look at the counter with the queue lock held
+			// so the waiter is parked before they might unpark it.
+			queue_.async_waiters_++;
+			async_parking_lot::park(&queue_, *this, [] { return true; });
+			return true;
+		}
+
+		static void wake(async_waiter &waiter)
+		{
+			async_pop_op &self = static_cast<async_pop_op &>(waiter);
+			if (!self.park())
+				self.resume();
+		}
+
+		synch_queue &queue_;
+		queue_op_status status_ = queue_op_status::empty;
+		value_type value_;
+	};
+
+	async_pop_op async_pop() noexcept
+	{
+		return async_pop_op(*this);
+	}
+
 private:
+	// Hand a freshly pushed value to a parked coroutine. This has to be
+	// done with the lock released as the coroutine takes it on wakeup.
+	queue_op_status wake_async_waiter(lock_owner_type &guard, queue_op_status status)
+	{
+		if (status != queue_op_status::success || async_waiters_ == 0)
+			return status;
+		async_waiters_--;
+		guard.unlock();
+		async_parking_lot::unpark_one(this);
+		return status;
+	}
+
 	queue_op_status locked_push(const value_type &value)
 	{
 		if (closed_)
@@ -236,6 +356,7 @@ private:
 	}
 
 	bool closed_;
+	std::size_t async_waiters_ = 0;
 	mutable lock_type lock_;
 	cond_var_type cond_;
 	sequence_type queue_;
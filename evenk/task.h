@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <memory>
+#include <new>
 #include <type_traits>
 #include <utility>
 
@@ -351,22 +352,29 @@ public:
 			wrapper_.helper_(this, nullptr);
 	}
 
-	task(task &&other) noexcept : base(nullptr, other.invoke_)
+	task(task &&other) noexcept : base(nullptr, other.invoke_), wrapper_(other.wrapper_)
 	{
-		other.wrapper_.helper_(this, &other);
-		std::swap(other.wrapper_.helper_, wrapper_.helper_);
+		if (other.wrapper_.helper_ != nullptr) {
+			other.wrapper_.helper_(this, &other);
+			other.wrapper_.helper_ = nullptr;
+		}
 		other.invoke_ = invalid_invoke;
 	}
 
 	task &operator=(task &&other) noexcept
 	{
-		task(std::move(other)).swap(*this);
+		if (this != &other) {
+			this->~task();
+			new (this) task(std::move(other));
+		}
 		return *this;
 	}
 
 	void swap(task &other) noexcept
 	{
-		std::swap(*this, other);
+		task temp(std::move(other));
+		other = std::move(*this);
+		*this = std::move(temp);
 	}
 
 	explicit operator bool() const noexcept
@@ -29,7 +29,6 @@
 
 #include <thread>
 #include <utility>
-#include <vector>
 
 #include <pthread.h>
 #ifdef HAVE_SCHED_H
@@ -37,13 +36,14 @@
 #endif
 
 #include "basic.h"
+#include "cpuset.h"
 
 namespace evenk {
 
 class thread : public std::thread
 {
 public:
-	using cpuset_type = std::vector<bool>;
+	using cpuset_type = cpuset;
 
 	thread() noexcept = default;
 
@@ -83,19 +83,8 @@ public:
 		if (!joinable())
 			throw_system_error(EINVAL, "affinity");
 
-		int cpu_num = cpuset.size();
-		// TODO: use CPU_ALLOC instead
-		if (cpu_num > CPU_SETSIZE)
-			cpu_num = CPU_SETSIZE;
-
-		cpu_set_t native_cpuset;
-		CPU_ZERO(&native_cpuset);
-		for (int cpu = 0; cpu < cpu_num; cpu++) {
-			if (cpuset[cpu])
-				CPU_SET(cpu, &native_cpuset);
-		}
-
-		int rc = pthread_setaffinity_np(handle, sizeof native_cpuset, &native_cpuset);
+		int rc = pthread_setaffinity_np(
+			handle, cpuset.native_size(), cpuset.native_handle());
 		if (rc != 0)
 			throw_system_error(rc, "pthread_setaffinity_np");
 	}
@@ -106,21 +95,11 @@ public:
 		if (!joinable())
 			throw_system_error(EINVAL, "affinity");
 
-		int cpu_num = std::thread::hardware_concurrency();
-		// TODO: use CPU_ALLOC instead
-		if (cpu_num > CPU_SETSIZE)
-			cpu_num = CPU_SETSIZE;
-
-		cpu_set_t native_cpuset;
-		int rc = pthread_getaffinity_np(handle, sizeof native_cpuset, &native_cpuset);
-		if (rc != 0)
-			throw_system_error(rc, "pthread_getaffinity_np");
-
-		cpuset_type cpuset;
-		for (int cpu = 0; cpu < cpu_num; cpu++)
-			cpuset.push_back(CPU_ISSET(cpu, &native_cpuset));
-
-		return cpuset;
+		return cpuset_type::query(
+			[handle](std::size_t size, cpu_set_t *set) {
+				return pthread_getaffinity_np(handle, size, set);
+			},
+			"pthread_getaffinity_np");
 	}
 
 #else // HAVE_PTHREAD_SETAFFINITY_NP
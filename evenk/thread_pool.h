@@ -26,12 +26,18 @@
 #define EVENK_THREAD_POOL_H_
 
 #include <atomic>
+#include <cstdlib>
+#include <new>
 
+#include "async.h"
 #include "basic.h"
 #include "conqueue.h"
+#include "future.h"
 #include "synch.h"
 #include "task.h"
 #include "thread.h"
+#include "topology.h"
+#include "ws_deque.h"
 
 namespace evenk {
 
@@ -82,14 +88,30 @@ protected:
 	virtual void work() = 0;
 	virtual void shutdown() = 0;
 
-	void activate(std::size_t size)
+	// Start the workers. With a placement every worker is pinned to its
+	// CPU right after it is started. If a worker cannot be started or
+	// pinned, e.g. its CPU is not in the process affinity mask, then the
+	// workers that are already running are stopped before the error is
+	// passed on.
+	void activate(std::size_t size, const cpu_placement *placement = nullptr)
 	{
 		if (pool_.size())
 			throw std::logic_error("thread_pool is already active");
 
 		pool_.reserve(size);
-		for (std::size_t i = 0; i < size; i++)
-			pool_.emplace_back(&thread_pool_base::work, this);
+		try {
+			for (std::size_t i = 0; i < size; i++) {
+				pool_.emplace_back(&thread_pool_base::work, this);
+				if (placement != nullptr)
+					pool_[i].affinity((*placement)(i));
+			}
+		} catch (...) {
+			// This is called from a derived constructor so the
+			// shutdown() override is still there.
+			stop();
+			wait();
+			throw;
+		}
 	}
 
 private:
@@ -137,12 +159,48 @@ public:
 		activate(size);
 	}
 
+	template <typename... QueueArgs>
+	thread_pool(std::size_t size, const cpu_placement &placement, QueueArgs... queue_args)
+		: thread_pool_base(), queue_(queue_args...)
+	{
+		activate(size, &placement);
+	}
+
+	~thread_pool() noexcept
+	{
+		stop();
+		wait();
+	}
+
 	template <typename Callable>
 	void submit(Callable &&callable)
 	{
 		queue_.push(task_type(std::forward<Callable>(callable), alloc_));
 	}
 
+	// Submit a task and get a future for its result.
+	template <typename Callable>
+	auto submit_with_result(Callable &&callable)
+	{
+		return detail::future_submit(*this, std::forward<Callable>(callable));
+	}
+
+	// Continue a coroutine on a pool thread: co_await pool.schedule().
+	async_schedule_op<thread_pool> schedule() noexcept
+	{
+		return async_schedule_op<thread_pool>(*this);
+	}
+
+	// Run a pending task in the calling thread if there is any.
+	bool try_run_one()
+	{
+		task_type task;
+		if (queue_.try_pop(task) != queue_op_status::success)
+			return false;
+		task();
+		return true;
+	}
+
 private:
 	queue_type queue_;
 	allocator_type alloc_;
@@ -169,6 +227,237 @@ private:
 	}
 };
 
+//
+// A work-stealing thread pool. Every worker has its own deque. Tasks that
+// are submitted by a worker go to its deque and tasks from other threads
+// go to the shared injection queue. A worker first looks at its own deque,
+// then at the injection queue, and then tries to steal from other workers
+// in random order. Idle workers sleep on an eventcount.
+//
+// The template parameters are the same as for thread_pool so one might be
+// replaced with another.
+//
+
+template <template <typename> class Queue,
+	  std::size_t S = 2 * fptr_size,
+	  typename A = std::allocator<char>>
+class ws_thread_pool final : public thread_pool_base
+{
+public:
+	using allocator_type = A;
+
+	static constexpr std::size_t task_size = S;
+	using task_type = task<void, task_size, allocator_type>;
+
+	using queue_type = Queue<task_type>;
+	using deque_type = ws_deque<task_type>;
+
+	template <typename... QueueArgs>
+	ws_thread_pool(std::size_t size, QueueArgs... queue_args)
+		: thread_pool_base(), queue_(queue_args...)
+	{
+		start(size);
+	}
+
+	template <typename... QueueArgs>
+	ws_thread_pool(std::size_t size, const allocator_type &alloc, QueueArgs... queue_args)
+		: thread_pool_base(), queue_(queue_args...), alloc_(alloc)
+	{
+		start(size);
+	}
+
+	template <typename... QueueArgs>
+	ws_thread_pool(std::size_t size,
+		       const cpu_placement &placement,
+		       QueueArgs... queue_args)
+		: thread_pool_base(), queue_(queue_args...)
+	{
+		start(size, &placement);
+	}
+
+	~ws_thread_pool() noexcept
+	{
+		stop();
+		wait();
+		destroy();
+	}
+
+	template <typename Callable>
+	void submit(Callable &&callable)
+	{
+		task_type task(std::forward<Callable>(callable), alloc_);
+
+		worker *self = current();
+		if (self != nullptr && self->pool == this)
+			self->deque.push(std::move(task));
+		else
+			queue_.push(std::move(task));
+
+		event_.notify_one();
+	}
+
+	// Submit a task and get a future for its result.
+	template <typename Callable>
+	auto submit_with_result(Callable &&callable)
+	{
+		return detail::future_submit(*this, std::forward<Callable>(callable));
+	}
+
+	// Continue a coroutine on a pool thread: co_await pool.schedule().
+	async_schedule_op<ws_thread_pool> schedule() noexcept
+	{
+		return async_schedule_op<ws_thread_pool>(*this);
+	}
+
+	// Run a pending task in the calling thread if there is any. A worker
+	// thread looks at its own deque first.
+	bool try_run_one()
+	{
+		task_type task;
+		worker *self = current();
+		if (self != nullptr && self->pool == this) {
+			if (!find(*self, task))
+				return false;
+		} else if (queue_.try_pop(task) != queue_op_status::success) {
+			static thread_local std::uint32_t seed = 1;
+			if (!steal(nullptr, seed, task))
+				return false;
+		}
+		task();
+		return true;
+	}
+
+private:
+	struct alignas(cache_line_size) worker
+	{
+		explicit worker(ws_thread_pool *p, std::uint32_t s) : pool(p), seed(s)
+		{
+		}
+
+		ws_thread_pool *pool;
+		std::uint32_t seed;
+		deque_type deque;
+	};
+
+	queue_type queue_;
+	allocator_type alloc_;
+
+	worker *workers_ = nullptr;
+	std::size_t size_ = 0;
+	std::atomic<std::size_t> next_index_ = ATOMIC_VAR_INIT(0);
+
+	std::atomic<bool> closed_ = ATOMIC_VAR_INIT(false);
+	eventcount event_;
+
+	static worker *&current() noexcept
+	{
+		static thread_local worker *self = nullptr;
+		return self;
+	}
+
+	void create(std::size_t size)
+	{
+		void *memory = cache_aligned_alloc(size * sizeof(worker));
+		if (memory == nullptr)
+			throw std::bad_alloc();
+
+		workers_ = static_cast<worker *>(memory);
+		for (; size_ < size; size_++)
+			new (&workers_[size_]) worker(this, size_ + 1);
+	}
+
+	// The destructor does not run if a constructor fails so the workers
+	// have to be destroyed here in that case.
+	void start(std::size_t size, const cpu_placement *placement = nullptr)
+	{
+		create(size);
+		try {
+			activate(size, placement);
+		} catch (...) {
+			destroy();
+			throw;
+		}
+	}
+
+	void destroy() noexcept
+	{
+		for (std::size_t i = 0; i < size_; i++)
+			workers_[i].~worker();
+		std::free(workers_);
+	}
+
+	virtual void work() override
+	{
+		worker &self = workers_[next_index_.fetch_add(1, std::memory_order_relaxed)];
+		current() = &self;
+
+		while (!is_stopped()) {
+			task_type task;
+			if (!find(self, task)) {
+				// Announce the intention to sleep and look once
+				// again to make sure no submission is missed.
+				auto key = event_.prepare_wait();
+				if (!find(self, task)) {
+					if (closed_.load(std::memory_order_acquire)) {
+						event_.cancel_wait();
+						break;
+					}
+					event_.commit_wait(key);
+					continue;
+				}
+				event_.cancel_wait();
+			}
+
+			task();
+		}
+
+		current() = nullptr;
+	}
+
+	virtual void shutdown() override
+	{
+		closed_.store(true, std::memory_order_release);
+		queue_.close();
+		event_.notify_all();
+	}
+
+	bool find(worker &self, task_type &task)
+	{
+		if (self.deque.try_pop(task) == queue_op_status::success)
+			return true;
+		if (queue_.try_pop(task) == queue_op_status::success)
+			return true;
+		return steal(&self, self.seed, task);
+	}
+
+	bool steal(worker *self, std::uint32_t &seed, task_type &task)
+	{
+		for (;;) {
+			// Use xorshift to choose the first victim.
+			std::uint32_t x = seed;
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			seed = x;
+
+			// Give up only if every deque is seen empty.
+			bool busy = false;
+			for (std::size_t i = 0; i < size_; i++) {
+				worker &victim = workers_[(x + i) % size_];
+				if (&victim == self)
+					continue;
+				auto status = victim.deque.try_steal(task);
+				if (status == queue_op_status::success)
+					return true;
+				if (status == queue_op_status::busy)
+					busy = true;
+			}
+			if (!busy)
+				return false;
+		}
+	}
+};
+
 } // namespace evenk
 
 #endif // !EVENK_THREAD_POOL_H_
@@ -0,0 +1,411 @@
+//
+// CPU Topology Discovery and Thread Placement
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_TOPOLOGY_H_
+#define EVENK_TOPOLOGY_H_
+
+//
+// The CPU topology is read from the Linux sysfs tree:
+//
+//   <root>/devices/system/cpu/online
+//   <root>/devices/system/cpu/cpuN/topology/physical_package_id
+//   <root>/devices/system/cpu/cpuN/topology/core_id
+//   <root>/devices/system/cpu/cpuN/cache/indexM/{level,type,shared_cpu_list}
+//   <root>/devices/system/node/nodeN/cpulist
+//
+// The root is "/sys" for the system topology but might be set to a canned
+// tree for tests.
+// Missing files are not an error. Virtual machines and containers often lack
+// some of them. In this case every CPU is taken for a separate core of a
+// single package and a single NUMA node.
+//
+// The default constructor reads "/sys" and takes only the CPUs the process
+// is allowed to run on. So a limit set by taskset or by a container cpuset
+// cgroup is honored.
+//
+// All the entities are numbered densely from zero in the order of their
+// sysfs identifiers. So cpu_info::package is an index into packages() rather
+// than the physical_package_id value, and so on.
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "thread.h"
+
+namespace evenk {
+
+class cpu_topology
+{
+public:
+	using cpuset_type = thread::cpuset_type;
+
+	static constexpr std::size_t npos = std::size_t(-1);
+
+	struct cpu_info
+	{
+		std::size_t id;	     // the OS CPU number
+		std::size_t package; // index into packages()
+		std::size_t node;    // index into nodes()
+		std::size_t core;    // index into cores()
+		std::size_t thread;  // SMT thread index within the core
+		std::size_t l2;	     // index into l2_domains() or npos
+		std::size_t l3;	     // index into l3_domains() or npos
+	};
+
+	// The system topology limited to the CPUs the process is allowed to
+	// run on.
+	cpu_topology() : cpu_topology("/sys", cpuset_type::process_affinity())
+	{
+	}
+
+	// The topology of all the online CPUs found in the given sysfs tree.
+	explicit cpu_topology(const std::string &root) : cpu_topology(root, cpuset_type())
+	{
+	}
+
+	// The topology of the online CPUs that are also in the allowed set.
+	// An empty allowed set means no limit.
+	cpu_topology(const std::string &root, const cpuset_type &allowed)
+	{
+		std::string cpu_dir = root + "/devices/system/cpu/";
+		std::string node_dir = root + "/devices/system/node/";
+
+		std::string list;
+		cpuset_type online;
+		if (read_line(cpu_dir + "online", list))
+			online = cpuset_type::parse(list);
+		else
+			online = cpuset_type::process_affinity();
+		if (allowed.any())
+			online &= allowed;
+		online.trim();
+		if (online.none())
+			throw std::runtime_error("cpu_topology: no online CPUs");
+		limit_ = online.size();
+
+		// Collect the raw identifiers.
+		struct raw_info
+		{
+			long package;
+			long core;
+			cpuset_type l2, l3;
+		};
+		std::vector<std::size_t> ids(online.begin(), online.end());
+		std::vector<raw_info> raw;
+		for (std::size_t id : ids) {
+			std::string base = cpu_dir + "cpu" + std::to_string(id) + "/";
+			raw_info info;
+			info.package = read_number(base + "topology/physical_package_id", 0);
+			info.core = read_number(base + "topology/core_id", long(id));
+			for (unsigned index = 0;; index++) {
+				std::string cache = base + "cache/index";
+				cache += std::to_string(index) + "/";
+				long level = read_number(cache + "level", -1);
+				if (level < 0)
+					break;
+				std::string type;
+				read_line(cache + "type", type);
+				if (type == "Instruction")
+					continue;
+				if (!read_line(cache + "shared_cpu_list", list))
+					continue;
+				if (level == 2)
+					info.l2 = cpuset_type::parse(list);
+				else if (level == 3)
+					info.l3 = cpuset_type::parse(list);
+			}
+			raw.push_back(std::move(info));
+		}
+
+		// Number packages and cores densely. A core_id is only unique
+		// within its package.
+		std::map<long, std::size_t> package_index;
+		std::map<std::pair<long, long>, std::size_t> core_index;
+		for (const raw_info &info : raw) {
+			package_index.emplace(info.package, 0);
+			core_index.emplace(std::make_pair(info.package, info.core), 0);
+		}
+		std::size_t count = 0;
+		for (auto &entry : package_index)
+			entry.second = count++;
+		count = 0;
+		for (auto &entry : core_index)
+			entry.second = count++;
+		packages_.assign(package_index.size(), empty_set());
+		cores_.assign(core_index.size(), empty_set());
+
+		for (std::size_t i = 0; i < ids.size(); i++) {
+			cpu_info info;
+			info.id = ids[i];
+			info.package = package_index[raw[i].package];
+			info.core = core_index[std::make_pair(raw[i].package, raw[i].core)];
+			info.thread = 0;
+			for (std::size_t id = 0; id < info.id; id++)
+				if (cores_[info.core][id])
+					info.thread++;
+			info.node = 0;
+			info.l2 = add_domain(l2_domains_, online, raw[i].l2);
+			info.l3 = add_domain(l3_domains_, online, raw[i].l3);
+			packages_[info.package][info.id] = true;
+			cores_[info.core][info.id] = true;
+			cpus_.push_back(info);
+		}
+
+		// Look for NUMA nodes. The node numbers might have gaps.
+		for (std::size_t node : possible_nodes(root)) {
+			std::string name = "node" + std::to_string(node);
+			if (!read_line(node_dir + name + "/cpulist", list))
+				continue;
+			cpuset_type set = empty_set();
+			for (std::size_t id : cpuset_type::parse(list)) {
+				cpu_info *info = find(id);
+				if (info == nullptr)
+					continue;
+				info->node = nodes_.size();
+				set[id] = true;
+			}
+			nodes_.push_back(std::move(set));
+		}
+		if (nodes_.empty()) {
+			nodes_.push_back(empty_set());
+			for (const cpu_info &info : cpus_)
+				nodes_[0][info.id] = true;
+		}
+	}
+
+	// The OS numbers of the NUMA nodes that might ever be used. This is
+	// empty if the system does not tell.
+	static cpuset_type possible_nodes(const std::string &root = "/sys")
+	{
+		std::string list;
+		if (!read_line(root + "/devices/system/node/possible", list))
+			return cpuset_type();
+		cpuset_type nodes = cpuset_type::parse(list);
+		nodes.trim();
+		return nodes;
+	}
+
+	// The CPU set size needed to cover all the CPUs.
+	std::size_t cpuset_size() const noexcept
+	{
+		return limit_;
+	}
+
+	// The CPUs ordered by their number.
+	const std::vector<cpu_info> &cpus() const noexcept
+	{
+		return cpus_;
+	}
+
+	const std::vector<cpuset_type> &packages() const noexcept
+	{
+		return packages_;
+	}
+
+	const std::vector<cpuset_type> &nodes() const noexcept
+	{
+		return nodes_;
+	}
+
+	const std::vector<cpuset_type> &cores() const noexcept
+	{
+		return cores_;
+	}
+
+	const std::vector<cpuset_type> &l2_domains() const noexcept
+	{
+		return l2_domains_;
+	}
+
+	const std::vector<cpuset_type> &l3_domains() const noexcept
+	{
+		return l3_domains_;
+	}
+
+	const cpu_info &cpu(std::size_t id) const
+	{
+		const cpu_info *info = const_cast<cpu_topology *>(this)->find(id);
+		if (info == nullptr)
+			throw std::out_of_range("cpu_topology: no such CPU");
+		return *info;
+	}
+
+	// The SMT siblings of the given CPU including the CPU itself.
+	const cpuset_type &siblings(std::size_t id) const
+	{
+		return cores_[cpu(id).core];
+	}
+
+private:
+	std::size_t limit_ = 0;
+	std::vector<cpu_info> cpus_;
+	std::vector<cpuset_type> packages_;
+	std::vector<cpuset_type> nodes_;
+	std::vector<cpuset_type> cores_;
+	std::vector<cpuset_type> l2_domains_;
+	std::vector<cpuset_type> l3_domains_;
+
+	cpuset_type empty_set() const
+	{
+		return cpuset_type(limit_, false);
+	}
+
+	cpu_info *find(std::size_t id) noexcept
+	{
+		auto less = [](const cpu_info &info, std::size_t id) { return info.id < id; };
+		auto it = std::lower_bound(cpus_.begin(), cpus_.end(), id, less);
+		if (it == cpus_.end() || it->id != id)
+			return nullptr;
+		return &*it;
+	}
+
+	// Register a cache domain given by its shared CPU set. The set might
+	// include offline or disallowed CPUs, these are dropped.
+	std::size_t add_domain(std::vector<cpuset_type> &domains,
+			       const cpuset_type &online,
+			       cpuset_type set)
+	{
+		if (set.none())
+			return npos;
+		set &= online;
+		set.resize(limit_);
+		for (std::size_t i = 0; i < domains.size(); i++)
+			if (domains[i] == set)
+				return i;
+		domains.push_back(std::move(set));
+		return domains.size() - 1;
+	}
+
+	static bool read_line(const std::string &path, std::string &line)
+	{
+		std::ifstream file(path);
+		if (!file || !std::getline(file, line))
+			return false;
+		while (!line.empty() && (line.back() == ' ' || line.back() == '\r'))
+			line.pop_back();
+		return true;
+	}
+
+	static long read_number(const std::string &path, long fallback)
+	{
+		std::string line;
+		if (!read_line(path, line))
+			return fallback;
+		try {
+			return std::stol(line);
+		} catch (std::logic_error &) {
+			return fallback;
+		}
+	}
+};
+
+//
+// Thread placement. A placement maps the workers of a pool to CPUs and
+// returns a cpuset with a single CPU for every worker. If there are more
+// workers than CPUs the mapping wraps around.
+//
+//   compact - fill SMT siblings of a core, then cores of a package, then
+//             the next package; workers share caches as much as possible.
+//   scatter - spread across packages first, then across cores, and use
+//             SMT siblings last; workers get most of the memory bandwidth.
+//   one_per_core - like compact but only one SMT thread of each core is
+//             used.
+//
+
+enum class placement_policy { compact, scatter, one_per_core };
+
+class cpu_placement
+{
+public:
+	using cpuset_type = cpu_topology::cpuset_type;
+
+	explicit cpu_placement(placement_policy policy) : cpu_placement(policy, cpu_topology())
+	{
+	}
+
+	cpu_placement(placement_policy policy, const cpu_topology &topology)
+		: size_(topology.cpuset_size())
+	{
+		std::vector<cpu_topology::cpu_info> cpus = topology.cpus();
+		if (policy == placement_policy::scatter) {
+			// Rank cores within their packages.
+			std::vector<std::size_t> rank(topology.cores().size(), 0);
+			std::vector<std::size_t> count(topology.packages().size(), 0);
+			for (const auto &info : cpus)
+				if (info.thread == 0)
+					rank[info.core] = count[info.package]++;
+
+			auto less = [&rank](const auto &a, const auto &b) {
+				if (a.thread != b.thread)
+					return a.thread < b.thread;
+				if (rank[a.core] != rank[b.core])
+					return rank[a.core] < rank[b.core];
+				return a.package < b.package;
+			};
+			std::stable_sort(cpus.begin(), cpus.end(), less);
+		} else {
+			if (policy == placement_policy::one_per_core) {
+				auto smt = [](const auto &info) { return info.thread != 0; };
+				cpus.erase(std::remove_if(cpus.begin(), cpus.end(), smt),
+					   cpus.end());
+			}
+			auto less = [](const auto &a, const auto &b) {
+				if (a.core != b.core)
+					return a.core < b.core;
+				return a.thread < b.thread;
+			};
+			std::stable_sort(cpus.begin(), cpus.end(), less);
+		}
+		for (const auto &info : cpus)
+			order_.push_back(info.id);
+	}
+
+	// The CPUs in the order they are assigned to workers.
+	const std::vector<std::size_t> &order() const noexcept
+	{
+		return order_;
+	}
+
+	cpuset_type operator()(std::size_t index) const
+	{
+		cpuset_type cpuset(size_, false);
+		cpuset[order_[index % order_.size()]] = true;
+		return cpuset;
+	}
+
+private:
+	std::size_t size_;
+	std::vector<std::size_t> order_;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_TOPOLOGY_H_
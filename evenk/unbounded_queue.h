@@ -0,0 +1,695 @@
+//
+// Unbounded Concurrent Queue
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_UNBOUNDED_QUEUE_H_
+#define EVENK_UNBOUNDED_QUEUE_H_
+
+//
+// The queue is a linked list of array segments in the spirit of LCRQ:
+//    A. Morrison, Y. Afek. Fast Concurrent Queues for x86 Processors.
+//    PPoPP 2013.
+// and the FAA array queue by P. Ramalhete and A. Correia.
+//
+// Producers and consumers take tickets in the tail and head segment with a
+// single fetch_add just like bounded_queue::ring does. A ticket selects a
+// cell in the segment. If a consumer gets to a cell before the producer it
+// poisons the cell and the producer has to take another ticket. When the
+// tail segment runs out of cells a producer appends a new one.
+//
+// Segments are protected with hazard pointers and the drained ones are
+// recycled through a small pool so in the steady state the queue does not
+// allocate memory.
+//
+// When the queue is closed the tickets of the tail segment get the closed
+// bit set and the segment gets a closed link so producers can neither take
+// a ticket in it nor append a new segment.
+//
+// Blocked consumers sleep on an eventcount so producers make a futex syscall
+// only when there actually is a sleeping consumer.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+#include "backoff.h"
+#include "basic.h"
+#include "conqueue.h"
+#include "futex.h"
+#include "synch.h"
+
+namespace evenk {
+
+namespace detail {
+
+//
+// A minimal hazard pointer domain with a single hazard pointer per thread.
+// That is enough for the queue operations as each of them works with one
+// segment at a time.
+//
+
+struct alignas(cache_line_size) hazard_record
+{
+	std::atomic<const void *> pointer = ATOMIC_VAR_INIT(nullptr);
+	std::atomic<bool> active = ATOMIC_VAR_INIT(false);
+	hazard_record *next = nullptr;
+
+	void clear() noexcept
+	{
+		pointer.store(nullptr, std::memory_order_release);
+	}
+
+	template <typename T>
+	T *protect(const std::atomic<T *> &source) noexcept
+	{
+		T *p = source.load(std::memory_order_relaxed);
+		for (;;) {
+			pointer.store(p, std::memory_order_seq_cst);
+			T *q = source.load(std::memory_order_seq_cst);
+			if (q == p)
+				return p;
+			p = q;
+		}
+	}
+};
+
+class hazard_domain
+{
+public:
+	// Get the hazard record of the current thread.
+	static hazard_record &local()
+	{
+		static thread_local holder h;
+		return *h.record;
+	}
+
+	static bool is_protected(const void *p) noexcept
+	{
+		hazard_record *r = records().load(std::memory_order_acquire);
+		for (; r != nullptr; r = r->next) {
+			if (r->pointer.load(std::memory_order_seq_cst) == p)
+				return true;
+		}
+		return false;
+	}
+
+private:
+	// Records are never freed, they are reused by new threads instead.
+	struct holder
+	{
+		hazard_record *record;
+
+		holder() : record(acquire())
+		{
+		}
+
+		~holder()
+		{
+			record->clear();
+			record->active.store(false, std::memory_order_release);
+		}
+	};
+
+	static std::atomic<hazard_record *> &records() noexcept
+	{
+		static std::atomic<hazard_record *> head = ATOMIC_VAR_INIT(nullptr);
+		return head;
+	}
+
+	static hazard_record *acquire()
+	{
+		hazard_record *r = records().load(std::memory_order_acquire);
+		for (; r != nullptr; r = r->next) {
+			bool active = false;
+			if (!r->active.load(std::memory_order_relaxed)
+			    && r->active.compare_exchange_strong(active, true))
+				return r;
+		}
+
+		void *memory = cache_aligned_alloc(sizeof(hazard_record));
+		if (memory == nullptr)
+			throw std::bad_alloc();
+		r = new (memory) hazard_record;
+		r->active.store(true, std::memory_order_relaxed);
+		hazard_record *head = records().load(std::memory_order_relaxed);
+		do
+			r->next = head;
+		while (!records().compare_exchange_weak(
+			head, r, std::memory_order_release, std::memory_order_relaxed));
+		return r;
+	}
+};
+
+} // namespace detail
+
+template <typename Value, std::size_t SegmentSize = 1024>
+class unbounded_queue : non_copyable
+{
+public:
+	using value_type = Value;
+	using reference = value_type &;
+	using const_reference = const value_type &;
+
+	static_assert(std::is_nothrow_destructible<value_type>::value,
+		      "value_type must be nothrow-destructible");
+	static_assert(SegmentSize >= 2 && SegmentSize < (1u << 31),
+		      "unbounded_queue segment size is out of range");
+
+	unbounded_queue()
+	{
+		segment *s = allocate();
+		head_.store(s, std::memory_order_relaxed);
+		tail_.store(s, std::memory_order_relaxed);
+	}
+
+	~unbounded_queue()
+	{
+		segment *s = head_.load(std::memory_order_relaxed);
+		while (s != nullptr && s != closed_link()) {
+			segment *next = s->next.load(std::memory_order_relaxed);
+			s->clear();
+			destroy(s);
+			s = next;
+		}
+
+		s = retired_.load(std::memory_order_relaxed);
+		while (s != nullptr) {
+			segment *next = s->free_next;
+			destroy(s);
+			s = next;
+		}
+
+		for (auto &slot : pool_) {
+			s = slot.load(std::memory_order_relaxed);
+			if (s != nullptr)
+				destroy(s);
+		}
+	}
+
+	//
+	// State operations
+	//
+
+	void close() noexcept
+	{
+		closed_.store(true, std::memory_order_relaxed);
+
+		detail::hazard_record &hp = detail::hazard_domain::local();
+		segment *s = hp.protect(tail_);
+		for (;;) {
+			s->enq.fetch_or(closed_bit, std::memory_order_acq_rel);
+
+			segment *next = nullptr;
+			if (link(s, next, closed_link()))
+				break;
+			if (next == closed_link())
+				break;
+
+			tail_.compare_exchange_strong(s, next, std::memory_order_acq_rel);
+			s = hp.protect(tail_);
+		}
+		hp.clear();
+
+		event_.notify_all();
+	}
+
+	bool is_closed() const noexcept
+	{
+		return closed_.load(std::memory_order_relaxed);
+	}
+
+	bool is_empty() const noexcept
+	{
+		detail::hazard_record &hp = detail::hazard_domain::local();
+		segment *s = hp.protect(head_);
+		count_t d = s->deq.load(std::memory_order_acquire);
+		count_t e = s->enq.load(std::memory_order_acquire) & ~closed_bit;
+		e = std::min<count_t>(e, SegmentSize);
+		bool empty = d >= e;
+		if (empty && e == SegmentSize) {
+			segment *next = s->next.load(std::memory_order_acquire);
+			empty = next == nullptr || next == closed_link();
+		}
+		hp.clear();
+		return empty;
+	}
+
+	static bool is_lock_free() noexcept
+	{
+		return true;
+	}
+
+	//
+	// Basic operations
+	//
+
+	template <typename... Backoff>
+	void push(const value_type &value, Backoff &&...)
+	{
+		auto status = enqueue(value);
+		if (status != queue_op_status::success)
+			throw status;
+	}
+
+	template <typename... Backoff>
+	void push(value_type &&value, Backoff &&...)
+	{
+		auto status = enqueue(std::move(value));
+		if (status != queue_op_status::success)
+			throw status;
+	}
+
+	template <typename... Backoff>
+	value_type value_pop(Backoff &&... backoff)
+	{
+		value_type value;
+		auto status = wait_pop(value, std::forward<Backoff>(backoff)...);
+		if (status != queue_op_status::success)
+			throw status;
+		return std::move(value);
+	}
+
+	//
+	// Waiting operations
+	//
+
+	// The queue is never full so producers never wait.
+	template <typename... Backoff>
+	queue_op_status wait_push(const value_type &value, Backoff &&...)
+	{
+		return enqueue(value);
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_push(value_type &&value, Backoff &&...)
+	{
+		return enqueue(std::move(value));
+	}
+
+	template <typename... Backoff>
+	queue_op_status wait_pop(value_type &value, Backoff &&... backoff)
+	{
+		bool waiting = false;
+		for (;;) {
+			auto status = dequeue(value);
+			if (status != queue_op_status::empty)
+				return status;
+
+			if (!waiting) {
+				waiting = pause(backoff...);
+				continue;
+			}
+
+			auto key = event_.prepare_wait();
+			status = dequeue(value);
+			if (status != queue_op_status::empty) {
+				event_.cancel_wait();
+				return status;
+			}
+			event_.commit_wait(key);
+		}
+	}
+
+	//
+	// Timed waiting operations
+	//
+
+	template <typename Duration, typename Backoff = no_backoff>
+	queue_op_status
+	wait_pop_until(value_type &value,
+		       const steady_time_point<Duration> &abs_time,
+		       Backoff backoff = Backoff{})
+	{
+		bool waiting = false;
+		for (;;) {
+			auto status = dequeue(value);
+			if (status != queue_op_status::empty)
+				return status;
+			if (std::chrono::steady_clock::now() >= abs_time)
+				return queue_op_status::timeout;
+
+			if (!waiting) {
+				waiting = backoff();
+				continue;
+			}
+
+			auto key = event_.prepare_wait();
+			status = dequeue(value);
+			if (status != queue_op_status::empty) {
+				event_.cancel_wait();
+				return status;
+			}
+			event_.commit_wait_until(key, abs_time);
+		}
+	}
+
+	template <typename Rep, typename Period, typename Backoff = no_backoff>
+	queue_op_status wait_pop_for(value_type &value,
+				     const std::chrono::duration<Rep, Period> &rel_time,
+				     Backoff backoff = Backoff{})
+	{
+		auto abs_time = std::chrono::steady_clock::now() + rel_time;
+		return wait_pop_until(value, abs_time, backoff);
+	}
+
+	//
+	// Non-waiting operations
+	//
+
+	queue_op_status try_push(const value_type &value)
+	{
+		return enqueue(value);
+	}
+
+	queue_op_status try_push(value_type &&value)
+	{
+		return enqueue(std::move(value));
+	}
+
+	queue_op_status try_pop(value_type &value)
+	{
+		return dequeue(value);
+	}
+
+private:
+	using count_t = std::uint32_t;
+
+	static constexpr count_t closed_bit = count_t(1) << 31;
+
+	// The number of recycled segments kept for reuse.
+	static constexpr std::size_t pool_size = 8;
+
+	enum cell_state : std::uint32_t
+	{
+		cell_empty = 0,
+		cell_busy = 1,
+		cell_ready = 2,
+		cell_poisoned = 3,
+	};
+
+	using storage_type =
+		typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type;
+
+	struct cell
+	{
+		std::atomic<std::uint32_t> state;
+		storage_type storage;
+
+		value_type *value() noexcept
+		{
+			return reinterpret_cast<value_type *>(&storage);
+		}
+	};
+
+	struct segment
+	{
+		alignas(cache_line_size) std::atomic<count_t> enq;
+		alignas(cache_line_size) std::atomic<count_t> deq;
+		alignas(cache_line_size) std::atomic<segment *> next;
+
+		// The link for the retired list.
+		segment *free_next;
+
+		cell cells[SegmentSize];
+
+		void reset() noexcept
+		{
+			enq.store(0, std::memory_order_relaxed);
+			deq.store(0, std::memory_order_relaxed);
+			next.store(nullptr, std::memory_order_relaxed);
+			for (auto &c : cells)
+				c.state.store(cell_empty, std::memory_order_relaxed);
+		}
+
+		// Destroy the values that have not been consumed.
+		void clear() noexcept
+		{
+			for (auto &c : cells) {
+				if (c.state.load(std::memory_order_relaxed) == cell_ready) {
+					c.value()->~value_type();
+					c.state.store(cell_poisoned, std::memory_order_relaxed);
+				}
+			}
+		}
+	};
+
+	// The link that marks the last segment of a closed queue.
+	static segment *closed_link() noexcept
+	{
+		return reinterpret_cast<segment *>(alignof(segment));
+	}
+
+	static void destroy(segment *s) noexcept
+	{
+		s->~segment();
+		std::free(s);
+	}
+
+	segment *allocate()
+	{
+		for (auto &slot : pool_) {
+			if (slot.load(std::memory_order_relaxed) == nullptr)
+				continue;
+			segment *s = slot.exchange(nullptr, std::memory_order_acquire);
+			if (s != nullptr)
+				return s;
+		}
+
+		void *memory = cache_aligned_alloc(sizeof(segment));
+		if (memory == nullptr)
+			throw std::bad_alloc();
+		segment *s = new (memory) segment;
+		s->reset();
+		return s;
+	}
+
+	// Put a reset segment to the pool or free it if the pool is full.
+	void recycle(segment *s) noexcept
+	{
+		for (auto &slot : pool_) {
+			segment *empty = nullptr;
+			if (slot.compare_exchange_strong(empty,
+							 s,
+							 std::memory_order_release,
+							 std::memory_order_relaxed))
+				return;
+		}
+		destroy(s);
+	}
+
+	void retire(segment *s) noexcept
+	{
+		push_retired(s);
+
+		// Take the whole retired list and recycle the segments that
+		// are not used by anybody else. Put back the rest.
+		segment *list = retired_.exchange(nullptr, std::memory_order_acquire);
+		while (list != nullptr) {
+			s = list;
+			list = s->free_next;
+			if (detail::hazard_domain::is_protected(s)) {
+				push_retired(s);
+			} else {
+				s->reset();
+				recycle(s);
+			}
+		}
+	}
+
+	void push_retired(segment *s) noexcept
+	{
+		segment *head = retired_.load(std::memory_order_relaxed);
+		do
+			s->free_next = head;
+		while (!retired_.compare_exchange_weak(
+			head, s, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	static bool link(segment *s, segment *&next, segment *n) noexcept
+	{
+		return s->next.compare_exchange_strong(
+			next, n, std::memory_order_acq_rel, std::memory_order_acquire);
+	}
+
+	static bool pause() noexcept
+	{
+		return true;
+	}
+
+	template <typename Backoff>
+	static bool pause(Backoff &backoff)
+	{
+		return backoff();
+	}
+
+	template <typename V>
+	queue_op_status enqueue(V &&value)
+	{
+		detail::hazard_record &hp = detail::hazard_domain::local();
+		for (;;) {
+			segment *s = hp.protect(tail_);
+			count_t t = s->enq.fetch_add(1, std::memory_order_acq_rel);
+			if ((t & closed_bit) != 0) {
+				hp.clear();
+				return queue_op_status::closed;
+			}
+
+			if (t < SegmentSize) {
+				cell &c = s->cells[t];
+				std::uint32_t state = cell_empty;
+				if (!c.state.compare_exchange_strong(state,
+								     cell_busy,
+								     std::memory_order_acquire,
+								     std::memory_order_relaxed))
+					continue; // Poisoned by a consumer.
+
+				try {
+					new (c.value()) value_type(std::forward<V>(value));
+				} catch (...) {
+					c.state.store(cell_poisoned, std::memory_order_release);
+					hp.clear();
+					throw;
+				}
+				c.state.store(cell_ready, std::memory_order_release);
+				hp.clear();
+
+				event_.notify_one();
+				return queue_op_status::success;
+			}
+
+			// The segment is full, move on to the next one.
+			segment *next = s->next.load(std::memory_order_acquire);
+			if (next == nullptr) {
+				segment *n = allocate();
+				if (link(s, next, n)) {
+					tail_.compare_exchange_strong(s, n);
+					continue;
+				}
+				recycle(n);
+			}
+			if (next == closed_link()) {
+				hp.clear();
+				return queue_op_status::closed;
+			}
+			tail_.compare_exchange_strong(s, next, std::memory_order_acq_rel);
+		}
+	}
+
+	queue_op_status dequeue(value_type &value)
+	{
+		detail::hazard_record &hp = detail::hazard_domain::local();
+		for (;;) {
+			segment *s = hp.protect(head_);
+			count_t d = s->deq.load(std::memory_order_acquire);
+			count_t e = s->enq.load(std::memory_order_acquire);
+			bool closed = (e & closed_bit) != 0;
+			e = std::min<count_t>(e & ~closed_bit, SegmentSize);
+
+			if (d >= e) {
+				if (e < SegmentSize) {
+					hp.clear();
+					if (closed)
+						return queue_op_status::closed;
+					return queue_op_status::empty;
+				}
+
+				// The segment is drained, move on to the next one.
+				segment *next = s->next.load(std::memory_order_acquire);
+				if (next == nullptr) {
+					hp.clear();
+					return queue_op_status::empty;
+				}
+				if (next == closed_link()) {
+					hp.clear();
+					return queue_op_status::closed;
+				}
+
+				// The hazard pointer check in retire() requires the
+				// segment to be unlinked with seq_cst operations.
+				segment *expected = s;
+				if (head_.compare_exchange_strong(expected, next)) {
+					// Make sure that the tail does not lag behind.
+					tail_.compare_exchange_strong(expected, next);
+					hp.clear();
+					retire(s);
+				}
+				continue;
+			}
+
+			count_t i = s->deq.fetch_add(1, std::memory_order_acq_rel);
+			if (i >= SegmentSize)
+				continue;
+
+			cell &c = s->cells[i];
+			std::uint32_t state = c.state.load(std::memory_order_acquire);
+			if (state == cell_empty) {
+				// Do not let the producer use the cell that is
+				// already skipped by consumers.
+				if (c.state.compare_exchange_strong(state,
+								    cell_poisoned,
+								    std::memory_order_acquire,
+								    std::memory_order_acquire))
+					continue;
+			}
+			while (state == cell_busy) {
+				std::this_thread::yield();
+				state = c.state.load(std::memory_order_acquire);
+			}
+			if (state == cell_poisoned)
+				continue;
+
+			value_type *p = c.value();
+			try {
+				value = std::move(*p);
+			} catch (...) {
+				p->~value_type();
+				c.state.store(cell_poisoned, std::memory_order_relaxed);
+				hp.clear();
+				throw;
+			}
+			p->~value_type();
+			c.state.store(cell_poisoned, std::memory_order_relaxed);
+			hp.clear();
+			return queue_op_status::success;
+		}
+	}
+
+	alignas(cache_line_size) std::atomic<segment *> head_ = ATOMIC_VAR_INIT(nullptr);
+	alignas(cache_line_size) std::atomic<segment *> tail_ = ATOMIC_VAR_INIT(nullptr);
+
+	alignas(cache_line_size) std::atomic<segment *> retired_ = ATOMIC_VAR_INIT(nullptr);
+	std::atomic<segment *> pool_[pool_size] = {};
+	std::atomic<bool> closed_ = ATOMIC_VAR_INIT(false);
+
+	eventcount event_;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_UNBOUNDED_QUEUE_H_
@@ -0,0 +1,341 @@
+//
+// Work-Stealing Deque
+//
+// Copyright (c) 2019  Aleksey Demakov
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+#ifndef EVENK_WS_DEQUE_H_
+#define EVENK_WS_DEQUE_H_
+
+//
+// The deque is based on the following papers:
+//    David Chase, Yossi Lev. Dynamic Circular Work-Stealing Deque.
+//    Nhat Minh Le et al. Correct and Efficient Work-Stealing for Weak
+//    Memory Models.
+//
+// A deque has a single owner thread that pushes and pops values at the
+// bottom end. Any other thread may steal values at the top end.
+//
+// The original algorithm copies values speculatively and so works only for
+// trivially-copyable types. Here values are moved and so may be anything
+// that is noexcept-movable, tasks in particular. To make this possible each
+// cell has a state word that tells which value index it holds and whether
+// the value is there. A thief moves a value out only after it wins the top
+// index and then the cell. The owner never reuses a cell until its previous
+// value is gone. If the cell to push to is still occupied the array grows.
+//
+// When the array grows the owner moves the remaining values to the new one.
+// A thief that comes to a moved cell follows the link to the new array. If
+// the owner is in the middle of moving that very value the thief has to wait
+// for it a bit. This is the only case when a thief waits for the owner.
+//
+// Old arrays might still be in use by thieves so they are not freed until
+// the deque itself is destroyed. As arrays grow twice each time they take
+// less memory than the current one altogether.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "basic.h"
+#include "conqueue.h"
+
+namespace evenk {
+
+template <typename Value>
+class ws_deque : non_copyable
+{
+public:
+	using value_type = Value;
+
+	static_assert(std::is_nothrow_move_constructible<value_type>::value,
+		      "a ws_deque value is not noexcept-movable");
+
+	explicit ws_deque(std::size_t size = 64) : array_{create(size, 0)}
+	{
+	}
+
+	~ws_deque() noexcept
+	{
+		array *a = array_.load(std::memory_order_relaxed);
+		std::int64_t t = top_.load(std::memory_order_relaxed);
+		std::int64_t b = bottom_.load(std::memory_order_relaxed);
+		for (std::int64_t i = t; i < b; i++)
+			a->at(i).value()->~value_type();
+		while (a != nullptr) {
+			array *prev = a->prev;
+			destroy(a);
+			a = prev;
+		}
+	}
+
+	//
+	// State operations
+	//
+
+	bool is_empty() const noexcept
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed);
+		std::int64_t t = top_.load(std::memory_order_relaxed);
+		return b <= t;
+	}
+
+	// An estimate of the number of values in the deque.
+	std::size_t size() const noexcept
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed);
+		std::int64_t t = top_.load(std::memory_order_relaxed);
+		return b > t ? std::size_t(b - t) : 0;
+	}
+
+	static bool is_lock_free() noexcept
+	{
+		return true;
+	}
+
+	//
+	// Owner operations
+	//
+
+	void push(const value_type &value)
+	{
+		emplace(value);
+	}
+
+	void push(value_type &&value)
+	{
+		emplace(std::move(value));
+	}
+
+	template <typename... Args>
+	void emplace(Args &&... args)
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed);
+		array *a = array_.load(std::memory_order_relaxed);
+		if (a->at(b).state.load(std::memory_order_acquire) != make_state(b, free_tag))
+			a = grow(a, b);
+
+		cell &c = a->at(b);
+		new (&c.storage) value_type(std::forward<Args>(args)...);
+		c.state.store(make_state(b, full_tag), std::memory_order_relaxed);
+		bottom_.store(b + 1, std::memory_order_release);
+	}
+
+	queue_op_status try_pop(value_type &value) noexcept
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		array *a = array_.load(std::memory_order_relaxed);
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t t = top_.load(std::memory_order_relaxed);
+		if (t > b) {
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return queue_op_status::empty;
+		}
+
+		cell &c = a->at(b);
+		if (t < b) {
+			take(c, value);
+			c.state.store(make_state(b, free_tag), std::memory_order_relaxed);
+			return queue_op_status::success;
+		}
+
+		// This is the last value, race against thieves for it.
+		bool won = top_.compare_exchange_strong(
+			t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom_.store(b + 1, std::memory_order_relaxed);
+		if (!won)
+			return queue_op_status::empty;
+
+		take(c, value);
+		c.state.store(make_state(b + a->size, free_tag), std::memory_order_release);
+		return queue_op_status::success;
+	}
+
+	//
+	// Thief operations
+	//
+
+	// Returns queue_op_status::busy if another thread has just taken the
+	// top value. It makes sense to try again then or to go to another
+	// deque.
+	queue_op_status try_steal(value_type &value) noexcept
+	{
+		std::int64_t t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t b = bottom_.load(std::memory_order_acquire);
+		if (t >= b)
+			return queue_op_status::empty;
+
+		array *a = array_.load(std::memory_order_acquire);
+		if (!top_.compare_exchange_strong(
+			    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return queue_op_status::busy;
+
+		// The value at index t is ours now. Get it out of the cell
+		// unless the owner moves it to a new array at this moment.
+		const std::uint64_t full = make_state(t, full_tag);
+		const std::uint64_t moved = make_state(t, moved_tag);
+		for (;;) {
+			std::uint64_t state = full;
+			if (a->at(t).state.compare_exchange_strong(state,
+								   make_state(t, busy_tag),
+								   std::memory_order_acquire,
+								   std::memory_order_acquire))
+				break;
+			if (state == moved)
+				a = a->next.load(std::memory_order_acquire);
+			else
+				std::this_thread::yield();
+		}
+
+		cell &c = a->at(t);
+		take(c, value);
+		c.state.store(make_state(t + a->size, free_tag), std::memory_order_release);
+		return queue_op_status::success;
+	}
+
+private:
+	// A cell state is a value index combined with one of these tags.
+	static constexpr std::uint64_t free_tag = 0;
+	static constexpr std::uint64_t full_tag = 1;
+	static constexpr std::uint64_t busy_tag = 2;
+	static constexpr std::uint64_t moved_tag = 3;
+
+	static constexpr std::uint64_t
+	make_state(std::int64_t index, std::uint64_t tag) noexcept
+	{
+		return (std::uint64_t(index) << 2) | tag;
+	}
+
+	struct cell
+	{
+		using storage_type = typename std::
+			aligned_storage<sizeof(value_type), alignof(value_type)>::type;
+
+		std::atomic<std::uint64_t> state;
+		storage_type storage;
+
+		value_type *value() noexcept
+		{
+			return reinterpret_cast<value_type *>(&storage);
+		}
+	};
+
+	struct alignas(cache_line_size) array
+	{
+		std::int64_t size;
+		std::int64_t mask;
+		std::atomic<array *> next;
+		array *prev;
+
+		cell &at(std::int64_t index) noexcept
+		{
+			return reinterpret_cast<cell *>(this + 1)[index & mask];
+		}
+	};
+
+	static array *create(std::size_t size, std::int64_t first)
+	{
+		if (size < 2)
+			size = 2;
+		if ((size & (size - 1)) != 0)
+			throw std::invalid_argument("ws_deque size must be a power of two");
+
+		std::size_t bytes = sizeof(array) + size * sizeof(cell);
+		bytes = (bytes + cache_line_size - 1) & ~(cache_line_size - 1);
+		void *memory = cache_aligned_alloc(bytes);
+		if (memory == nullptr)
+			throw std::bad_alloc();
+
+		array *a = new (memory) array;
+		a->size = size;
+		a->mask = size - 1;
+		a->next.store(nullptr, std::memory_order_relaxed);
+		a->prev = nullptr;
+
+		// Every cell is free for the first index that maps to it.
+		for (std::int64_t i = first; i < first + a->size; i++)
+			new (&a->at(i).state)
+				std::atomic<std::uint64_t>(make_state(i, free_tag));
+		return a;
+	}
+
+	static void destroy(array *a) noexcept
+	{
+		a->~array();
+		std::free(a);
+	}
+
+	static void take(cell &c, value_type &value) noexcept
+	{
+		value_type *ptr = c.value();
+		value = std::move(*ptr);
+		ptr->~value_type();
+	}
+
+	array *grow(array *a, std::int64_t b)
+	{
+		std::int64_t t = top_.load(std::memory_order_acquire);
+		array *n = create(2 * a->size, t);
+		n->prev = a;
+		a->next.store(n, std::memory_order_release);
+
+		// Move the values unless thieves have already taken them.
+		for (std::int64_t i = t; i < b; i++) {
+			cell &c = a->at(i);
+			cell &d = n->at(i);
+			std::uint64_t state = make_state(i, full_tag);
+			if (c.state.compare_exchange_strong(state,
+							    make_state(i, moved_tag),
+							    std::memory_order_acq_rel,
+							    std::memory_order_relaxed)) {
+				new (&d.storage) value_type(std::move(*c.value()));
+				c.value()->~value_type();
+				d.state.store(make_state(i, full_tag),
+					      std::memory_order_release);
+			} else {
+				d.state.store(make_state(i + n->size, free_tag),
+					      std::memory_order_relaxed);
+			}
+		}
+
+		array_.store(n, std::memory_order_release);
+		return n;
+	}
+
+	// The owner and thieves.
+	alignas(cache_line_size) std::atomic<std::int64_t> top_ = ATOMIC_VAR_INIT(0);
+
+	// The owner mostly.
+	alignas(cache_line_size) std::atomic<std::int64_t> bottom_ = ATOMIC_VAR_INIT(0);
+	std::atomic<array *> array_;
+};
+
+} // namespace evenk
+
+#endif // !EVENK_WS_DEQUE_H_
@@ -0,0 +1,100 @@
+#include "evenk/bounded_queue.h"
+#include "evenk/thread.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace evenk;
+
+static const int batch_count = 20000;
+static const int batch_size = 7;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+// Every producer pushes batches of increasing values tagged with its number.
+// Every consumer checks that the values of each producer come in order (this
+// holds for any consumer as it pops tickets in order) and sums them up.
+template <typename Queue>
+void
+test_bulk(const std::string &name, int producers, int consumers)
+{
+	Queue queue(64);
+
+	std::vector<evenk::thread> producer_threads;
+	for (int p = 0; p < producers; p++) {
+		producer_threads.emplace_back([&queue, p] {
+			std::vector<long> batch(batch_size);
+			long value = 0;
+			for (int i = 0; i < batch_count; i++) {
+				for (auto &v : batch)
+					v = (++value << 4) | p;
+				queue.wait_push_bulk(batch.begin(), batch.end());
+			}
+		});
+	}
+
+	std::vector<long> sums(consumers);
+	std::vector<char> ordered(consumers, true);
+	std::vector<evenk::thread> consumer_threads;
+	for (int c = 0; c < consumers; c++) {
+		consumer_threads.emplace_back([&queue, &sums, &ordered, producers, c] {
+			std::vector<long> last(producers);
+			std::vector<long> batch(batch_size * 2);
+			for (;;) {
+				auto n = queue.wait_pop_bulk(batch.begin(), batch.size());
+				if (n == 0)
+					break;
+				for (std::size_t i = 0; i < n; i++) {
+					long v = batch[i] >> 4;
+					int p = batch[i] & 15;
+					if (v <= last[p])
+						ordered[c] = false;
+					last[p] = v;
+					sums[c] += v;
+				}
+			}
+		});
+	}
+
+	for (auto &thread : producer_threads)
+		thread.join();
+	queue.close();
+	for (auto &thread : consumer_threads)
+		thread.join();
+
+	long total = 0;
+	bool in_order = true;
+	for (int c = 0; c < consumers; c++) {
+		total += sums[c];
+		in_order = in_order && ordered[c];
+	}
+	const long n = long(batch_count) * batch_size;
+	check(name + " sum", total == producers * (n * (n + 1) / 2));
+	check(name + " order", in_order);
+}
+
+int
+main()
+{
+	test_bulk<bounded_queue::spsc<long, bounded_queue::futex>>("spsc", 1, 1);
+	test_bulk<bounded_queue::spmc<long, bounded_queue::futex>>("spmc", 1, 3);
+	test_bulk<bounded_queue::mpsc<long, bounded_queue::futex>>("mpsc", 3, 1);
+	test_bulk<bounded_queue::mpmc<long, bounded_queue::futex>>("mpmc", 3, 3);
+	test_bulk<bounded_queue::spsc<long, bounded_queue::yield>>("spsc yield", 1, 1);
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include "evenk/cohort_lock.h"
+#include "evenk/synch.h"
+#include "evenk/thread.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <sys/stat.h>
+
+static constexpr std::size_t test_count = 200 * 1000;
+
+static constexpr std::size_t thread_num = 8;
+
+template <typename Lock>
+void
+thread_routine(Lock &lock, std::size_t &counter)
+{
+	for (std::size_t i = 0; i < test_count; i++) {
+		lock.lock(evenk::yield_backoff{});
+		counter++;
+		lock.unlock();
+	}
+}
+
+template <typename Lock>
+bool
+test(const std::string &name, std::size_t node_count)
+{
+	Lock lock(evenk::cpu_node_map::fake(node_count));
+	std::size_t counter = 0;
+
+	evenk::thread thread_array[thread_num];
+	for (std::size_t i = 0; i < thread_num; i++)
+		thread_array[i] = evenk::thread(thread_routine<Lock>, std::ref(lock), std::ref(counter));
+	for (std::size_t i = 0; i < thread_num; i++)
+		thread_array[i].join();
+
+	bool ok = counter == test_count * thread_num;
+	std::cout << name << " with " << node_count << " fake nodes: counter=" << counter
+		  << (ok ? ": ok\n" : ": FAILED\n");
+	return ok;
+}
+
+bool
+test_sysfs()
+{
+	char dir[] = "/tmp/cohort-lock-test-XXXXXX";
+	if (mkdtemp(dir) == nullptr)
+		return false;
+
+	// The node numbers have a gap that the map closes.
+	std::string system_dir = std::string(dir) + "/devices/system";
+	for (const char *sub : {"/devices", "/devices/system", "/devices/system/cpu",
+				"/devices/system/node"})
+		mkdir((std::string(dir) + sub).c_str(), 0700);
+	std::ofstream(system_dir + "/cpu/online") << "0-11\n";
+	std::ofstream(system_dir + "/node/possible") << "0,2\n";
+	const char *lists[] = {"0-3,8\n", "4-7,9-11\n"};
+	for (int node = 0; node < 2; node++) {
+		std::string node_dir = system_dir + "/node/node" + std::to_string(node * 2);
+		mkdir(node_dir.c_str(), 0700);
+		std::ofstream(node_dir + "/cpulist") << lists[node];
+	}
+
+	evenk::cpu_node_map map{evenk::cpu_topology(dir)};
+	bool ok = map.node_count() == 2 && map.cpu_node(3) == 0 && map.cpu_node(8) == 0
+		  && map.cpu_node(4) == 1 && map.cpu_node(11) == 1;
+	std::cout << "canned sysfs topology" << (ok ? ": ok\n" : ": FAILED\n");
+
+	// The same map from the node directory alone.
+	evenk::cpu_node_map dir_map(system_dir + "/node");
+	bool dir_ok = dir_map.node_count() == 2 && dir_map.cpu_node(3) == 0
+		      && dir_map.cpu_node(8) == 0 && dir_map.cpu_node(4) == 1
+		      && dir_map.cpu_node(11) == 1;
+	std::cout << "canned sysfs node directory" << (dir_ok ? ": ok\n" : ": FAILED\n");
+	ok = ok && dir_ok;
+
+	std::system((std::string("rm -rf ") + dir).c_str());
+	return ok;
+}
+
+int
+main()
+{
+	bool ok = test_sysfs();
+
+	ok &= test<evenk::cohort_lock<>>("cohort_lock<ticket_lock, ticket_lock>", 2);
+	ok &= test<evenk::cohort_lock<>>("cohort_lock<ticket_lock, ticket_lock>", 4);
+#if __linux__
+	using futex_cohort_lock = evenk::cohort_lock<evenk::futex_lock, evenk::futex_lock>;
+	ok &= test<futex_cohort_lock>("cohort_lock<futex_lock, futex_lock>", 2);
+	ok &= test<futex_cohort_lock>("cohort_lock<futex_lock, futex_lock>", 4);
+	using mixed_cohort_lock = evenk::cohort_lock<evenk::futex_lock, evenk::ticket_lock>;
+	ok &= test<mixed_cohort_lock>("cohort_lock<futex_lock, ticket_lock>", 4);
+#endif
+
+	std::cout << (ok ? "passed\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
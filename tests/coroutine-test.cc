@@ -0,0 +1,230 @@
+#include "evenk/bounded_queue.h"
+#include "evenk/synch.h"
+#include "evenk/synch_queue.h"
+#include "evenk/thread.h"
+#include "evenk/thread_pool.h"
+#include "evenk/unbounded_queue.h"
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace evenk;
+
+template <typename T>
+using queue = synch_queue<T>;
+
+template <typename T>
+using lock_free_queue = unbounded_queue<T>;
+
+using ring_queue = bounded_queue::mpmc<int, bounded_queue::futex>;
+
+static constexpr int coroutine_count = 1000;
+static constexpr int test_count = 100 * 1000;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+// A coroutine that starts at once and is never waited for.
+struct detached
+{
+	struct promise_type
+	{
+		detached get_return_object() noexcept
+		{
+			return {};
+		}
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+		void return_void() noexcept
+		{
+		}
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+
+void
+wait_for(std::atomic<int> &counter, int value)
+{
+	while (counter.load(std::memory_order_acquire) != value)
+		std::this_thread::yield();
+}
+
+template <typename Pool>
+detached
+schedule_one(Pool &pool,
+	     std::thread::id caller,
+	     std::atomic<int> &moved,
+	     std::atomic<int> &done)
+{
+	co_await pool.schedule();
+	if (std::this_thread::get_id() != caller)
+		moved.fetch_add(1, std::memory_order_relaxed);
+	done.fetch_add(1, std::memory_order_release);
+}
+
+template <typename Pool>
+void
+test_schedule(const std::string &name)
+{
+	Pool pool(4);
+	std::atomic<int> moved(0), done(0);
+	for (int i = 0; i < coroutine_count; i++)
+		schedule_one(pool, std::this_thread::get_id(), moved, done);
+	wait_for(done, coroutine_count);
+	check(name + " schedule", moved.load() == coroutine_count);
+}
+
+template <typename Pool>
+detached
+lock_many(Pool &pool, async_futex_lock &lock, int &counter, std::atomic<int> &done)
+{
+	co_await pool.schedule();
+	for (int i = 0; i < 100; i++) {
+		co_await lock.async_lock();
+		counter++;
+		lock.unlock();
+	}
+	done.fetch_add(1, std::memory_order_release);
+}
+
+detached
+lock_one(async_futex_lock &lock, int &counter, std::atomic<int> &done)
+{
+	co_await lock.async_lock();
+	counter++;
+	lock.unlock();
+	done.fetch_add(1, std::memory_order_release);
+}
+
+void
+test_lock()
+{
+	async_futex_lock lock;
+	int counter = 0;
+	std::atomic<int> done(0);
+
+	// The coroutines park while the lock is held and run one after
+	// another as it is released.
+	lock.lock();
+	for (int i = 0; i < coroutine_count; i++)
+		lock_one(lock, counter, done);
+	check("async_lock parks", done.load() == 0 && counter == 0);
+	lock.unlock();
+	check("async_lock resumes",
+	      done.load() == coroutine_count && counter == coroutine_count);
+
+	// Every coroutine hands the lock over to the next one on unlock. This
+	// must not nest the resumptions on the stack.
+	counter = 0;
+	done.store(0);
+	lock.lock();
+	for (int i = 0; i < test_count; i++)
+		lock_one(lock, counter, done);
+	lock.unlock();
+	check("async_lock long chain", done.load() == test_count && counter == test_count);
+
+	// Coroutines on pool threads compete with plain threads.
+	thread_pool<queue> pool(4);
+	counter = 0;
+	done.store(0);
+	for (int i = 0; i < coroutine_count; i++)
+		lock_many(pool, lock, counter, done);
+	evenk::thread threads[2];
+	for (auto &t : threads) {
+		t = evenk::thread([&lock, &counter] {
+			for (int i = 0; i < test_count; i++) {
+				lock.lock();
+				counter++;
+				lock.unlock();
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	wait_for(done, coroutine_count);
+	lock.lock();
+	check("async_lock concurrent", counter == coroutine_count * 100 + 2 * test_count);
+	lock.unlock();
+}
+
+template <typename Queue>
+detached
+consume(Queue &q, std::atomic<long> &sum, std::atomic<int> &done)
+{
+	long local = 0;
+	try {
+		for (;;)
+			local += co_await q.async_pop();
+	} catch (queue_op_status status) {
+		if (status != queue_op_status::closed)
+			local = -1;
+	}
+	sum.fetch_add(local, std::memory_order_relaxed);
+	done.fetch_add(1, std::memory_order_release);
+}
+
+template <typename Queue>
+void
+test_queue(const std::string &name, Queue &q, int consumer_count)
+{
+	std::atomic<long> sum(0);
+	std::atomic<int> done(0);
+	for (int i = 0; i < consumer_count; i++)
+		consume(q, sum, done);
+	check(name + " async_pop parks", done.load() == 0);
+
+	evenk::thread producers[2];
+	for (auto &t : producers) {
+		t = evenk::thread([&q] {
+			for (int i = 1; i <= test_count; i++)
+				q.push(i);
+		});
+	}
+	for (auto &t : producers)
+		t.join();
+	q.close();
+
+	wait_for(done, consumer_count);
+	check(name + " async_pop", sum.load() == 2 * long(test_count) * (test_count + 1) / 2);
+}
+
+int
+main()
+{
+	test_schedule<thread_pool<queue>>("thread_pool");
+	test_schedule<ws_thread_pool<lock_free_queue>>("ws_thread_pool");
+
+	test_lock();
+
+	synch_queue<int> sq;
+	test_queue("synch_queue", sq, 100);
+	ring_queue rq(1024);
+	test_queue("ring", rq, 10);
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
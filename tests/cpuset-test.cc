@@ -0,0 +1,98 @@
+#include "evenk/cpuset.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using evenk::cpuset;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+void
+test_bits()
+{
+	cpuset set;
+	check("empty", set.size() == 0 && set.none() && set.begin() == set.end());
+
+	// Go well past CPU_SETSIZE.
+	set.set(3);
+	set.set(64);
+	set.set(5000);
+	check("set", set.size() == 5001 && set.count() == 3 && set[64] && !set[63]);
+	check("iterate", std::vector<std::size_t>(set.begin(), set.end())
+				 == std::vector<std::size_t>({3, 64, 5000}));
+
+	set[5000] = false;
+	set.reset(100000);
+	check("reset", set.count() == 2 && !set.test(5000));
+	set.trim();
+	check("trim", set.size() == 65);
+	set.resize(4);
+	check("shrink", set.size() == 4 && set.count() == 1);
+
+	check("fill", cpuset(70, true).count() == 70);
+}
+
+void
+test_ops()
+{
+	cpuset a = cpuset::parse("0-7");
+	cpuset b = cpuset::parse("4-11,2000");
+	check("union", (a | b).to_string() == "0-11,2000");
+	check("intersect", (a & b).to_string() == "4-7" && (b & a) == cpuset({4, 5, 6, 7}));
+	check("difference", (a - b).to_string() == "0-3" && (b - a).to_string() == "8-11,2000");
+
+	cpuset c(4096);
+	c.set(1);
+	check("equal", c == cpuset({1}) && c != cpuset({2}) && cpuset() == cpuset(100));
+}
+
+void
+test_format()
+{
+	check("parse", cpuset::parse("0-3,8,10-15").count() == 11);
+	check("format", cpuset::parse("10-15,0-3,8,3,9").to_string() == "0-3,8-15");
+	check("format single", cpuset({1, 3, 5}).to_string() == "1,3,5");
+	check("format empty", cpuset::parse("").to_string().empty());
+
+	bool thrown = false;
+	try {
+		cpuset::parse("3-1");
+	} catch (std::invalid_argument &) {
+		thrown = true;
+	}
+	check("parse error", thrown);
+}
+
+void
+test_process()
+{
+	cpuset set = cpuset::process_affinity();
+	std::cout << "process affinity: " << set.to_string() << "\n";
+	check("process affinity", set.any());
+}
+
+int
+main()
+{
+	test_bits();
+	test_ops();
+	test_format();
+	test_process();
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -0,0 +1,213 @@
+#include "evenk/bounded_queue.h"
+#include "evenk/fiber.h"
+#include "evenk/synch_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace evenk;
+
+using fiber_ring = bounded_queue::mpmc<int, bounded_queue::synch<fiber_synch>>;
+
+static constexpr int fiber_count = 10000;
+static constexpr int test_count = 100 * 1000;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+void
+test_spawn()
+{
+	std::atomic<int> count(0);
+	std::atomic<int> nested(0);
+	bool outside = this_fiber::is_fiber();
+	{
+		fiber_scheduler scheduler(4);
+		for (int i = 0; i < fiber_count; i++) {
+			scheduler.spawn([&scheduler, &count, &nested, i] {
+				if (this_fiber::is_fiber())
+					count.fetch_add(1, std::memory_order_relaxed);
+				this_fiber::yield();
+				if (i % 100 == 0)
+					scheduler.spawn([&nested] { nested.fetch_add(1); });
+			});
+		}
+		scheduler.join();
+	}
+	check("spawn", !outside && count.load() == fiber_count && nested.load() == 100);
+}
+
+void
+test_exception()
+{
+	bool caught = false;
+	fiber_scheduler scheduler(1);
+	scheduler.spawn([&caught] {
+		try {
+			this_fiber::yield();
+			throw std::runtime_error("test");
+		} catch (std::runtime_error &) {
+			caught = true;
+		}
+	});
+	scheduler.join();
+	check("exception", caught);
+}
+
+void
+test_numa_stacks()
+{
+	numa_policy policy = numa_policy::interleave();
+	std::atomic<int> count(0);
+	{
+		fiber_scheduler scheduler(2, fiber_scheduler::default_stack_size, policy);
+		for (int i = 0; i < 100; i++) {
+			scheduler.spawn([&count] {
+				this_fiber::yield();
+				count.fetch_add(1, std::memory_order_relaxed);
+			});
+		}
+		scheduler.join();
+	}
+	check("numa stacks", count.load() == 100);
+}
+
+void
+test_mutex()
+{
+	fiber_scheduler scheduler(4);
+	fiber_mutex mutex;
+	long counter = 0;
+	for (int i = 0; i < 100; i++) {
+		scheduler.spawn([&mutex, &counter] {
+			for (int j = 0; j < 1000; j++) {
+				lock_guard<fiber_mutex> guard(mutex);
+				counter++;
+				if (j % 10 == 0)
+					this_fiber::yield();
+			}
+		});
+	}
+	scheduler.join();
+	check("mutex", counter == 100 * 1000);
+}
+
+void
+test_timed()
+{
+	fiber_scheduler scheduler(2);
+	fiber_mutex mutex;
+	fiber_cond_var cond;
+	bool timed_out = false, notified = false, slept = false;
+	bool flag = false;
+
+	scheduler.spawn([&] {
+		lock_guard<fiber_mutex> guard(mutex);
+		auto status = cond.wait_for(guard, std::chrono::milliseconds(10));
+		timed_out = status == std::cv_status::timeout;
+	});
+	scheduler.spawn([&] {
+		lock_guard<fiber_mutex> guard(mutex);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (!flag) {
+			if (cond.wait_until(guard, deadline) == std::cv_status::timeout)
+				return;
+		}
+		notified = true;
+	});
+	scheduler.spawn([&] {
+		auto start = std::chrono::steady_clock::now();
+		this_fiber::sleep_for(std::chrono::milliseconds(20));
+		auto time = std::chrono::steady_clock::now() - start;
+		slept = time >= std::chrono::milliseconds(20);
+
+		lock_guard<fiber_mutex> guard(mutex);
+		flag = true;
+		cond.notify_all();
+	});
+	scheduler.join();
+	check("timed wait", timed_out && notified && slept);
+}
+
+template <typename Queue>
+void
+test_queue(const std::string &name, Queue &queue)
+{
+	static constexpr int consumer_count = 10;
+
+	fiber_scheduler scheduler(2);
+	std::atomic<long> sum(0);
+	std::atomic<int> producers(2);
+	for (int i = 0; i < consumer_count; i++) {
+		scheduler.spawn([&queue, &sum] {
+			long local = 0;
+			int value = 0;
+			while (queue.wait_pop(value) == queue_op_status::success)
+				local += value;
+			sum.fetch_add(local);
+		});
+	}
+	for (int i = 0; i < 2; i++) {
+		scheduler.spawn([&queue, &producers] {
+			for (int j = 1; j <= test_count; j++)
+				queue.push(j);
+			if (producers.fetch_sub(1) == 1)
+				queue.close();
+		});
+	}
+	scheduler.join();
+	check(name, sum.load() == 2 * long(test_count) * (test_count + 1) / 2);
+}
+
+void
+bench_switch()
+{
+	static constexpr int count = 1000 * 1000;
+
+	fiber_scheduler scheduler(1);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 2; i++) {
+		scheduler.spawn([] {
+			for (int j = 0; j < count; j++)
+				this_fiber::yield();
+		});
+	}
+	scheduler.join();
+	auto time = std::chrono::steady_clock::now() - start;
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+	std::cout << "yield: " << ns / (2 * count) << " ns\n";
+}
+
+int
+main()
+{
+	test_spawn();
+	test_exception();
+	test_numa_stacks();
+	test_mutex();
+	test_timed();
+
+	synch_queue<int, fiber_synch> sq;
+	test_queue("synch_queue", sq);
+	fiber_ring ring(16);
+	test_queue("ring", ring);
+
+	bench_switch();
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
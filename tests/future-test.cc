@@ -0,0 +1,146 @@
+#include "evenk/synch_queue.h"
+#include "evenk/thread_pool.h"
+#include "evenk/unbounded_queue.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace evenk;
+
+template <typename T>
+using queue = synch_queue<T>;
+
+template <typename T>
+using lock_free_queue = unbounded_queue<T>;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+template <typename Pool>
+void
+test(const std::string &name)
+{
+	Pool pool(4);
+
+	auto f1 = pool.submit_with_result([] { return 42; });
+	check(name + " result", f1.valid() && f1.get() == 42 && !f1.valid());
+
+	// A large result and a large callable.
+	std::string s(1000, 'x');
+	auto f2 = pool.submit_with_result([s] { return s + s; });
+	check(name + " large result", f2.get().size() == 2000);
+
+	auto f3 = pool.submit_with_result([]() -> int { throw std::runtime_error("test"); });
+	bool caught = false;
+	try {
+		f3.get();
+	} catch (std::runtime_error &) {
+		caught = true;
+	}
+	check(name + " exception", caught);
+
+	// A pipeline of continuations.
+	auto f4 = pool.submit_with_result([] { return 1; })
+			  .then([](int x) { return x + 1; })
+			  .then([](int x) { return std::to_string(x * 10); })
+			  .then([](std::string x) { return x + "!"; });
+	check(name + " continuation", f4.get() == "20!");
+
+	// A continuation attached to a ready future.
+	auto f5 = pool.submit_with_result([] {});
+	f5.wait();
+	bool called = false;
+	auto f6 = f5.then([&called] { called = true; return 7; });
+	check(name + " late continuation", f6.get() == 7 && called);
+
+	// An exception skips continuations.
+	int calls = 0;
+	auto f7 = pool.submit_with_result([]() -> int { throw std::runtime_error("test"); })
+			  .then([&calls](int x) { calls++; return x; })
+			  .then([&calls](int) { calls++; });
+	caught = false;
+	try {
+		f7.get();
+	} catch (std::runtime_error &) {
+		caught = true;
+	}
+	check(name + " continuation exception", caught && calls == 0);
+
+	// Timed wait.
+	auto f8 = pool.submit_with_result([] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		return 1;
+	});
+	bool early = f8.wait_for(std::chrono::milliseconds(1));
+	bool late = f8.wait_for(std::chrono::seconds(10));
+	check(name + " timed wait", !early && late && f8.get() == 1);
+
+	// Many futures at once.
+	std::vector<future<int>> futures;
+	for (int i = 0; i < 10000; i++)
+		futures.push_back(pool.submit_with_result([i] { return i; }).then([](int x) {
+			return x * 2;
+		}));
+	bool ok = true;
+	for (int i = 0; i < 10000; i++)
+		ok = ok && futures[i].get() == i * 2;
+	check(name + " many", ok);
+
+	// Dropped futures do not leak.
+	for (int i = 0; i < 1000; i++)
+		pool.submit_with_result([i] { return i; }).then([](int x) { return x; });
+}
+
+// A task that is never run breaks its future and all the continuations.
+template <typename Pool>
+void
+test_abandoned(const std::string &name, bool chained)
+{
+	future<int> broken;
+	{
+		Pool pool(1);
+		pool.submit([] { std::this_thread::sleep_for(std::chrono::milliseconds(50)); });
+		auto f = pool.submit_with_result([] { return 1; });
+		if (chained)
+			broken = f.then([](int x) { return x + 1; })
+					 .then([](int x) { return x * 2; });
+		else
+			broken = std::move(f);
+		pool.stop();
+	}
+	bool caught = false;
+	try {
+		broken.get();
+	} catch (std::runtime_error &) {
+		caught = true;
+	}
+	check(name, caught);
+}
+
+int
+main()
+{
+	test<thread_pool<queue>>("thread_pool");
+	test<ws_thread_pool<lock_free_queue>>("ws_thread_pool");
+
+	test_abandoned<thread_pool<queue>>("abandoned", false);
+	test_abandoned<thread_pool<queue>>("abandoned chain", true);
+	test_abandoned<ws_thread_pool<lock_free_queue>>("ws abandoned chain", true);
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
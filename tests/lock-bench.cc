@@ -1,3 +1,4 @@
+#include "evenk/parking_lot.h"
 #include "evenk/spinlock.h"
 #include "evenk/synch.h"
 
@@ -11,7 +12,10 @@ evenk::posix_mutex posix_mutex;
 evenk::spin_lock spin_lock;
 evenk::tatas_lock tatas_lock;
 evenk::ticket_lock ticket_lock;
+evenk::mcs_lock mcs_lock;
+evenk::clh_lock clh_lock;
 evenk::futex_lock futex_lock;
+evenk::parking_lock parking_lock;
 
 evenk::no_backoff no_backoff;
 evenk::yield_backoff yield_backoff;
@@ -88,6 +92,12 @@ bench(unsigned nthreads, unsigned hardware_nthreads)
 	BENCH2(futex_lock, exponential_cycle_backoff);
 	BENCH2(futex_lock, linear_relax_backoff);
 	BENCH2(futex_lock, exponential_relax_backoff);
+
+	BENCH2(parking_lock, no_backoff);
+	BENCH2(parking_lock, linear_cycle_backoff);
+	BENCH2(parking_lock, exponential_cycle_backoff);
+	BENCH2(parking_lock, linear_relax_backoff);
+	BENCH2(parking_lock, exponential_relax_backoff);
 #endif
 
 	BENCH2(spin_lock, no_backoff);
@@ -143,6 +153,26 @@ bench(unsigned nthreads, unsigned hardware_nthreads)
 		BENCH2(ticket_lock, relax_yield_backoff);
 	}
 
+	if (nthreads < hardware_nthreads || hardware_nthreads <= 8) {
+		BENCH2(mcs_lock, no_backoff);
+		BENCH2(mcs_lock, const_cycle_backoff);
+		BENCH2(mcs_lock, const_relax_backoff);
+		BENCH2(mcs_lock, const_relax_x4_backoff);
+		BENCH2(mcs_lock, yield_backoff);
+	} else {
+		BENCH2(mcs_lock, yield_backoff);
+	}
+
+	if (nthreads < hardware_nthreads || hardware_nthreads <= 8) {
+		BENCH2(clh_lock, no_backoff);
+		BENCH2(clh_lock, const_cycle_backoff);
+		BENCH2(clh_lock, const_relax_backoff);
+		BENCH2(clh_lock, const_relax_x4_backoff);
+		BENCH2(clh_lock, yield_backoff);
+	} else {
+		BENCH2(clh_lock, yield_backoff);
+	}
+
 	std::cout << "\n";
 }
 
@@ -0,0 +1,175 @@
+#include "evenk/mpsc_queue.h"
+#include "evenk/thread.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace evenk;
+
+static constexpr int producer_num = 4;
+static constexpr int test_count = 100 * 1000;
+
+static bool failed = false;
+
+struct message : mpsc_queue_hook
+{
+	int producer = 0;
+	int count = 0;
+};
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+void
+test_basic()
+{
+	intrusive_mpsc_queue<message> queue;
+	std::vector<message> messages(100);
+	message *node;
+
+	check("empty", queue.try_pop(node) == queue_op_status::empty && queue.is_empty());
+
+	bool ok = true;
+	for (int i = 0; i < 100; i++) {
+		messages[i].count = i;
+		queue.push(&messages[i]);
+	}
+	for (int i = 0; i < 100; i++)
+		ok = ok && queue.try_pop(node) == queue_op_status::success && node->count == i;
+	check("fifo order", ok && queue.is_empty());
+
+	// The same nodes may be reused once they are out of the queue.
+	queue.push(&messages[1]);
+	queue.push(&messages[0]);
+	ok = queue.try_pop(node) == queue_op_status::success && node == &messages[1];
+	ok = ok && queue.try_pop(node) == queue_op_status::success && node == &messages[0];
+	check("node reuse", ok && queue.try_pop(node) == queue_op_status::empty);
+
+	auto status = queue.wait_pop_for(node, std::chrono::milliseconds(10));
+	check("timed pop", status == queue_op_status::timeout);
+
+	queue.push(&messages[2]);
+	queue.close();
+	check("push when closed", queue.try_push(&messages[3]) == queue_op_status::closed);
+	status = queue.wait_pop(node);
+	check("pop after close", status == queue_op_status::success && node == &messages[2]);
+	check("pop when drained", queue.wait_pop(node) == queue_op_status::closed);
+}
+
+template <typename... Backoff>
+void
+test_concurrent(const std::string &name, Backoff... backoff)
+{
+	intrusive_mpsc_queue<message> queue;
+	std::vector<std::vector<message>> messages(producer_num,
+						   std::vector<message>(test_count));
+
+	// The consumer must see the messages of every producer in order.
+	std::vector<int> last(producer_num, -1);
+	long sum = 0;
+	bool ordered = true;
+
+	evenk::thread consumer([&] {
+		message *node;
+		while (queue.wait_pop(node, backoff...) == queue_op_status::success) {
+			if (node->count != last[node->producer] + 1)
+				ordered = false;
+			last[node->producer] = node->count;
+			sum += node->count;
+		}
+	});
+
+	evenk::thread producers[producer_num];
+	for (int i = 0; i < producer_num; i++) {
+		producers[i] = evenk::thread([i, &queue, &messages] {
+			for (int j = 0; j < test_count; j++) {
+				message &m = messages[i][j];
+				m.producer = i;
+				m.count = j;
+				queue.push(&m);
+			}
+		});
+	}
+	for (auto &t : producers)
+		t.join();
+	queue.close();
+	consumer.join();
+
+	long expected = long(test_count) * (test_count - 1) / 2 * producer_num;
+	check(name + " concurrent order", ordered);
+	check(name + " concurrent total", sum == expected);
+}
+
+// Every producer pushes a message only after the previous one is taken so
+// the consumer keeps falling asleep on an empty queue. A lost wakeup leaves
+// all the threads waiting. So the consumer waits with a timeout that is way
+// more than enough for a producer to get going.
+void
+test_wakeup()
+{
+	static constexpr int round_num = 20 * 1000;
+
+	intrusive_mpsc_queue<message> queue;
+	std::vector<message> messages(producer_num);
+	std::atomic<int> taken[producer_num];
+	for (auto &t : taken)
+		t.store(0, std::memory_order_relaxed);
+
+	std::atomic<bool> lost(false);
+	evenk::thread consumer([&] {
+		message *node;
+		for (int n = 0; n < round_num * producer_num; n++) {
+			auto status = queue.wait_pop_for(node, std::chrono::seconds(5));
+			if (status != queue_op_status::success) {
+				lost = true;
+				break;
+			}
+			taken[node->producer].store(node->count + 1, std::memory_order_release);
+		}
+	});
+
+	evenk::thread producers[producer_num];
+	for (int i = 0; i < producer_num; i++) {
+		producers[i] = evenk::thread([i, &queue, &messages, &taken, &lost] {
+			message &m = messages[i];
+			m.producer = i;
+			for (int j = 0; j < round_num && !lost; j++) {
+				m.count = j;
+				queue.push(&m);
+				while (taken[i].load(std::memory_order_acquire) <= j && !lost)
+					std::this_thread::yield();
+			}
+		});
+	}
+	consumer.join();
+	for (auto &t : producers)
+		t.join();
+
+	check("no lost wakeups", !lost && queue.is_empty());
+}
+
+int
+main()
+{
+	test_basic();
+
+	test_concurrent("futex");
+	test_concurrent("yield", yield_backoff{});
+	test_concurrent("linear", linear_backoff<cpu_relax, 100>{});
+	test_wakeup();
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -0,0 +1,224 @@
+#include "evenk/bounded_queue.h"
+#include "evenk/numa.h"
+#include "evenk/task.h"
+#include "evenk/thread.h"
+
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace evenk;
+
+using ring_queue = bounded_queue::mpmc<int, bounded_queue::futex>;
+using numa_task = task<long, fptr_size, numa_allocator<char>>;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+// Get the kernel policy mode for an address or -1 if it is not available.
+int
+address_mode(void *addr)
+{
+	int mode;
+	unsigned long mask[16];
+	// 2 is MPOL_F_ADDR.
+	if (syscall(SYS_get_mempolicy, &mode, mask, sizeof mask * 8, addr, 2) != 0)
+		return -1;
+	return mode;
+}
+
+void
+test_alloc(const std::string &name, const numa_policy &policy, int mode)
+{
+	const std::size_t size = 3 * 4096 + 1;
+	char *memory = static_cast<char *>(numa_alloc(size, policy));
+	bool ok = memory[0] == 0 && memory[size - 1] == 0;
+	memory[size - 1] = 1;
+	if (!numa_is_fake()) {
+		int actual = address_mode(memory);
+		if (actual >= 0 && actual != mode)
+			ok = false;
+	}
+	numa_free(memory, size);
+	check(name + " alloc", ok);
+}
+
+// Small blocks come from a shared arena of the policy.
+void
+test_arena(const std::string &name, const numa_policy &policy, int mode)
+{
+	numa_policy copy = policy;
+	numa_allocator<long> alloc(policy);
+	numa_allocator<char> other(copy);
+	bool ok = alloc == other && alloc.policy() == policy;
+
+	std::vector<long *> blocks;
+	std::set<long *> distinct;
+	for (int i = 0; i < 10000; i++) {
+		long *p = alloc.allocate(i % 7 + 1);
+		p[i % 7] = i;
+		if (reinterpret_cast<std::uintptr_t>(p) % sizeof(long) != 0)
+			ok = false;
+		blocks.push_back(p);
+		distinct.insert(p);
+	}
+	ok = ok && distinct.size() == blocks.size();
+	if (!numa_is_fake()) {
+		int actual = address_mode(blocks.back());
+		if (actual >= 0 && actual != mode)
+			ok = false;
+	}
+	for (int i = 0; i < 10000; i++)
+		alloc.deallocate(blocks[i], i % 7 + 1);
+
+	// A freed block is reused.
+	long *p = alloc.allocate(1);
+	ok = ok && distinct.count(p) != 0;
+	alloc.deallocate(p, 1);
+
+	// Large blocks still go directly to numa_alloc().
+	char *large = other.allocate(3 * 4096);
+	ok = ok && reinterpret_cast<std::uintptr_t>(large) % 4096 == 0;
+	other.deallocate(large, 3 * 4096);
+
+	check(name + " arena", ok);
+}
+
+void
+test_ring(const std::string &name, const numa_policy &policy)
+{
+	ring_queue queue(1024, policy);
+	evenk::thread producer([&queue] {
+		for (int i = 1; i <= 100000; i++)
+			queue.push(i);
+		queue.close();
+	});
+
+	long sum = 0;
+	int value;
+	while (queue.wait_pop(value) == queue_op_status::success)
+		sum += value;
+	producer.join();
+	check(name + " ring", sum == 100000L * 100001 / 2);
+}
+
+void
+test_task(const std::string &name, const numa_policy &policy)
+{
+	// Too large to fit inline so the allocator is used.
+	long data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	numa_allocator<char> alloc(policy);
+	numa_task t(
+		[data] {
+			long sum = 0;
+			for (long x : data)
+				sum += x;
+			return sum;
+		},
+		alloc);
+	numa_task moved(std::move(t));
+	check(name + " task", moved() == 36);
+}
+
+void
+test_policies(const std::string &prefix)
+{
+	// The numbers are the MPOL_* modes.
+	test_alloc(prefix + "first_touch", numa_policy::first_touch(), 0);
+	test_alloc(prefix + "node_local", numa_policy::node_local(numa_current_node()), 1);
+	test_alloc(prefix + "interleave", numa_policy::interleave(), 3);
+	test_arena(prefix + "first_touch", numa_policy::first_touch(), 0);
+	test_arena(prefix + "node_local", numa_policy::node_local(numa_current_node()), 1);
+	test_arena(prefix + "interleave", numa_policy::interleave(), 3);
+
+	numa_policy local = numa_policy::node_local(0);
+	test_ring(prefix + "node_local", local);
+	test_task(prefix + "node_local", local);
+	numa_policy interleave = numa_policy::interleave(cpuset({0}));
+	test_ring(prefix + "interleave", interleave);
+	test_task(prefix + "interleave", interleave);
+}
+
+void
+test_errors()
+{
+	// There is no such node.
+	numa_policy policy = numa_policy::node_local(numa_node_count() + 100);
+	bool thrown = false;
+	try {
+		numa_free(numa_alloc(4096, policy), 4096);
+	} catch (std::system_error &) {
+		thrown = true;
+	}
+	check("bad node", thrown);
+
+	thrown = false;
+	try {
+		numa_policy::interleave(cpuset());
+	} catch (std::invalid_argument &) {
+		thrown = true;
+	}
+	check("no nodes", thrown);
+}
+
+void
+test_thread()
+{
+	bool ok = true;
+	evenk::thread thread([&ok] {
+		try {
+			numa_policy::interleave().apply_to_thread();
+			numa_policy::first_touch().apply_to_thread();
+		} catch (std::system_error &) {
+			ok = false;
+		}
+	});
+	thread.join();
+	check("thread policy", ok);
+}
+
+int
+main()
+{
+	std::cout << "nodes: " << numa_node_count() << "\n";
+
+	// Probe if the NUMA calls are permitted here.
+	bool real = true;
+	try {
+		numa_free(numa_alloc(1, numa_policy::interleave()), 1);
+	} catch (std::system_error &e) {
+		std::cout << "NUMA calls are not available: " << e.what() << "\n";
+		real = false;
+	}
+	if (real) {
+		test_policies("");
+		test_errors();
+		test_thread();
+	}
+
+	numa_set_fake(true);
+	check("fake nodes", numa_node_count() == 1 && numa_current_node() == 0);
+	test_policies("fake ");
+	numa_free(numa_alloc(1, numa_policy::node_local(100)), 1);
+	numa_set_fake(false);
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
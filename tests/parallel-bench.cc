@@ -0,0 +1,111 @@
+#include "evenk/parallel.h"
+#include "evenk/thread_pool.h"
+#include "evenk/unbounded_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+
+template <typename T>
+using queue = evenk::unbounded_queue<T>;
+
+static constexpr std::size_t element_count = 1000 * 1000;
+
+static double
+compute(std::size_t i)
+{
+	return std::sqrt(double(i));
+}
+
+template <typename Bench>
+void
+measure(std::string const &name, Bench bench)
+{
+	auto start = std::chrono::steady_clock::now();
+	double sum = bench();
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> diff = end - start;
+
+	std::cout << name << ": ns/element=" << (diff.count() * 1e9 / element_count)
+		  << ", sum=" << sum << "\n";
+}
+
+template <typename Pool>
+void
+bench(unsigned nthreads, std::string const &name)
+{
+	Pool pool(nthreads);
+
+	// Submit a task for every element and count them down.
+	measure(name + " naive submit", [&pool] {
+		std::atomic<std::size_t> pending(element_count);
+		std::atomic<double> total(0);
+		for (std::size_t i = 0; i < element_count; i++) {
+			pool.submit([i, &pending, &total] {
+				double v = compute(i);
+				double t = total.load(std::memory_order_relaxed);
+				while (!total.compare_exchange_weak(t, t + v))
+					;
+				pending.fetch_sub(1, std::memory_order_release);
+			});
+		}
+		while (pending.load(std::memory_order_acquire) != 0)
+			std::this_thread::yield();
+		return total.load();
+	});
+
+	measure(name + " parallel_for", [&pool] {
+		std::atomic<double> total(0);
+		evenk::parallel_for(
+			pool,
+			evenk::make_range(std::size_t(0), element_count),
+			[&total](evenk::range<std::size_t> r) {
+				double v = 0;
+				for (auto i = r.begin(); i != r.end(); i++)
+					v += compute(i);
+				double t = total.load(std::memory_order_relaxed);
+				while (!total.compare_exchange_weak(t, t + v))
+					;
+			},
+			1000);
+		return total.load();
+	});
+
+	measure(name + " parallel_reduce", [&pool] {
+		return evenk::parallel_reduce(
+			pool,
+			evenk::make_range(std::size_t(0), element_count),
+			0.0,
+			[](evenk::range<std::size_t> r, double v) {
+				for (auto i = r.begin(); i != r.end(); i++)
+					v += compute(i);
+				return v;
+			},
+			[](double a, double b) { return a + b; },
+			1000);
+	});
+}
+
+int
+main()
+{
+	measure("serial", [] {
+		double v = 0;
+		for (std::size_t i = 0; i < element_count; i++)
+			v += compute(i);
+		return v;
+	});
+	std::cout << "\n";
+
+	unsigned n = std::thread::hardware_concurrency();
+	for (unsigned i = 1; i <= n; i += std::min(i, 8u)) {
+		std::cout << "Pool threads: " << i << "\n";
+		bench<evenk::thread_pool<queue>>(i, "thread_pool");
+		bench<evenk::ws_thread_pool<queue>>(i, "ws_thread_pool");
+		std::cout << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include "evenk/parallel.h"
+#include "evenk/synch_queue.h"
+#include "evenk/thread_pool.h"
+#include "evenk/unbounded_queue.h"
+
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace evenk;
+
+template <typename T>
+using queue = synch_queue<T>;
+
+template <typename T>
+using lock_free_queue = unbounded_queue<T>;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+template <typename Pool>
+void
+test(const std::string &name)
+{
+	Pool pool(4);
+
+	// Every element is visited exactly once.
+	std::vector<int> v(100 * 1000);
+	parallel_for(pool, make_range(std::size_t(0), v.size()), [&v](range<std::size_t> r) {
+		for (auto i = r.begin(); i != r.end(); i++)
+			v[i]++;
+	});
+	bool ok = true;
+	for (auto x : v)
+		ok = ok && x == 1;
+	check(name + " parallel_for", ok);
+
+	std::iota(v.begin(), v.end(), 0);
+	long sum = parallel_reduce(pool,
+				   make_range(v.cbegin(), v.cend()),
+				   0L,
+				   [](range<std::vector<int>::const_iterator> r, long acc) {
+					   return std::accumulate(r.begin(), r.end(), acc);
+				   },
+				   [](long a, long b) { return a + b; },
+				   100);
+	check(name + " parallel_reduce", sum == long(v.size()) * long(v.size() - 1) / 2);
+
+	long empty = parallel_reduce(pool,
+				     make_range(0, 0),
+				     42L,
+				     [](range<int>, long acc) { return acc + 1; },
+				     [](long a, long b) { return a + b; });
+	check(name + " empty range", empty == 42);
+
+	// An exception from the body gets to the caller.
+	bool caught = false;
+	try {
+		parallel_for(pool, make_range(0, 1000), [](range<int> r) {
+			if (r.begin() <= 500 && 500 < r.end())
+				throw std::runtime_error("test");
+		});
+	} catch (std::runtime_error &) {
+		caught = true;
+	}
+	check(name + " exception", caught);
+
+	// A loop inside a pool task.
+	std::atomic<long> nested = ATOMIC_VAR_INIT(0);
+	parallel_for(pool, make_range(0, 8), [&pool, &nested](range<int> outer) {
+		for (auto i = outer.begin(); i != outer.end(); i++) {
+			parallel_for(pool, make_range(0, 1000), [&nested](range<int> r) {
+				nested.fetch_add(r.size(), std::memory_order_relaxed);
+			});
+		}
+	});
+	check(name + " nested", nested.load() == 8 * 1000);
+}
+
+int
+main()
+{
+	test<thread_pool<queue>>("thread_pool");
+	test<ws_thread_pool<lock_free_queue>>("ws_thread_pool");
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -1,9 +1,13 @@
 #include "evenk/bounded_queue.h"
+#include "evenk/parking_lot.h"
 #include "evenk/synch_queue.h"
+#include "evenk/unbounded_queue.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -68,6 +72,186 @@ bench(unsigned nthreads, const std::string &name, Queue &queue, Backoff... backo
 	std::cout << '\n';
 }
 
+template <typename Queue, typename... Backoff>
+void
+consume_bulk(Queue &queue, size_t &count, size_t batch, Backoff... backoff)
+{
+	std::vector<std::string> data;
+	data.reserve(batch);
+	size_t n;
+	while ((n = queue.wait_pop_bulk(std::back_inserter(data), batch, backoff...)) != 0) {
+		count += n;
+		data.clear();
+	}
+}
+
+template <typename Queue, typename... Backoff>
+void
+produce_bulk(Queue &queue, int count, size_t batch, Backoff... backoff)
+{
+	std::vector<std::string> data(batch, "this is a test string");
+	for (int i = 0; i < count; i += batch) {
+		size_t n = std::min<size_t>(batch, count - i);
+		queue.wait_push_bulk(data.begin(), data.begin() + n, backoff...);
+	}
+}
+
+template <typename Queue, typename... Backoff>
+void
+bench_bulk(unsigned nthreads, size_t batch, const std::string &name, Backoff... backoff)
+{
+	Queue queue(1024);
+	std::vector<size_t> counts(nthreads);
+	std::vector<std::thread> threads(nthreads);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i] = std::thread(consume_bulk<Queue, Backoff...>,
+					 std::ref(queue),
+					 std::ref(counts[i]),
+					 batch,
+					 backoff...);
+
+	produce_bulk(queue, TOTAL, batch, backoff...);
+	queue.close();
+
+	for (auto &t : threads)
+		t.join();
+
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> diff = end - start;
+
+	size_t total = 0;
+	for (auto &c : counts)
+		total += c;
+
+	std::cout << name << " batch=" << batch << ": duration=" << diff.count()
+		  << ", count=" << total << "\n";
+	if (total != TOTAL)
+		std::cout << "FAIL!!!\n";
+
+	for (auto &c : counts)
+		std::cout << " " << c;
+	std::cout << '\n';
+}
+
+void
+bench_bulk(unsigned nthreads)
+{
+	for (size_t batch = 1; batch <= 64; batch *= 4) {
+		using yield_queue = bounded_queue::mpmc<std::string, bounded_queue::yield>;
+		bench_bulk<yield_queue>(nthreads, batch, "bounded_yield_queue");
+		using dense_queue = bounded_queue::
+			mpmc<std::string, bounded_queue::yield, bounded_queue::dense_layout>;
+		bench_bulk<dense_queue>(nthreads, batch, "bounded_dense_yield_queue");
+		using spread_queue = bounded_queue::
+			mpmc<std::string, bounded_queue::yield, bounded_queue::spread_layout>;
+		bench_bulk<spread_queue>(nthreads, batch, "bounded_spread_yield_queue");
+#if __linux__
+		using futex_queue = bounded_queue::mpmc<std::string, bounded_queue::futex>;
+		bench_bulk<futex_queue>(nthreads, batch, "bounded_futex_queue");
+		bench_bulk<futex_queue>(nthreads, batch, "bounded_futex_queue yield_backoff",
+					yield_backoff{});
+#endif
+	}
+
+	std::cout << "\n";
+}
+
+template <typename Queue, typename... Backoff>
+void
+consume_large(Queue &queue, size_t &count, bool claim, Backoff... backoff)
+{
+	std::string data;
+	if (claim) {
+		for (;;) {
+			auto handle = queue.acquire_pop(backoff...);
+			if (!handle)
+				break;
+			if (!handle.value().empty())
+				++count;
+			handle.release();
+		}
+	} else {
+		while (queue.wait_pop(data, backoff...) == queue_op_status::success) {
+			if (!data.empty())
+				++count;
+		}
+	}
+}
+
+template <typename Queue, typename... Backoff>
+void
+produce_large(Queue &queue, int count, bool claim, Backoff... backoff)
+{
+	std::string data(1000, 'x');
+	for (int i = 0; i < count; i++) {
+		if (claim) {
+			auto handle = queue.reserve_push(backoff...);
+			handle.value().assign(data);
+			handle.commit();
+		} else {
+			queue.push(data, backoff...);
+		}
+	}
+}
+
+template <typename Queue, typename... Backoff>
+void
+bench_large(unsigned nthreads, bool claim, const std::string &name, Backoff... backoff)
+{
+	Queue queue(1024);
+	std::vector<size_t> counts(nthreads);
+	std::vector<std::thread> threads(nthreads);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i] = std::thread(consume_large<Queue, Backoff...>,
+					 std::ref(queue),
+					 std::ref(counts[i]),
+					 claim,
+					 backoff...);
+
+	produce_large(queue, TOTAL, claim, backoff...);
+	queue.close();
+
+	for (auto &t : threads)
+		t.join();
+
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> diff = end - start;
+
+	size_t total = 0;
+	for (auto &c : counts)
+		total += c;
+
+	std::cout << name << (claim ? " claim" : " copy") << ": duration=" << diff.count()
+		  << ", count=" << total << "\n";
+	if (total != TOTAL)
+		std::cout << "FAIL!!!\n";
+
+	for (auto &c : counts)
+		std::cout << " " << c;
+	std::cout << '\n';
+}
+
+void
+bench_large(unsigned nthreads)
+{
+	for (bool claim : {false, true}) {
+		using yield_queue = bounded_queue::mpmc<std::string, bounded_queue::yield>;
+		bench_large<yield_queue>(nthreads, claim, "bounded_yield_queue");
+#if __linux__
+		using futex_queue = bounded_queue::mpmc<std::string, bounded_queue::futex>;
+		bench_large<futex_queue>(nthreads, claim, "bounded_futex_queue");
+#endif
+	}
+
+	std::cout << "\n";
+}
+
 void
 bench(unsigned nthreads)
 {
@@ -102,8 +286,45 @@ bench(unsigned nthreads)
 		yield_backoff yield_backoff;
 		BENCH2(futex_queue, yield_backoff);
 	}
+	{
+		synch_queue<std::string, futex_shared_synch> futex_shared_queue;
+		BENCH1(futex_shared_queue);
+	}
+	{
+		synch_queue<std::string, futex_shared_synch> futex_shared_queue;
+		linear_backoff<cpu_relax, 1000, 1> linear_relax_backoff;
+		BENCH2(futex_shared_queue, linear_relax_backoff);
+	}
+	{
+		synch_queue<std::string, eventcount_synch> eventcount_queue;
+		BENCH1(eventcount_queue);
+	}
+	{
+		synch_queue<std::string, eventcount_synch> eventcount_queue;
+		linear_backoff<cpu_relax, 1000, 1> linear_relax_backoff;
+		BENCH2(eventcount_queue, linear_relax_backoff);
+	}
+	{
+		synch_queue<std::string, parking_synch> parking_queue;
+		BENCH1(parking_queue);
+	}
+	{
+		synch_queue<std::string, parking_synch> parking_queue;
+		linear_backoff<cpu_relax, 1000, 1> linear_relax_backoff;
+		BENCH2(parking_queue, linear_relax_backoff);
+	}
 #endif
 
+	{
+		unbounded_queue<std::string> a_unbounded_queue;
+		BENCH1(a_unbounded_queue);
+	}
+	{
+		unbounded_queue<std::string> a_unbounded_queue;
+		yield_backoff yield_backoff;
+		BENCH2(a_unbounded_queue, yield_backoff);
+	}
+
 	bounded_queue::mpmc<std::string> a_bounded_queue(1024);
 	BENCH1(a_bounded_queue);
 
@@ -172,11 +393,66 @@ bench(unsigned nthreads)
 		yield_backoff yield_backoff;
 		BENCH2(bounded_futex_queue, yield_backoff);
 	}
+	{
+		bounded_queue::mpmc<std::string, bounded_queue::event> bounded_event_queue(1024);
+		BENCH1(bounded_event_queue);
+	}
+	{
+		bounded_queue::mpmc<std::string, bounded_queue::event> bounded_event_queue(1024);
+		linear_backoff<cpu_relax, 1000, 1> linear_relax_backoff;
+		BENCH2(bounded_event_queue, linear_relax_backoff);
+	}
+	{
+		bounded_queue::mpmc<std::string, bounded_queue::event> bounded_event_queue(1024);
+		yield_backoff yield_backoff;
+		BENCH2(bounded_event_queue, yield_backoff);
+	}
+	{
+		bounded_queue::mpmc<std::string, bounded_queue::synch<parking_synch>>
+			bounded_parking_synch_queue(1024);
+		BENCH1(bounded_parking_synch_queue);
+	}
+	{
+		bounded_queue::mpmc<std::string, bounded_queue::synch<parking_synch>>
+			bounded_parking_synch_queue(1024);
+		linear_backoff<cpu_relax, 1000, 1> linear_relax_backoff;
+		BENCH2(bounded_parking_synch_queue, linear_relax_backoff);
+	}
 #endif
 
 	bounded_queue::mpmc<std::string, bounded_queue::yield> bounded_yield_queue(1024);
 	BENCH1(bounded_yield_queue);
 
+	if (nthreads == 1) {
+		{
+			bounded_queue::spsc<std::string, bounded_queue::yield>
+				spsc_yield_queue(1024);
+			BENCH1(spsc_yield_queue);
+		}
+		{
+			bounded_queue::cached_spsc<std::string> cached_spsc_queue(1024);
+			yield_backoff yield_backoff;
+			BENCH2(cached_spsc_queue, yield_backoff);
+		}
+		if (std::thread::hardware_concurrency() > 1) {
+			bounded_queue::cached_spsc<std::string> cached_spsc_queue(1024);
+			BENCH1(cached_spsc_queue);
+		}
+	}
+
+	{
+		bounded_queue::
+			mpmc<std::string, bounded_queue::yield, bounded_queue::dense_layout>
+			bounded_dense_yield_queue(1024);
+		BENCH1(bounded_dense_yield_queue);
+	}
+	{
+		bounded_queue::
+			mpmc<std::string, bounded_queue::yield, bounded_queue::spread_layout>
+			bounded_spread_yield_queue(1024);
+		BENCH1(bounded_spread_yield_queue);
+	}
+
 	std::cout << "\n";
 }
 
@@ -186,5 +462,9 @@ main()
 	unsigned n = std::thread::hardware_concurrency();
 	for (unsigned i = 1; i <= n; i += i)
 		bench(i);
+	for (unsigned i = 1; i <= n; i += i)
+		bench_bulk(i);
+	for (unsigned i = 1; i <= n; i += i)
+		bench_large(i);
 	return 0;
 }
@@ -0,0 +1,89 @@
+#include "evenk/bounded_queue.h"
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace evenk;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+// A value that throws on construction from a negative number.
+struct checked
+{
+	int value = 0;
+
+	checked() noexcept = default;
+
+	explicit checked(int v) : value(v)
+	{
+		if (v < 0)
+			throw std::invalid_argument("negative");
+	}
+};
+
+void
+test_release()
+{
+	bounded_queue::mpmc<std::shared_ptr<int>, bounded_queue::futex> queue(16);
+	auto message = std::make_shared<int>(42);
+
+	auto push = queue.reserve_push();
+	push.emplace(message);
+	push.commit();
+	check("pushed", message.use_count() == 2);
+
+	auto pop = queue.acquire_pop();
+	bool ok = pop && *pop.value() == 42;
+	pop.release();
+	check("released value is dropped", ok && message.use_count() == 1);
+}
+
+void
+test_emplace()
+{
+	bounded_queue::mpmc<checked, bounded_queue::futex> queue(16);
+
+	bool thrown = false;
+	{
+		auto push = queue.reserve_push();
+		try {
+			push.emplace(-1);
+		} catch (std::invalid_argument &) {
+			thrown = true;
+		}
+	}
+	{
+		auto push = queue.reserve_push();
+		push.emplace(7);
+		push.commit();
+	}
+
+	// The failed push is dropped and skipped by consumers.
+	checked value;
+	bool ok = queue.wait_pop(value) == queue_op_status::success && value.value == 7;
+	check("emplace throws", thrown && ok);
+}
+
+int
+main()
+{
+	test_release();
+	test_emplace();
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "evenk/bounded_queue.h"
+#include "evenk/thread.h"
+
+#include <iostream>
+#include <string>
+
+using namespace evenk;
+
+using queue = bounded_queue::mpmc<int, bounded_queue::futex>;
+
+static constexpr int queue_num = 3;
+static constexpr int test_count = 100 * 1000;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+void
+test_priority()
+{
+	queue q0(16), q1(16), q2(16);
+	q2.push(2);
+	q1.push(1);
+
+	std::size_t index;
+	int value;
+	auto status = bounded_queue::select_pop(index, value, q0, q1, q2);
+	check("select_pop priority first", status == queue_op_status::success && index == 1
+						   && value == 1);
+	status = bounded_queue::select_pop(index, value, q0, q1, q2);
+	check("select_pop priority second", status == queue_op_status::success && index == 2
+						    && value == 2);
+
+	q0.close();
+	q1.close();
+	q2.close();
+	status = bounded_queue::select_pop(index, value, q0, q1, q2);
+	check("select_pop when closed", status == queue_op_status::closed);
+}
+
+void
+test_concurrent(const std::string &name)
+{
+	queue q0(16), q1(16), q2(16);
+	queue *queues[queue_num] = {&q0, &q1, &q2};
+
+	evenk::thread producers[queue_num];
+	for (int i = 0; i < queue_num; i++) {
+		producers[i] = evenk::thread([i, &queues] {
+			for (int j = 0; j < test_count; j++)
+				queues[i]->push(i);
+			queues[i]->close();
+		});
+	}
+
+	long counts[queue_num] = {};
+	bool consistent = true;
+	std::size_t index;
+	int value;
+	for (;;) {
+		auto status = bounded_queue::select_pop(index, value, q0, q1, q2);
+		if (status != queue_op_status::success)
+			break;
+		if (value != int(index))
+			consistent = false;
+		counts[index]++;
+	}
+
+	for (int i = 0; i < queue_num; i++)
+		producers[i].join();
+
+	for (int i = 0; i < queue_num; i++) {
+		check(name + " from queue #" + std::to_string(i) + " count="
+			      + std::to_string(counts[i]),
+		      counts[i] == test_count);
+	}
+	check(name + " values match queues", consistent);
+}
+
+int
+main()
+{
+	test_priority();
+	test_concurrent("select_pop");
+
+	// Without futex_waitv() the waits go through the shared eventcount.
+	bounded_queue::detail::select_no_waitv().store(true);
+	test_priority();
+	test_concurrent("select_pop fallback");
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
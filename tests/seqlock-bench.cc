@@ -0,0 +1,169 @@
+#include "evenk/seqlock.h"
+#include "evenk/spinlock.h"
+#include "evenk/synch.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct snapshot
+{
+	std::uint64_t epoch;
+	std::uint64_t limit;
+	std::uint64_t count;
+	std::uint64_t check;
+};
+
+static constexpr int read_count = 1000 * 1000;
+
+evenk::seq_lock<snapshot, evenk::spin_lock> seq_spin_lock;
+#if __linux__
+evenk::seq_lock<snapshot, evenk::futex_lock> seq_futex_lock;
+#endif
+
+evenk::shared_ticket_lock shared_ticket_lock;
+snapshot shared_snapshot;
+
+evenk::yield_backoff yield_backoff;
+evenk::linear_backoff<evenk::cpu_relax, 10, 2> linear_relax_backoff;
+
+std::atomic<bool> done;
+
+//
+// Sequence lock readers and writers
+//
+
+template <typename SeqLock, typename Backoff>
+void
+seq_read(std::uint64_t &errors, SeqLock &lock, Backoff backoff)
+{
+	std::uint64_t e = 0;
+	for (int i = 0; i < read_count; ++i) {
+		snapshot s = lock.read(backoff);
+		if (s.check != s.epoch + s.limit + s.count)
+			++e;
+	}
+	errors += e;
+}
+
+template <typename SeqLock, typename Backoff>
+void
+seq_write(SeqLock &lock, Backoff backoff)
+{
+	while (!done.load(std::memory_order_relaxed)) {
+		lock.update(
+			[](snapshot &s) {
+				s.epoch++;
+				s.count += 2;
+				s.check = s.epoch + s.limit + s.count;
+			},
+			backoff);
+		evenk::cpu_cycle{}(5000);
+	}
+}
+
+//
+// Shared ticket lock readers and writers
+//
+
+template <typename Backoff>
+void
+shared_read(std::uint64_t &errors, evenk::shared_ticket_lock &lock, Backoff backoff)
+{
+	std::uint64_t e = 0;
+	for (int i = 0; i < read_count; ++i) {
+		lock.lock_shared(backoff);
+		snapshot s = shared_snapshot;
+		lock.unlock_shared();
+		if (s.check != s.epoch + s.limit + s.count)
+			++e;
+	}
+	errors += e;
+}
+
+template <typename Backoff>
+void
+shared_write(evenk::shared_ticket_lock &lock, Backoff backoff)
+{
+	while (!done.load(std::memory_order_relaxed)) {
+		lock.lock(backoff);
+		shared_snapshot.epoch++;
+		shared_snapshot.count += 2;
+		shared_snapshot.check =
+			shared_snapshot.epoch + shared_snapshot.limit + shared_snapshot.count;
+		lock.unlock();
+		evenk::cpu_cycle{}(5000);
+	}
+}
+
+template <typename Reader, typename Writer, typename Lock, typename Backoff>
+void
+bench(unsigned nthreads, std::string const &name, Reader reader, Writer writer, Lock &lock,
+      Backoff backoff)
+{
+	std::vector<std::uint64_t> errors(nthreads);
+
+	std::vector<std::thread> v;
+	v.reserve(nthreads);
+
+	done = false;
+	std::thread w(writer, std::ref(lock), backoff);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < nthreads; ++i)
+		v.emplace_back(reader, std::ref(errors[i]), std::ref(lock), backoff);
+	for (auto &t : v)
+		t.join();
+
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> diff = end - start;
+
+	done = true;
+	w.join();
+
+	std::uint64_t total = 0;
+	for (auto e : errors)
+		total += e;
+
+	std::cout << name << ": reads/sec=" << (nthreads * read_count / diff.count())
+		  << ", errors=" << total << ", duration=" << diff.count() << "\n";
+}
+
+void
+bench(unsigned nthreads, unsigned hardware_nthreads)
+{
+	std::cout << "Reader threads: " << nthreads << "\n";
+
+#define BENCH_SEQ(lock, backoff)                                                               \
+	bench(nthreads, #lock " " #backoff, seq_read<decltype(lock), decltype(backoff)>,           \
+	      seq_write<decltype(lock), decltype(backoff)>, lock, backoff)
+#define BENCH_SHARED(lock, backoff)                                                            \
+	bench(nthreads, #lock " " #backoff, shared_read<decltype(backoff)>,                        \
+	      shared_write<decltype(backoff)>, lock, backoff)
+
+	BENCH_SEQ(seq_spin_lock, yield_backoff);
+	BENCH_SEQ(seq_spin_lock, linear_relax_backoff);
+#if __linux__
+	BENCH_SEQ(seq_futex_lock, yield_backoff);
+	BENCH_SEQ(seq_futex_lock, linear_relax_backoff);
+#endif
+
+	// Ticket handoff without yielding is hopeless when the writer has to
+	// share a CPU with the readers.
+	BENCH_SHARED(shared_ticket_lock, yield_backoff);
+	if (nthreads < hardware_nthreads)
+		BENCH_SHARED(shared_ticket_lock, linear_relax_backoff);
+
+	std::cout << "\n";
+}
+
+int
+main()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	for (unsigned i = 1; i <= n; i += std::min(i, 8u))
+		bench(i, n);
+	return 0;
+}
@@ -1,6 +1,8 @@
 #define EVENK_SHARED_TICKET_TESTING 1
 
+#include "evenk/biased_lock.h"
 #include "evenk/spinlock.h"
+#include "evenk/synch.h"
 #include "evenk/thread.h"
 
 #include <iostream>
@@ -17,10 +19,9 @@ struct entry
 	alignas(64) std::int_fast32_t value;
 } table[table_size];
 
-evenk::shared_ticket_lock table_lock;
-
+template <typename Lock>
 void
-thread_routine(std::size_t thread_idx)
+thread_routine(Lock &table_lock, std::size_t thread_idx)
 {
 	for (std::size_t i = 1; i <= test_count; i++) {
 		table_lock.lock_shared();
@@ -40,29 +41,86 @@ thread_routine(std::size_t thread_idx)
 	}
 }
 
-int
-main()
+template <typename Lock>
+bool
+test(const char *name)
 {
-	std::size_t hw_threads = std::thread::hardware_concurrency();
-	if (thread_num > hw_threads) {
-		std::cout << "WARNING: the test runs extremely slow if the number of CPU cores is below " << thread_num
-			  << " while your machine appears to have just " << hw_threads << ".\n";
-	}
+	std::cout << "testing " << name << "\n";
+
+	for (std::size_t j = 0; j < table_size; j++)
+		table[j].value = 0;
+
+	Lock table_lock;
 
 	evenk::thread thread_array[thread_num];
 	for (std::size_t i = 0; i < thread_num; i++)
-		thread_array[i] = evenk::thread(thread_routine, i);
+		thread_array[i] = evenk::thread(thread_routine<Lock>, std::ref(table_lock), i);
 	for (std::size_t i = 0; i < thread_num; i++)
 		thread_array[i].join();
 
 	for (std::size_t j = 0; j < table_size; j++) {
 		if (table[j].value != test_count * thread_num) {
 			std::cout << "FAILED\n";
-			return 1;
+			return false;
 		}
 		std::cout << "entry #" << j << ": table[j].value=" << table[j].value << ": ok\n";
 	}
 
+	return true;
+}
+
+template <typename Lock>
+bool
+test_try_lock(const char *name)
+{
+	std::cout << "testing " << name << " try_lock\n";
+
+	// A failed try_lock must keep the lock usable by fast readers and
+	// a successful one must exclude them.
+	Lock lock;
+	bool ok = true;
+	for (int i = 0; i < 1000; i++) {
+		lock.lock_shared();
+		if (lock.try_lock())
+			ok = false;
+		lock.unlock_shared();
+		if (!lock.try_lock()) {
+			ok = false;
+			continue;
+		}
+		if (lock.try_lock_shared())
+			ok = false;
+		lock.unlock();
+	}
+	std::cout << (ok ? "ok\n" : "FAILED\n");
+	return ok;
+}
+
+int
+main()
+{
+	std::size_t hw_threads = std::thread::hardware_concurrency();
+	if (thread_num > hw_threads) {
+		std::cout << "WARNING: the test runs extremely slow if the number of CPU cores is below " << thread_num
+			  << " while your machine appears to have just " << hw_threads << ".\n";
+	}
+
+	if (!test<evenk::shared_ticket_lock>("shared_ticket_lock"))
+		return 1;
+#if __linux__
+	if (!test<evenk::futex_shared_lock>("futex_shared_lock"))
+		return 1;
+#endif
+	if (!test<evenk::reader_biased_lock<evenk::shared_ticket_lock>>("reader_biased_lock<shared_ticket_lock>"))
+		return 1;
+#if __linux__
+	if (!test<evenk::reader_biased_lock<evenk::futex_shared_lock>>("reader_biased_lock<futex_shared_lock>"))
+		return 1;
+#endif
+	if (!test_try_lock<evenk::reader_biased_lock<evenk::shared_ticket_lock>>(
+		    "reader_biased_lock<shared_ticket_lock>"))
+		return 1;
+
 	std::cout << "passed\n";
 	return 0;
 }
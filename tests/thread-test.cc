@@ -24,10 +24,8 @@ print_affinity(const evenk::thread::cpuset_type &affinity)
 	if (affinity.size() == 0) {
 		std::cout << " is not available";
 	} else {
-		std::cout << ": " << affinity.size() << " CPUs:";
-		for (std::size_t cpu = 0; cpu < affinity.size(); cpu++)
-			if (affinity[cpu])
-				std::cout << " " << cpu;
+		std::cout << ": " << affinity.count() << " CPUs: ";
+		std::cout << affinity.to_string();
 	}
 	std::cout << "\n";
 }
@@ -46,9 +44,15 @@ main()
 		auto affinity = thread.affinity();
 		print_affinity(affinity);
 
-		for (std::size_t cpu = 0; cpu < affinity.size(); cpu += 2)
-			affinity[cpu] = false;
-		thread.affinity(affinity);
+		// Drop every other CPU but keep at least one.
+		bool drop = false;
+		for (std::size_t cpu : evenk::thread::cpuset_type(affinity)) {
+			if (drop)
+				affinity[cpu] = false;
+			drop = !drop;
+		}
+		if (affinity.size())
+			thread.affinity(affinity);
 	}
 
 	{
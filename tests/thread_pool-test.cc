@@ -1,16 +1,21 @@
 #include <evenk/synch_queue.h>
 #include <evenk/thread_pool.h>
+#include <evenk/unbounded_queue.h>
 
 template <typename T>
 using queue = evenk::synch_queue<T>;
 
-int
-main()
+template <typename T>
+using lock_free_queue = evenk::unbounded_queue<T>;
+
+template <typename Pool>
+bool
+test()
 {
 	static constexpr std::uint32_t expected = 100 * 1000;
 	std::atomic<std::uint32_t> counter = ATOMIC_VAR_INIT(0);
 
-	evenk::thread_pool<queue> pool(8);
+	Pool pool(8);
 	for (std::uint32_t i = 0; i < expected; i++)
 		pool.submit([&counter] { counter.fetch_add(1, std::memory_order_relaxed); });
 	pool.wait();
@@ -18,5 +23,57 @@ main()
 	std::uint32_t actual = counter.load(std::memory_order_relaxed);
 	printf("%u %s\n", actual, actual == expected ? "Okay" : "FAIL");
 
+	return actual == expected;
+}
+
+// Tasks that submit more tasks from worker threads.
+template <typename Pool>
+bool
+test_nested()
+{
+	static constexpr std::uint32_t outer = 1000;
+	static constexpr std::uint32_t inner = 100;
+	static constexpr std::uint32_t expected = outer * inner;
+	std::atomic<std::uint32_t> counter = ATOMIC_VAR_INIT(0);
+
+	Pool pool(8);
+	for (std::uint32_t i = 0; i < outer; i++) {
+		pool.submit([&pool, &counter] {
+			for (std::uint32_t j = 0; j < inner; j++)
+				pool.submit([&counter] {
+					counter.fetch_add(1, std::memory_order_relaxed);
+				});
+		});
+	}
+	// Workers drain their own deques before they quit so inner tasks
+	// are not lost even if they are submitted after the pool closes.
+	pool.wait();
+
+	std::uint32_t actual = counter.load(std::memory_order_relaxed);
+	printf("%u %s\n", actual, actual == expected ? "Okay" : "FAIL");
+
+	return actual == expected;
+}
+
+int
+main()
+{
+	if (!test<evenk::thread_pool<queue>>())
+		return 1;
+	if (!test<evenk::thread_pool<lock_free_queue>>())
+		return 1;
+	if (!test<evenk::ws_thread_pool<queue>>())
+		return 1;
+	if (!test<evenk::ws_thread_pool<lock_free_queue>>())
+		return 1;
+	if (!test_nested<evenk::ws_thread_pool<lock_free_queue>>())
+		return 1;
+
+	// A pool that is neither stopped nor waited for is shut down on
+	// destruction.
+	{
+		evenk::thread_pool<queue> pool(2);
+		evenk::ws_thread_pool<queue> ws_pool(2);
+	}
 	return 0;
 }
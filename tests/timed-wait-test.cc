@@ -0,0 +1,202 @@
+#include "evenk/bounded_queue.h"
+#include "evenk/parking_lot.h"
+#include "evenk/synch.h"
+#include "evenk/synch_queue.h"
+#include "evenk/thread.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace evenk;
+
+static constexpr std::chrono::milliseconds timeout(20);
+
+static bool failed = false;
+
+// Check that an operation gives up not before the timeout and not too late.
+template <typename Operation>
+void
+check_timeout(const std::string &name, Operation operation)
+{
+	auto start = std::chrono::steady_clock::now();
+	bool timed_out = operation();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	bool ok = timed_out && elapsed >= timeout && elapsed < timeout * 50;
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	std::cout << name << ": elapsed=" << us << "us" << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+template <typename Synch>
+void
+test_cond_var(const std::string &name)
+{
+	typename Synch::lock_type lock;
+	typename Synch::cond_var_type cond;
+
+	check_timeout(name + " wait_for", [&] {
+		typename Synch::lock_owner_type guard(lock);
+		return cond.wait_for(guard, timeout) == std::cv_status::timeout;
+	});
+
+	bool flag = false;
+	evenk::thread notifier([&] {
+		typename Synch::lock_owner_type guard(lock);
+		flag = true;
+		cond.notify_one();
+	});
+	{
+		typename Synch::lock_owner_type guard(lock);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (!flag && cond.wait_until(guard, deadline) == std::cv_status::no_timeout)
+			;
+		check(name + " notify before deadline", flag);
+	}
+	notifier.join();
+}
+
+template <typename Queue>
+void
+test_bounded_queue(const std::string &name)
+{
+	Queue queue(16);
+	std::string value;
+
+	check_timeout(name + " wait_pop_for", [&] {
+		return queue.wait_pop_for(value, timeout) == queue_op_status::timeout;
+	});
+
+	for (int i = 0; i < 16; i++)
+		queue.push(std::to_string(i));
+	check_timeout(name + " wait_push_for", [&] {
+		auto status = queue.wait_push_for(std::string("full"), timeout);
+		return status == queue_op_status::timeout;
+	});
+	auto status = queue.try_push(std::string("full"));
+	check(name + " try_push when full", status == queue_op_status::full);
+
+	evenk::thread consumer([&] {
+		std::string v;
+		for (int i = 0; i < 17; i++)
+			queue.wait_pop(v);
+	});
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	status = queue.wait_push_until(std::string("16"), deadline);
+	check(name + " wait_push_until", status == queue_op_status::success);
+	consumer.join();
+
+	evenk::thread producer([&] { queue.push(std::string("late")); });
+	deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	status = queue.wait_pop_until(value, deadline);
+	check(name + " wait_pop_until", status == queue_op_status::success && value == "late");
+	producer.join();
+
+	queue.close();
+	status = queue.wait_pop_for(value, timeout);
+	check(name + " wait_pop_for when closed", status == queue_op_status::closed);
+}
+
+template <typename Queue>
+void
+test_synch_queue(const std::string &name)
+{
+	Queue queue;
+	std::string value;
+
+	check_timeout(name + " wait_pop_for", [&] {
+		return queue.wait_pop_for(value, timeout) == queue_op_status::timeout;
+	});
+
+	evenk::thread producer([&] { queue.push(std::string("late")); });
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	auto status = queue.wait_pop_until(value, deadline);
+	check(name + " wait_pop_until", status == queue_op_status::success && value == "late");
+	producer.join();
+
+	queue.close();
+	status = queue.wait_pop_for(value, timeout);
+	check(name + " wait_pop_for when closed", status == queue_op_status::closed);
+}
+
+int
+main()
+{
+#if __linux__
+	{
+		futex_t futex(0);
+		check_timeout("futex_wait_for",
+			      [&] { return futex_wait_for(futex, 0, timeout) == -ETIMEDOUT; });
+	}
+	{
+		futex_lock lock;
+		lock.lock();
+		evenk::thread other([&] {
+			check_timeout("futex_lock try_lock_for",
+				      [&] { return !lock.try_lock_for(timeout); });
+		});
+		other.join();
+		lock.unlock();
+		check("futex_lock try_lock_for when free", lock.try_lock_for(timeout));
+		lock.unlock();
+	}
+#endif
+
+	test_cond_var<std_synch>("std_synch");
+	test_cond_var<posix_synch>("posix_synch");
+#if __linux__
+	test_cond_var<futex_synch>("futex_synch");
+	test_cond_var<futex_shared_synch>("futex_shared_synch");
+	test_cond_var<parking_synch>("parking_synch");
+	test_cond_var<eventcount_synch>("eventcount_synch");
+#endif
+
+	test_bounded_queue<bounded_queue::mpmc<std::string, bounded_queue::yield>>(
+		"bounded_queue::yield");
+	test_bounded_queue<bounded_queue::spsc<std::string, bounded_queue::yield>>(
+		"bounded_queue::yield spsc");
+	test_bounded_queue<bounded_queue::cached_spsc<std::string>>(
+		"bounded_queue::cached_spsc");
+	test_bounded_queue<bounded_queue::mpmc<std::string, bounded_queue::synch<std_synch>>>(
+		"bounded_queue::synch<std_synch>");
+	test_bounded_queue<bounded_queue::
+		mpmc<std::string, bounded_queue::yield, bounded_queue::dense_layout>>(
+		"bounded_queue::yield dense_layout");
+	test_bounded_queue<bounded_queue::
+		mpmc<std::string, bounded_queue::yield, bounded_queue::spread_layout>>(
+		"bounded_queue::yield spread_layout");
+#if __linux__
+	test_bounded_queue<bounded_queue::mpmc<std::string, bounded_queue::futex>>(
+		"bounded_queue::futex");
+	test_bounded_queue<bounded_queue::mpmc<std::string, bounded_queue::synch<futex_synch>>>(
+		"bounded_queue::synch<futex_synch>");
+	test_bounded_queue<bounded_queue::mpmc<std::string, bounded_queue::event>>(
+		"bounded_queue::event");
+#endif
+
+	test_synch_queue<synch_queue<std::string, std_synch>>("synch_queue<std_synch>");
+	test_synch_queue<synch_queue<std::string, posix_synch>>("synch_queue<posix_synch>");
+#if __linux__
+	test_synch_queue<synch_queue<std::string, futex_synch>>("synch_queue<futex_synch>");
+	test_synch_queue<synch_queue<std::string, parking_synch>>("synch_queue<parking_synch>");
+	test_synch_queue<synch_queue<std::string, eventcount_synch>>(
+		"synch_queue<eventcount_synch>");
+#endif
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
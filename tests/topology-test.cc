@@ -0,0 +1,219 @@
+#include "evenk/thread_pool.h"
+#include "evenk/topology.h"
+#include "evenk/unbounded_queue.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace evenk;
+
+template <typename T>
+using queue = unbounded_queue<T>;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+void
+make_dirs(const std::string &path)
+{
+	for (std::size_t pos = 1; pos != std::string::npos;) {
+		pos = path.find('/', pos + 1);
+		mkdir(path.substr(0, pos).c_str(), 0755);
+	}
+}
+
+void
+write_file(const std::string &dir, const std::string &name, const std::string &text)
+{
+	make_dirs(dir);
+	std::ofstream(dir + "/" + name) << text << "\n";
+}
+
+int
+remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+	return remove(path);
+}
+
+//
+// A canned topology with 2 packages, 2 cores per package and 2 threads per
+// core. CPUs 0-3 are the first threads of the cores and CPUs 4-7 are their
+// siblings, just like Linux numbers them on x86. CPU 7 is offline. Every
+// core has its own L2 and every package has its own L3 and NUMA node.
+//
+
+std::string
+make_root()
+{
+	char name[] = "/tmp/evenk-topology-XXXXXX";
+	if (mkdtemp(name) == nullptr) {
+		std::cout << "mkdtemp failed\n";
+		exit(1);
+	}
+	return name;
+}
+
+std::string
+make_canned_tree()
+{
+	std::string root = make_root();
+	std::string cpu = root + "/devices/system/cpu";
+	std::string node = root + "/devices/system/node";
+
+	write_file(cpu, "online", "0-6");
+	for (int id = 0; id < 8; id++) {
+		int core = id % 4;
+		int package = core / 2;
+		std::string base = cpu + "/cpu" + std::to_string(id);
+		write_file(base + "/topology", "physical_package_id", std::to_string(package));
+		write_file(base + "/topology", "core_id", std::to_string(core % 2));
+
+		std::string l1 = base + "/cache/index0";
+		write_file(l1, "level", "1");
+		write_file(l1, "type", "Data");
+		write_file(l1, "shared_cpu_list",
+			   std::to_string(core) + "," + std::to_string(core + 4));
+		std::string l1i = base + "/cache/index1";
+		write_file(l1i, "level", "1");
+		write_file(l1i, "type", "Instruction");
+		write_file(l1i, "shared_cpu_list", "0-7");
+		std::string l2 = base + "/cache/index2";
+		write_file(l2, "level", "2");
+		write_file(l2, "type", "Unified");
+		write_file(l2, "shared_cpu_list",
+			   std::to_string(core) + "," + std::to_string(core + 4));
+		std::string l3 = base + "/cache/index3";
+		write_file(l3, "level", "3");
+		write_file(l3, "type", "Unified");
+		write_file(l3, "shared_cpu_list", package ? "2-3,6-7" : "0-1,4-5");
+	}
+
+	write_file(node, "possible", "0,2");
+	write_file(node + "/node0", "cpulist", "0-1,4-5");
+	write_file(node + "/node2", "cpulist", "2-3,6-7");
+
+	return root;
+}
+
+std::vector<std::size_t>
+members(const cpu_topology::cpuset_type &set)
+{
+	return std::vector<std::size_t>(set.begin(), set.end());
+}
+
+void
+test_canned(const std::string &root)
+{
+	using list = std::vector<std::size_t>;
+
+	cpu_topology topology(root);
+	check("cpus", topology.cpus().size() == 7 && topology.cpuset_size() == 7);
+	check("packages", topology.packages().size() == 2
+				  && members(topology.packages()[1]) == list({2, 3, 6}));
+	check("nodes", topology.nodes().size() == 2 && topology.cpu(6).node == 1
+			       && members(topology.nodes()[0]) == list({0, 1, 4, 5}));
+	check("cores", topology.cores().size() == 4 && topology.cpu(5).core == 1
+			       && topology.cpu(5).thread == 1 && topology.cpu(3).thread == 0);
+	check("siblings", members(topology.siblings(4)) == list({0, 4})
+				  && members(topology.siblings(3)) == list({3}));
+	check("l2", topology.l2_domains().size() == 4
+			    && topology.cpu(1).l2 == topology.cpu(5).l2);
+	const auto &l3 = topology.l3_domains();
+	check("l3", l3.size() == 2 && members(l3[topology.cpu(6).l3]) == list({2, 3, 6}));
+
+	cpu_placement compact(placement_policy::compact, topology);
+	check("compact", compact.order() == list({0, 4, 1, 5, 2, 6, 3}));
+	cpu_placement scatter(placement_policy::scatter, topology);
+	check("scatter", scatter.order() == list({0, 2, 1, 3, 4, 6, 5}));
+	cpu_placement one_per_core(placement_policy::one_per_core, topology);
+	check("one_per_core", one_per_core.order() == list({0, 1, 2, 3}));
+	check("wrap", members(one_per_core(5)) == list({1}) && one_per_core(5).size() == 7);
+}
+
+void
+test_missing()
+{
+	// No sysfs at all: every CPU is a core of its own.
+	cpu_topology topology("/nonexistent");
+	std::size_t count = topology.cpus().size();
+	check("fallback", count > 0 && topology.cores().size() == count
+				  && topology.packages().size() == 1
+				  && topology.nodes().size() == 1);
+}
+
+template <typename Pool>
+void
+test_pool(const std::string &name)
+{
+	cpu_topology topology;
+	cpu_placement placement(placement_policy::compact, topology);
+	Pool pool(2, placement);
+
+	bool ok = true;
+	for (std::size_t i = 0; i < pool.size(); i++) {
+		auto affinity = pool[i].affinity();
+		if (affinity.none())
+			continue; // affinity is not supported
+		if (affinity != placement(i))
+			ok = false;
+	}
+	check(name + " placement", ok);
+}
+
+// A placement on a CPU that the process may not use must fail without
+// leaving the started workers behind.
+template <typename Pool>
+void
+test_bad_pool(const std::string &name, const std::string &root)
+{
+	cpu_topology topology(root);
+	cpu_placement placement(placement_policy::compact, topology);
+
+	bool thrown = false;
+	try {
+		Pool pool(2, placement);
+	} catch (std::system_error &) {
+		thrown = true;
+	}
+	check(name + " bad placement", thrown);
+}
+
+int
+main()
+{
+	std::string root = make_canned_tree();
+	test_canned(root);
+	nftw(root.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	test_missing();
+	test_pool<thread_pool<queue>>("thread_pool");
+	test_pool<ws_thread_pool<queue>>("ws_thread_pool");
+
+	root = make_root();
+	write_file(root + "/devices/system/cpu", "online", "4095");
+	test_bad_pool<thread_pool<queue>>("thread_pool", root);
+	test_bad_pool<ws_thread_pool<queue>>("ws_thread_pool", root);
+	nftw(root.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -0,0 +1,115 @@
+#include "evenk/thread.h"
+#include "evenk/unbounded_queue.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace evenk;
+
+static constexpr int producer_num = 4;
+static constexpr int consumer_num = 4;
+static constexpr int test_count = 100 * 1000;
+
+static bool failed = false;
+
+void
+check(const std::string &name, bool ok)
+{
+	std::cout << name << (ok ? ": ok\n" : ": FAILED\n");
+	if (!ok)
+		failed = true;
+}
+
+template <typename Queue>
+void
+test_basic(const std::string &name)
+{
+	Queue queue;
+	std::string value;
+
+	check(name + " empty", queue.try_pop(value) == queue_op_status::empty && queue.is_empty());
+
+	// Cross a few segment boundaries.
+	bool ok = true;
+	for (int i = 0; i < 100; i++)
+		queue.push(std::to_string(i));
+	for (int i = 0; i < 100; i++)
+		ok = ok && queue.try_pop(value) == queue_op_status::success && value == std::to_string(i);
+	check(name + " fifo order", ok && queue.is_empty());
+
+	queue.push(std::string("last"));
+	queue.close();
+	check(name + " push when closed", queue.try_push(std::string("x")) == queue_op_status::closed);
+	auto status = queue.wait_pop(value);
+	check(name + " pop after close", status == queue_op_status::success && value == "last");
+	check(name + " pop when drained", queue.wait_pop(value) == queue_op_status::closed);
+}
+
+template <typename Queue>
+void
+test_concurrent(const std::string &name)
+{
+	Queue queue;
+
+	// Every consumer must see the values of every producer in order.
+	std::vector<std::vector<int>> last(consumer_num, std::vector<int>(producer_num, -1));
+	std::vector<long> sums(consumer_num);
+	bool ordered[consumer_num];
+
+	evenk::thread consumers[consumer_num];
+	for (int i = 0; i < consumer_num; i++) {
+		ordered[i] = true;
+		consumers[i] = evenk::thread([i, &queue, &last, &sums, &ordered] {
+			int value;
+			while (queue.wait_pop(value) == queue_op_status::success) {
+				int producer = value % producer_num;
+				int count = value / producer_num;
+				if (count <= last[i][producer])
+					ordered[i] = false;
+				last[i][producer] = count;
+				sums[i] += count;
+			}
+		});
+	}
+
+	evenk::thread producers[producer_num];
+	for (int i = 0; i < producer_num; i++) {
+		producers[i] = evenk::thread([i, &queue] {
+			for (int j = 0; j < test_count; j++)
+				queue.push(j * producer_num + i);
+		});
+	}
+	for (auto &t : producers)
+		t.join();
+	queue.close();
+	for (auto &t : consumers)
+		t.join();
+
+	long sum = 0;
+	bool ok = true;
+	for (int i = 0; i < consumer_num; i++) {
+		sum += sums[i];
+		ok = ok && ordered[i];
+	}
+	long expected = long(test_count) * (test_count - 1) / 2 * producer_num;
+	check(name + " concurrent order", ok);
+	check(name + " concurrent total", sum == expected);
+}
+
+int
+main()
+{
+	test_basic<unbounded_queue<std::string>>("unbounded_queue");
+	test_basic<unbounded_queue<std::string, 16>>("unbounded_queue<16>");
+
+	test_concurrent<unbounded_queue<int>>("unbounded_queue");
+	test_concurrent<unbounded_queue<int, 16>>("unbounded_queue<16>");
+
+	if (failed) {
+		std::cout << "FAILED\n";
+		return 1;
+	}
+	std::cout << "passed\n";
+	return 0;
+}
@@ -0,0 +1,168 @@
+#include "evenk/task.h"
+#include "evenk/ws_deque.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static constexpr int owner_count = 10 * 1000 * 1000;
+static constexpr int steal_count = 1000 * 1000;
+static constexpr int burst_size = 64;
+
+using int_task = evenk::task<int, 2 * evenk::fptr_size>;
+
+static int
+make_value(int i, int *)
+{
+	return i;
+}
+
+static int_task
+make_value(int i, int_task *)
+{
+	return [i] { return i; };
+}
+
+static int
+get_value(int v)
+{
+	return v;
+}
+
+static int
+get_value(int_task &t)
+{
+	return t();
+}
+
+//
+// Owner push and pop cost
+//
+
+template <typename Value>
+void
+bench_owner(std::string const &name)
+{
+	evenk::ws_deque<Value> deque;
+	Value value{};
+	long sum = 0;
+
+	// Go up and down with a small number of values at hand.
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < owner_count / burst_size; i++) {
+		for (int j = 0; j < burst_size; j++)
+			deque.push(make_value(j, &value));
+		for (int j = 0; j < burst_size; j++) {
+			deque.try_pop(value);
+			sum += get_value(value);
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> diff = end - start;
+
+	long expected = long(burst_size) * (burst_size - 1) / 2 * (owner_count / burst_size);
+	std::cout << name << " owner push/pop: ns/op=" << (diff.count() * 1e9 / owner_count / 2)
+		  << (sum == expected ? "" : ", FAILED") << "\n";
+}
+
+//
+// Steal throughput
+//
+
+template <typename Value>
+void
+steal(evenk::ws_deque<Value> &deque, std::atomic<bool> &done, long &sum, long &count)
+{
+	Value value{};
+	long s = 0, c = 0;
+	for (;;) {
+		auto status = deque.try_steal(value);
+		if (status == evenk::queue_op_status::success) {
+			s += get_value(value);
+			c++;
+		} else if (status == evenk::queue_op_status::empty) {
+			if (done.load(std::memory_order_acquire) && deque.is_empty())
+				break;
+			std::this_thread::yield();
+		}
+	}
+	sum = s;
+	count = c;
+}
+
+template <typename Value>
+void
+bench_steal(unsigned nthreads, std::string const &name)
+{
+	evenk::ws_deque<Value> deque;
+	std::atomic<bool> done(false);
+
+	std::vector<long> sums(nthreads + 1), counts(nthreads + 1);
+	std::vector<std::thread> thieves;
+	thieves.reserve(nthreads);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < nthreads; i++)
+		thieves.emplace_back(steal<Value>,
+				     std::ref(deque),
+				     std::ref(done),
+				     std::ref(sums[i]),
+				     std::ref(counts[i]));
+
+	// The owner pushes bursts of values and takes back a half of each.
+	Value value{};
+	long s = 0, c = 0;
+	for (int i = 0; i < steal_count; i += burst_size) {
+		for (int j = 0; j < burst_size; j++)
+			deque.push(make_value(i + j, &value));
+		for (int j = 0; j < burst_size / 2; j++) {
+			if (deque.try_pop(value) != evenk::queue_op_status::success)
+				break;
+			s += get_value(value);
+			c++;
+		}
+	}
+	while (deque.try_pop(value) == evenk::queue_op_status::success) {
+		s += get_value(value);
+		c++;
+	}
+	sums[nthreads] = s;
+	counts[nthreads] = c;
+
+	done.store(true, std::memory_order_release);
+	for (auto &t : thieves)
+		t.join();
+
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> diff = end - start;
+
+	long sum = 0;
+	for (auto v : sums)
+		sum += v;
+	long expected = long(steal_count) * (steal_count - 1) / 2;
+
+	std::cout << name << " steal: thieves=" << nthreads
+		  << ", stolen=" << (steal_count - c)
+		  << ", ops/sec=" << (steal_count / diff.count())
+		  << ", duration=" << diff.count()
+		  << (sum == expected ? "" : ", FAILED") << "\n";
+}
+
+int
+main()
+{
+	bench_owner<int>("int");
+	bench_owner<int_task>("task");
+	std::cout << "\n";
+
+	unsigned n = std::thread::hardware_concurrency();
+	for (unsigned i = 1; i <= n; i += std::min(i, 8u)) {
+		bench_steal<int>(i, "int");
+		bench_steal<int_task>(i, "task");
+	}
+	return 0;
+}